@@ -1,3 +1,5 @@
+#define _GNU_SOURCE //for statx and the other Linux specific definitions
+
 #include <stdio.h>
 #include <string.h>
 #include <dirent.h>
@@ -8,10 +10,63 @@
 #include <fcntl.h>
 #include <time.h>
 #include <linux/limits.h>
+#include <limits.h>
 #include <libgen.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <stdarg.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
 
-#define MAX_LINE 128
+#define DEFAULT_DIR_BUFFER_SIZE (1 << 20) //size of the buffer used for reading directory entries with getdents64 (1 MiB)
+#define LIBC_DIR_BUFFER_SIZE 32768         //size of the internal buffer used by readdir (used only for the statistics)
+#define MAX_SCAN_THREADS 1024
+#define MAX_TASK_FDS 1024                  //max no. of directory fds kept open for the directories waiting in the deques
+#define MAX_URING_DEPTH 4096
+#define DEFAULT_MAX_OPEN_DIRS 64           //max no. of directory fds kept open by the sequential traversal
+#define DEFAULT_WRITE_BUFFER_SIZE (4 << 20) //size of the buffer of the snapshot writer (4 MiB)
+#define WRITE_CHUNK_SIZE (256 << 10)       //the buffer is made of chunks of this size, written together with writev
+#define MAX_WRITE_BUFFER_SIZE (256 << 20)
+#define COMPARE_BLOCK_SIZE (1 << 20)       //the snapshots are compared in blocks of 1 MiB
+#define DEFAULT_COMPARE_MEMORY (256 << 20) //memory for sorting the snapshots that are not sorted by path (256 MiB)
+#define MIN_COMPARE_MEMORY (4 << 20)
+#define MIN_RUN_BUFFER_SIZE (64 << 10)     //each sorted run is read through a buffer of at least 64 KiB while merging
+#define MAX_COMPARE_THREADS 256
+#define COMPARE_SHARDS_PER_THREAD 4        //the snapshots are split in 4 shards for each comparing thread (for balancing)
+#define CURSOR_RELEASE_INTERVAL 65536      //a binary snapshot cursor releases the pages already read every 65536 records
+#define MERKLE_TREE_MAGIC "OSMERKL2"        //first bytes of the hash tree of the snapshot ("DIR_Snapshot.merkle")
+#define BINARY_SNAPSHOT_MAGIC "OSSNAP01"    //first bytes of the snapshots written with "--format=binary"
+#define BINARY_SNAPSHOT_VERSION 3          //version 2 added the device of the entries, version 3 the content hash
+#define RECORD_HAS_CONTENT_HASH 1          //flag of a binary record whose content_hash is set
+#define PATH_RESTART_INTERVAL 16           //every 16th path of a binary snapshot is stored entirely (not prefix compressed)
+#define SCAN_CACHE_MAGIC "OSCACHE3"         //first bytes of the cache used by "--incremental"
+#define HASH_CACHE_MAGIC "OSHASH01"         //first bytes of the cache of the content hashes ("DIR_Hash.cache")
+#define DEFAULT_JOURNAL_COMPACTION 25      //with "--journal" a new base snapshot is written when the journal has 25% of its size
+#define DEFAULT_HISTORY_GENERATIONS 8      //with "--history" the last 8 compacted journals are kept with their bases
+#define DEFAULT_CONTENT_HASH_THREADS 4     //no. of threads hashing the content of the files with "--content-hash"
+#define MAX_CONTENT_HASH_THREADS 256
+#define DEFAULT_WATCH_LATENCY 100          //with "--watch" the changes are written 100 ms after the first event
+#define MAX_WATCH_CHANGES 1048576          //more paths changed before they are applied => the directory is parsed again
+#define WATCH_HANDLE_CACHE_SIZE 4096       //directories resolved from their file handles kept with "--watch-backend=fanotify"
+#define CONTENT_HASH_BUFFER_SIZE (1 << 20) //each hashing thread reads the files in blocks of 1 MiB (aligned to a page)
+#define CONTENT_HASH_WINDOW 4096           //max no. of records waiting in the snapshot writer for their content hash
+#define CONTENT_PRIME_1 0x9E3779B185EBCA87ULL //the primes of the content hash (XXH64)
+#define CONTENT_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define CONTENT_PRIME_3 0x165667B19E3779F9ULL
+#define CONTENT_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define CONTENT_PRIME_5 0x27D4EB2F165667C5ULL
 
 int count_processes=0; //counts the no. child procesess for each monitored directory
 int count_grandchild_procesess=0; //counts the no. grandchild processes for each child process 
@@ -19,288 +74,8488 @@ int count_corrupted=0; //counts the no. of files with potential danger
 
 const char *monitored_directory; //stores only the name of the monitored directory (not the full path)
 
+size_t dir_buffer_size=DEFAULT_DIR_BUFFER_SIZE; //size of the getdents64 buffer, can be changed with "--dir-buffer=SIZE"
+int scan_threads=1;  //no. of worker threads parsing one monitored directory, can be changed with "--threads=N"
+int max_open_dirs=DEFAULT_MAX_OPEN_DIRS; //can be changed with "--max-open-dirs=N"
+int incremental_mode=0;  //"--incremental" => 1 (the listing of the unchanged directories is taken from the cache),
+                         //"--incremental=prune" => 2 (the information of their files is taken from the cache too)
+unsigned int uring_depth=0;  //queue depth of the io_uring used for statx, "--uring-depth=N" (0 => fstatat is used)
+size_t write_buffer_size=DEFAULT_WRITE_BUFFER_SIZE; //can be changed with "--write-buffer=SIZE"
+int write_uring=0;       //"--write-uring" => the snapshot is written with io_uring (while the next records are encoded)
+int binary_snapshots=0;  //"--format=binary" => the snapshots are written in the binary format
+int one_file_system=0;   //"--one-file-system" => the directories from other file systems (mount points) are not parsed
+int diff_mode=0;         //"--diff" => the entries added, removed, modified and renamed are printed when comparing the snapshots
+int journal_compaction=0;    //"--journal[=P]" => only the changes are appended to a journal, compacted into a new base
+                             //snapshot when it reaches P% of the size of the base (0 => a complete snapshot in every run)
+int compare_threads=1;       //"--compare-threads=N" => the snapshots are split in shards compared by N threads
+size_t compare_memory=0;     //"--compare-memory=SIZE" => the snapshots are compared with an external sort in this memory
+int history_generations=0;   //"--history[=N]" => the compacted journals are kept with their bases (N generations)
+int content_hash_threads=0; //"--content-hash[=N]" => the regular files are hashed by N threads (0 => no content hashes)
+int watch_latency=0;         //"--watch[=MS]" => the directories are watched with inotify and the changes written after MS ms
+int watch_fanotify=0;        //"--watch-backend=fanotify" => the file systems of the directory are watched with fanotify
+volatile sig_atomic_t watch_stopping=0; //set by SIGINT or SIGTERM => the watch mode writes the pending changes and stops
+unsigned int statx_mask=STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_NLINK | STATX_INO; //only the fields recorded in the snapshot
+                                                                                        //(and the inode, for the visited directories)
+
+//the statistics are updated with atomic operations because they are shared by the worker threads
+long count_directories=0;       //counts the no. of directories read during the scan
+long count_dir_entries=0;       //counts the no. of entries returned by getdents64 (without "." & "..")
+long count_getdents_calls=0;    //counts the no. of getdents64 syscalls made
+long count_readdir_calls=0;     //estimates the no. of getdents64 syscalls readdir would have made with its buffer
+long count_reopened_dirs=0;     //counts the no. of directories opened again because of the limit of open directories
+long count_statx_requests=0;    //counts the no. of statx requests submitted through io_uring
+long count_uring_enters=0;      //counts the no. of io_uring_enter syscalls made for them
+long count_excluded_entries=0;  //counts the no. of entries excluded by the filters (without the content of the directories)
+long count_pruned_dirs=0;       //counts the no. of excluded directories (not opened)
+long count_skipped_mounts=0;    //counts the no. of mount points not crossed with "--one-file-system"
+long count_duplicate_dirs=0;    //counts the no. of directories not parsed again (bind mounts of a directory already parsed)
+long count_snapshot_writes=0;   //counts the no. of writev calls (or io_uring writes) made for the snapshot
+long count_snapshot_bytes=0;    //counts the no. of bytes written in the snapshot
+long count_reused_analyses=0;   //counts the no. of hard links that reused the result of the analysis of their inode
+long count_hashed_files=0;      //counts the no. of files whose content was hashed
+long count_hashed_bytes=0;      //counts the no. of bytes read for the content hashes
+long count_unhashed_files=0;    //counts the no. of regular files that could not be read (their records have no content hash)
+long count_cached_hashes=0;     //counts the no. of content hashes taken from the hash cache (the files were not read)
+
 
 /*
     FUNCTION PROTOTYPES
 */
 /*
-    Parses through the directory (given as argument for monitoring) and his sub_directories recursively.
-    Writes in the snapshot file the full path and other file information (allocated dinamically) for all entries.
+    Stores the printable path of the entry that is parsed. The buffer is shared by all the levels of the traversal: 
+    the name of an entry is appended before writing its record and the path is truncated back after that.
 */
-void ReadDirectories(const char *path, int snapshot_fd, char *isolated_path);
+typedef struct{
+    char *data;
+    size_t length;
+    size_t capacity;
+}PathBuffer;
 
 
 /*
-    Creates a snapshot file in the output directory. The name of the snapshot file contains the name of the monitored
-    directory and a timestamp. This function calls read_directories (for parsing through the directory) and GetPreviousSnapshotThenCompare
-    (for comparing the current snapshot with the previous one).
+    Appends "/name" to the path buffer (growing it if needed). Returns the previous length of the path, used for
+    truncating the buffer back, or -1 if the allocation of memory fails.
 */
-void CreateSnapshot(char *path, char *output_path, char *isolated_path);
+ssize_t AppendToPath(PathBuffer *path, const char *name);
 
 
 /*
-    Parses through the files from the output directory that contains the name of the monitored dir and calls the
-    compare_snapshots function if two snapshot are found. Otherwise, no comparation is made. 
-    After comparation, if a difference is found, the previous snapshot is overriden.
+    Layout of the records returned by the getdents64 syscall (struct linux_dirent64).
 */
-void GetPreviousSnapshotThenCompare(const char *output_path, const char *snapshot_file_name);
+struct linux_dirent64{
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
 
 
 /*
-    Compares the current snapshot (created when the program is executed) with the previous snapshot found in the output dir. 
-    Returns 1 if a difference is found, 0 if the snapshot are identical and -1 in case of errors.
+    Stores all the entries of a directory (without "." & ".."), read in bulk with getdents64. The names are kept one
+    after another in a single buffer, each entry storing the offset of its name and the type reported by the kernel.
 */
-int CompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name);
+typedef struct{
+    size_t name_offset;
+    unsigned char d_type;
+    ino_t d_ino;
+}ListingEntry;
+
+typedef struct{
+    ListingEntry *entries;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_length;
+    size_t names_capacity;
+}DirListing;
+
+
+/*
+    Reads all the entries of the directory dir_fd into the listing by calling getdents64 with the given buffer and walking
+    the returned records in place. Returns 0 on success and -1 in case of errors.
+*/
+int ReadDirectoryListing(int dir_fd, DirListing *listing, char *buffer, size_t buffer_size);
+
+
+/*
+    Adds an entry at the end of a listing. Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int AppendListingEntry(DirListing *listing, const char *name, size_t name_length, unsigned char d_type, ino_t d_ino);
+
+
+/*
+    Frees the memory used by a directory listing.
+*/
+void FreeDirListing(DirListing *listing);
+
+
+/*
+    Sorts the entries of a listing by name (with strcmp), so the snapshots have the same order in every run and on 
+    every file system, whatever the order returned by getdents64.
+*/
+void SortDirListing(DirListing *listing);
+
+
+/*
+    A filter given with "--exclude=PATTERN", "--include=PATTERN" or read from "--filter-file=FILE". The rules are 
+    checked in the order they were given and the first one matching an entry decides if it is excluded (the entries
+    matched by no rule are included). A pattern with '/' is matched against the path relative to the monitored 
+    directory, otherwise against the name of the entry, and a pattern ending with '/' matches only directories.
+*/
+typedef struct{
+    char *pattern;               //without the leading and the trailing '/'
+    size_t length;
+    int include;
+    int dir_only;
+    int anchored;                //matched against the relative path
+    int kind;                    //FILTER_LITERAL, FILTER_SUFFIX ("*.ext"), FILTER_PREFIX ("name*") or FILTER_GLOB (fnmatch)
+}FilterRule;
+
+enum{FILTER_LITERAL, FILTER_SUFFIX, FILTER_PREFIX, FILTER_GLOB};
+
+/*
+    The rules compiled at startup. The literal names are looked up in a hash table, so only the patterns with 
+    wildcards (and the ones given before the first literal that matches) are checked for each entry.
+*/
+typedef struct{
+    FilterRule *rules;
+    size_t count;
+    size_t capacity;
+    size_t *name_index;          //open addressing table with the literal name rules (index +1, 0 is empty)
+    size_t index_capacity;
+    size_t *other_rules;         //the rest of the rules, in their order
+    size_t other_count;
+    int has_dir_only;            //the type of the entries with DT_UNKNOWN is needed
+    int has_anchored;            //the relative path of the entries is needed
+    char *header;                //the active rules, written at the beginning of the snapshot
+    size_t header_length;
+}FilterSet;
+
+FilterSet filters={0}; //the rules given in the command line (no rule => the entire directory is parsed)
+
+
+/*
+    Adds a rule at the end of the filters. Returns 0 on success and -1 if the pattern is empty or the allocation of 
+    memory fails.
+*/
+int AddFilterRule(const char *pattern, int include);
+
+
+/*
+    Adds the rules from a file, one on each line: "exclude PATTERN" or "include PATTERN" (empty lines and lines starting
+    with '#' are skipped). Returns 0 on success and -1 in case of errors.
+*/
+int ReadFilterFile(const char *file_name);
+
+
+/*
+    Builds the hash table of the literal names and the header of the snapshot. Returns 0 on success and -1 if the
+    allocation of memory fails.
+*/
+int CompileFilters(FilterSet *set);
+
+
+/*
+    Returns the index of the first rule matching an entry (given by its name and its path relative to the monitored
+    directory) or -1 if no rule matches it.
+*/
+long MatchFilters(const FilterSet *set, const char *name, const char *relative_path, int is_dir);
+
+
+/*
+    Removes from a listing the entries excluded by the filters, before their information is read (the type of the 
+    entries is taken from d_type, so the excluded directories are never opened). relative_path is the path of the 
+    directory relative to the monitored directory ("" for the root). Returns 0 on success and -1 if the allocation 
+    of memory fails.
+*/
+int FilterListing(int dir_fd, DirListing *listing, const char *relative_path);
+
+
+/*
+    Cache of the directories parsed in the previous run of a monitored directory, used by "--incremental". For each 
+    directory the cache keeps its identity, mtime and ctime and the names and information of its entries. A directory
+    whose mtime and ctime did not change has the same entries, so its listing is taken from the cache instead of being
+    read again (and, with "--incremental=prune", the information of its files too, without fstatat).
+    The previous cache is mapped in memory and indexed by path; the new one is written while parsing and replaces it
+    (with rename) at the end of the scan.
+*/
+typedef struct{
+    char *map;                   //previous cache
+    size_t map_size;
+    size_t *index;               //open addressing table with the offsets of the directories in map (+1, 0 is empty)
+    size_t index_capacity;
+    FILE *output;                //new cache (temporary file)
+    char *temp_name;
+    char *file_name;
+    time_t scan_start;           //the directories changed after this time are not cached (their mtime could change again
+                                 //in the same second)
+    int failed;                  //writing the new cache failed => the previous cache is kept
+    long hits;                   //no. of directories taken from the cache
+    long saved_stats;            //no. of fstatat calls saved with "--incremental=prune"
+}ScanCache;
+
+ScanCache *scan_cache=NULL; //cache of the previous scan of the monitored directory (NULL without "--incremental")
+
+
+/*
+    Maps the previous cache of the monitored directory (if it exists) and creates the new cache file in the output directory.
+    Returns 0 on success and -1 in case of errors.
+*/
+int OpenScanCache(ScanCache *cache, const char *output_path, const char *dir_name);
+
+
+/*
+    Looks up a directory (by its path relative to the monitored directory) in the previous cache. Returns its record 
+    if it is found with the same identity, mtime and ctime, otherwise NULL.
+*/
+const char *LookupScanCache(ScanCache *cache, const char *relative_path, const struct stat *dir_st);
+
+
+/*
+    Fills the listing of a directory from its record in the cache. Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int ReadCachedListing(const char *record, DirListing *listing);
+
+
+/*
+    Fills the information of the entries of a directory from its record in the cache (stats must have one element for each entry).
+*/
+void ReadCachedStats(const char *record, struct stat *stats);
+
+
+/*
+    Writes a parsed directory (its first count entries, with their information) in the new cache.
+*/
+void AppendScanCache(ScanCache *cache, const char *relative_path, const struct stat *dir_st, const DirListing *listing, const struct stat *stats);
+
+
+/*
+    Unmaps the previous cache and replaces it with the new cache (if it was written without errors).
+*/
+void CloseScanCache(ScanCache *cache);
+
+
+/*
+    An io_uring used for getting the information of the entries of a directory with batched statx requests.
+    The statx buffers are owned by the ring (one for each request that can be in flight).
+*/
+typedef struct{
+    int ring_fd;
+    unsigned int depth;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    struct statx *buffers;
+    unsigned int *free_slots;    //stack of the statx buffers not used by a request in flight
+    unsigned int free_count;
+    int failed;                  //io_uring_enter failed => the ring is not used anymore (fstatat is used instead)
+}StatxRing;
+
+
+/*
+    Creates an io_uring with the given queue depth. Returns 0 on success and -1 in case of errors 
+    (e.g. io_uring is not supported or disabled), when the entries are read with fstatat.
+*/
+int SetupStatxRing(StatxRing *ring, unsigned int depth);
+
+
+/*
+    Closes the io_uring and frees its buffers.
+*/
+void CloseStatxRing(StatxRing *ring);
+
+
+/*
+    Gets the information of all the entries of a listing with statx requests submitted in batches of the queue depth,
+    consuming the completions as they arrive. result[i] is 0 if stats[i] was filled and -1 if the entry could not be read.
+    Returns 0 on success and -1 if the ring can't be used anymore (the requests of the listing are withdrawn or waited
+    for first, so no request is left in the ring).
+*/
+int StatListingWithRing(StatxRing *ring, int dir_fd, const DirListing *listing, struct stat *stats, int *result);
+
+
+/*
+    Computes the FNV-1a hash of a buffer.
+*/
+uint64_t HashBytes(const void *data, size_t length);
+
+
+/*
+    Continues an FNV-1a hash with the bytes of a buffer (the hash of data split in several buffers is the same as the
+    hash of all the data).
+*/
+uint64_t UpdateHash(uint64_t hash, const void *data, size_t length);
+
+
+/*
+    Layout of a directory and of its entries in the cache used by "--incremental". A directory is stored as its header, 
+    its path (relative to the monitored directory) and, for each entry, the header of the entry followed by its name.
+*/
+typedef struct{
+    uint32_t record_length;
+    uint32_t path_length;
+    uint32_t entry_count;
+    uint32_t reserved;
+    uint64_t dev, ino;
+    int64_t mtime_sec, mtime_nsec, ctime_sec, ctime_nsec;
+}CacheDirHeader;
+
+typedef struct{
+    uint64_t size, nlink, dev, ino;
+    int64_t mtime_sec, mtime_nsec, ctime_sec, ctime_nsec;
+    uint32_t mode;
+    uint32_t name_length;
+}CacheEntryHeader;
+
+
+/*
+    Buffer in which the records of the snapshot are encoded. It is reused for all the entries, so it grows only for 
+    a longer path.
+*/
+typedef struct{
+    char *data;
+    size_t length;
+    size_t capacity;
+}RecordBuffer;
+
+
+/*
+    The chunks of the snapshot writer, filled one after another and written together.
+*/
+typedef struct{
+    RecordBuffer *chunks;
+    size_t count;                //no. of chunks used
+    size_t capacity;             //no. of chunks allocated (kept for the next records)
+    size_t length;               //no. of bytes in the chunks
+    struct iovec *iov;           //the chunks given to writev (or to the io_uring write)
+    size_t iov_capacity;
+}ChunkSet;
+
+
+/*
+    Layout of a binary snapshot ("--format=binary"): the header, the array of records (in the order of the text snapshot),
+    the table of paths and the filters (the same text as at the beginning of a text snapshot). Every path in the table is
+    stored as the no. of bytes shared with the previous path and the rest of the path (both lengths as varints), except
+    every PATH_RESTART_INTERVAL-th path, which is stored entirely, so a path can be decoded starting from the closest 
+    restart. All the numbers are in the byte order of the machine and the file is read through mmap.
+*/
+typedef struct{
+    char magic[8];
+    uint32_t version;
+    uint32_t restart_interval;
+    uint64_t record_count;
+    uint64_t records_offset;
+    uint64_t strings_offset;
+    uint64_t strings_length;
+    uint64_t filters_offset;
+    uint64_t filters_length;
+}SnapshotFileHeader;
+
+typedef struct{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    uint64_t nlink;
+    uint64_t path_offset;        //offset of the path in the table of paths
+    uint64_t content_hash;       //only with RECORD_HAS_CONTENT_HASH in flags
+    uint32_t mode;
+    uint32_t mtime_nsec;
+    uint32_t flags;
+    uint32_t reserved;
+}SnapshotFileRecord;
+
+//the records of the older versions of the format (still read, the snapshots are written with the last version)
+typedef struct{
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    uint64_t nlink;
+    uint64_t path_offset;
+    uint32_t mode;
+    uint32_t mtime_nsec;
+}SnapshotFileRecordV1;
+
+typedef struct{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    uint64_t nlink;
+    uint64_t path_offset;
+    uint32_t mode;
+    uint32_t mtime_nsec;
+}SnapshotFileRecordV2;
+
+
+/*
+    A binary snapshot mapped in memory.
+*/
+typedef struct{
+    char *map;
+    size_t map_size;
+    const SnapshotFileHeader *header;
+    const char *records;         //read with ReadSnapshotRecord (their size depends on the version)
+    size_t record_size;
+    const unsigned char *strings;
+}MappedSnapshot;
+
+
+/*
+    Reads the records of a snapshot one by one, in the text or in the binary format (detected from the first bytes). Only
+    the current and the previous record are kept in memory, so two snapshots can be compared in a single pass. The text
+    format has only the access rights (not the type) and no inode or mtime, so these fields are 0. The content hash of a
+    file is optional in both formats.
+*/
+typedef struct{
+    int binary;
+    FILE *file;              //text format
+    char *line;
+    size_t line_capacity;
+    long line_no;
+    int pending;             //the line buffer holds a line that was read but not parsed
+    RecordBuffer filters;    //the "Filter: " lines from the beginning of a text snapshot
+    MappedSnapshot mapped;   //binary format
+    uint64_t index;
+    const char *filters_data;
+    size_t filters_length;
+    PathBuffer path;         //the current record
+    PathBuffer previous_path;
+    struct stat st;
+    uint64_t content_hash;
+    int has_content_hash;    //the record has a content hash ("--content-hash")
+    int sorted;              //0 after a path that is not after the previous one (a snapshot of an older version)
+}SnapshotCursor;
+
+
+/*
+    Hash tree of a snapshot: one node for each directory (and one for the monitored directory, the root). The hash of a
+    record covers its name, size, access rights, no. of hard links and content hash; the hashes of the other entries of a
+    directory are folded in the files hash of its node, and the hash of the node is the hash of its record followed by the
+    hashes of its sub-directories and its files hash, so two directories with the same hash have the same entries. The
+    nodes are in the order of the records (pre-order) and each node stores the size of its subtree, so the children of a
+    node are found by skipping subtrees. The tree is built from the records given to the snapshot writer and saved in the
+    output directory with the manifest, so comparing two snapshots descends only into the directories whose hashes differ.
+*/
+typedef struct{
+    uint64_t hash;               //hash of the record and of the subtree
+    uint64_t record_hash;        //hash of the record only
+    uint64_t files_hash;         //hash of the records of the entries that are not directories
+    uint64_t subtree_size;       //no. of nodes in the subtree (with the node), the next sibling is at index + subtree_size
+    uint64_t entry_count;        //no. of records in the subtree (with the directory, except for the root)
+    uint64_t name_offset;        //offset of the name (not the full path) in the names
+    uint32_t name_length;
+    uint32_t reserved;
+}MerkleNode;
+
+typedef struct{
+    char magic[8];
+    uint64_t node_count;
+    uint64_t names_length;
+    uint64_t root_hash;
+}MerkleFileHeader;
+
+typedef struct{
+    size_t node;                 //index of the directory
+    size_t path_length;          //length of its path
+    uint64_t first_record;       //no. of records added before the directory
+}MerkleFrame;
+
+typedef struct{
+    MerkleNode *nodes;
+    size_t count;
+    size_t capacity;
+    RecordBuffer names;
+    MerkleFrame *frames;         //the directories whose records are being added (from the root to the current one)
+    size_t depth;
+    size_t frame_capacity;
+    RecordBuffer dir_path;       //the path of the current directory
+    uint64_t record_count;       //no. of records added
+    int failed;                  //the allocation of memory failed => the tree is not used
+    char *map;                   //the tree loaded from the output directory (read only)
+    size_t map_size;
+}MerkleTree;
+
+
+/*
+    Creates a tree with only the root. The hash of the filters is the hash of the root's record, so the trees of two 
+    snapshots with different filters are different.
+*/
+void InitMerkleTree(MerkleTree *tree, uint64_t filters_hash);
+
+
+/*
+    Adds a record given in the order of the snapshot, finishing the directories that do not contain it. A directory gets
+    its own node, the hash of another entry is added to the files hash of its directory.
+*/
+void AddMerkleRecord(MerkleTree *tree, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash);
+
+
+/*
+    Finishes all the directories after the last record (the hash of the root is the hash of the snapshot). Returns 0 
+    on success and -1 if the tree is not complete.
+*/
+int FinishMerkleTree(MerkleTree *tree);
+
+
+/*
+    Saves the tree in the output directory (through a temporary file). Returns 0 on success and -1 in case of errors.
+*/
+int WriteMerkleTree(const MerkleTree *tree, const char *output_path, const char *dir_name);
+
+
+/*
+    Maps the tree saved for the monitored directory and checks it. Returns 0 on success and -1 if it is not valid.
+*/
+int LoadMerkleTree(MerkleTree *tree, const char *output_path, const char *dir_name);
+
+
+/*
+    Frees (or unmaps) a tree.
+*/
+void FreeMerkleTree(MerkleTree *tree);
+
+
+/*
+    Compares two trees, descending only into the nodes whose hashes differ. An added or removed directory is counted
+    with its entire subtree (without visiting it), the directories whose files hashes differ are counted in changed (the
+    files are not in the tree). Returns the no. of nodes visited.
+*/
+long CompareMerkleTrees(const MerkleTree *prev, const MerkleTree *current, long *added, long *removed, long *modified, long *changed);
+
+
+/*
+    State of the content hash of a file (the XXH64 algorithm). The data is consumed in stripes of 32 bytes by four
+    independent lanes, so the multiplications of a stripe do not wait for the previous ones and the hash runs close to
+    the speed of memory.
+*/
+typedef struct{
+    uint64_t lanes[4];
+    uint64_t total_length;
+    unsigned char stripe[32];    //the bytes of an incomplete stripe
+    size_t stripe_length;
+}ContentHashState;
+
+
+/*
+    Starts the content hash of a file.
+*/
+void StartContentHash(ContentHashState *state);
+
+
+/*
+    Adds data to the content hash.
+*/
+void UpdateContentHash(ContentHashState *state, const void *data, size_t length);
+
+
+/*
+    Returns the content hash of the data added so far.
+*/
+uint64_t FinishContentHash(const ContentHashState *state);
+
+
+/*
+    Reads a regular file in blocks of CONTENT_HASH_BUFFER_SIZE (into the aligned buffer of the thread) and computes its
+    content hash. The file must still be the inode from the record. Returns 0 on success, 1 if the file was hashed but
+    its size, mtime or ctime are not the ones from the record anymore (the hash is not cached) and -1 if it can't be read.
+*/
+int HashFileContent(const char *path, const struct stat *st, char *buffer, uint64_t *hash);
+
+
+/*
+    Cache of the content hashes from the previous scan of a monitored directory ("DIR_Hash.cache" in the output
+    directory). A file whose device, inode, size, mtime and ctime did not change has the same content, so its hash is 
+    taken from the cache without reading it. The cache is an open addressing table (indexed by device and inode) with
+    fixed-size entries, mapped in memory as it is. The new table is built in memory while the records are written 
+    and replaces the previous one at the end of the scan (written in a temporary file, synced and renamed, so a crash
+    leaves the previous table or the new one, never a partial table). Only the files found in the scan are kept.
+*/
+typedef struct{
+    char magic[8];
+    uint64_t capacity;           //no. of entries (a power of 2)
+    uint64_t count;              //no. of entries used
+    uint64_t reserved;
+}HashCacheHeader;
+
+typedef struct{
+    uint64_t dev, ino;           //ino 0 => empty entry
+    int64_t size;
+    int64_t mtime_sec, ctime_sec;
+    uint32_t mtime_nsec, ctime_nsec;
+    uint64_t hash;
+}HashCacheEntry;
+
+typedef struct{
+    char *map;                   //previous table
+    size_t map_size;
+    const HashCacheEntry *entries;
+    size_t capacity;
+    HashCacheEntry *table;       //new table
+    size_t table_capacity;
+    size_t table_count;
+    char file_name[PATH_MAX];
+    char temp_name[PATH_MAX];
+    time_t scan_start;           //the files changed after this time are not cached (they could change again in the same second)
+    int failed;                  //the allocation of memory failed => the previous table is kept
+}HashCache;
+
+
+/*
+    Maps the previous table of the monitored directory (if it exists and it is valid) and creates the new table.
+    Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int OpenHashCache(HashCache *cache, const char *output_path, const char *dir_name);
+
+
+/*
+    Looks up a file in the previous table. Returns 1 and stores its hash if it is found with the same device, inode,
+    size, mtime and ctime, otherwise 0.
+*/
+int LookupHashCache(const HashCache *cache, const struct stat *st, uint64_t *hash);
+
+
+/*
+    Adds the hash of a file to the new table (growing it when it is half full).
+*/
+void AddHashCache(HashCache *cache, const struct stat *st, uint64_t hash);
+
+
+/*
+    Writes the new table in place of the previous one (if no error occurred) and frees the cache.
+*/
+void CloseHashCache(HashCache *cache);
+
+
+/*
+    A record waiting in the snapshot writer for the content hash of its file.
+*/
+typedef struct{
+    PathBuffer path;             //the buffer is reused by the next records that get the same slot
+    struct stat st;
+    uint64_t content_hash;
+    int state;                   //HASH_PENDING, HASH_READY or HASH_NONE (not a regular file or the file can't be read)
+    int cacheable;               //the hash is the one of the content described by st (it is added to the hash cache)
+}HashJob;
+
+enum{HASH_PENDING, HASH_READY, HASH_NONE};
+
+
+/*
+    Threads hashing the content of the files while the directories are parsed ("--content-hash"). The records are
+    added in the order of the snapshot to a window of CONTENT_HASH_WINDOW slots, hashed by the threads in any order 
+    and written by the snapshot writer in the same order, as soon as the first ones are ready. The traversal waits
+    only when the window is full.
+*/
+typedef struct{
+    HashJob *jobs;
+    size_t head;                 //first record not written yet
+    size_t next;                 //next record to be taken by a thread (never before head)
+    size_t tail;                 //no. of records added
+    pthread_t *threads;
+    int thread_count;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;    //a record was added (or the threads must stop)
+    pthread_cond_t done_cond;    //a record was hashed
+    HashCache *cache;            //the hashes of the previous scan (NULL => every file is read)
+}HashPool;
+
+
+/*
+    Creates the window and starts the hashing threads. Returns 0 on success and -1 in case of errors.
+*/
+int StartHashPool(HashPool *pool, int thread_count);
+
+
+/*
+    Function executed by the hashing threads (each with its own read buffer).
+*/
+void *HashWorker(void *arg);
+
+
+/*
+    Stops the hashing threads and frees the window (all the records must be written before).
+*/
+void StopHashPool(HashPool *pool);
+
+
+/*
+    Buffered writer of the snapshot file. The records are encoded in the chunks of the current set and the set is written
+    with writev when it has write_buffer_size bytes. With "--write-uring" the set is submitted as an io_uring write and
+    the records are encoded in the other set in the meantime.
+    In the binary format the records are written the same way, while the table of paths goes to a temporary file (a chunk
+    at a time) and is copied at the end, followed by the filters and the header (at the beginning of the file).
+*/
+typedef struct{
+    int fd;
+    int binary;
+    uint64_t record_count;       //no. of records written
+    uint64_t hash;               //FNV-1a of the bytes written through the chunks (recorded in the manifest)
+    MerkleTree *tree;            //the records are added to the hash tree (NULL => no tree)
+    HashPool *hashes;            //the records wait for the content hashes of their files (NULL => no content hashes)
+    RecordBuffer strings;        //binary format: the end of the table of paths (not yet in the temporary file)
+    int strings_fd;              //binary format: the temporary file with the beginning of the table of paths
+    uint64_t strings_written;    //binary format: no. of bytes of the table in the temporary file
+    RecordBuffer previous_path;  //binary format: the last path (for the prefix compression)
+    const char *filters;         //binary format: the filters written at the end
+    size_t filters_length;
+    ChunkSet sets[2];
+    int current;                 //the set filled with records
+    size_t chunk_size;
+    StatxRing *ring;             //NULL => writev
+    int in_flight;               //the other set was submitted and its write is not completed
+    size_t in_flight_length;
+    off_t offset;                //offset of the next write in the file
+    int failed;                  //a write failed
+}SnapshotWriter;
+
+char permission_strings[512][12]; //"rwx rwx rwx" for each value of st_mode & 0777, filled by BuildPermissionTable
+
+
+/*
+    Fills the table with the access rights as text for all the 512 values of the permission bits.
+*/
+void BuildPermissionTable(void);
+
+
+/*
+    Writes the decimal digits of a number ending at end (backwards, two digits at a time). Returns the first digit.
+*/
+char *FormatUnsigned(char *end, unsigned long long value);
+
+
+/*
+    Makes room in the buffer for length more bytes. Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int ReserveRecordBuffer(RecordBuffer *buffer, size_t length);
+
+
+/*
+    Appends to the buffer the record of an entry (path, size, access rights and no. of hard links) followed by "\n",
+    without formatting it with printf. Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int EncodeSnapshotRecord(RecordBuffer *buffer, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash);
+
+
+/*
+    Prepares the writer for the snapshot file fd (with io_uring if "--write-uring" is given and it can be created).
+    For the binary format, the filters are written at the end of the snapshot and the table of paths waits in a temporary
+    file in the directory of file_name.
+*/
+void OpenSnapshotWriter(SnapshotWriter *writer, int fd, const char *file_name, int binary, const char *filters, size_t filters_length);
+
+
+/*
+    Returns the chunk of the current set with room for length bytes (starting a new chunk if the last one is full) 
+    or NULL if the allocation of memory fails.
+*/
+RecordBuffer *ReserveSnapshotChunk(SnapshotWriter *writer, size_t length);
+
+
+/*
+    Appends bytes to the snapshot (used for the header and for the sections of the binary format). Returns 0 on success 
+    and -1 if the allocation of memory fails.
+*/
+int WriteSnapshotData(SnapshotWriter *writer, const char *data, size_t length);
+
+
+/*
+    Encodes in the writer the record of an entry (path, size, access rights and no. of hard links) followed by "\n".
+    Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int WriteSnapshotRecord(SnapshotWriter *writer, const char *path, size_t path_length, const struct stat *st);
+
+
+/*
+    Writes a record with its content hash (NULL => without a content hash), adding it to the hash tree. Returns 0 on
+    success and -1 if the allocation of memory fails.
+*/
+int AppendSnapshotRecord(SnapshotWriter *writer, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash);
+
+
+/*
+    Writes the records from the beginning of the window of the hash pool whose content hashes are ready. With wait_all
+    it waits for all of them, otherwise it waits only while the window is full. Returns 0 on success and -1 if a record
+    could not be written.
+*/
+int DrainHashPool(SnapshotWriter *writer, int wait_all);
+
+
+/*
+    Writes all the bytes of an array of buffers with writev (continuing after the partial writes). Returns 0 on success 
+    and -1 in case of errors.
+*/
+int WriteAllBuffers(int fd, struct iovec *iov, int count);
+
+
+/*
+    Waits for the io_uring write of the other set (if there is one) and writes with pwritev what it did not write.
+*/
+void WaitSnapshotWrite(SnapshotWriter *writer);
+
+
+/*
+    Writes the records from the current set (with writev or by submitting an io_uring write).
+*/
+void FlushSnapshotWriter(SnapshotWriter *writer);
+
+
+/*
+    Writes the rest of the records (and, for the binary format, the table of paths, the filters and the header), waits 
+    for the io_uring writes and frees the writer (only record_count and hash are kept). Returns 0 on success and -1 if a 
+    write failed.
+*/
+int CloseSnapshotWriter(SnapshotWriter *writer);
+
+
+/*
+    Adds the record of an entry to a binary snapshot. Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int WriteBinaryRecord(SnapshotWriter *writer, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash);
+
+
+/*
+    Appends a number to the buffer as a varint (7 bits in each byte). The buffer must have room for 10 bytes.
+*/
+void AppendVarint(RecordBuffer *buffer, uint64_t value);
+
+
+/*
+    Reads a varint from the table of paths. Returns the position after it or NULL if it does not end before end.
+*/
+const unsigned char *ReadVarint(const unsigned char *position, const unsigned char *end, uint64_t *value);
+
+
+/*
+    Checks if a snapshot file is in the binary format. Returns 1 if it is, 0 if it is not and -1 if it can't be opened.
+*/
+int IsBinarySnapshot(const char *file_name);
+
+
+/*
+    Maps a binary snapshot in memory and checks its header (the versions 1 and 2 of the format are read too). Returns 0 on
+    success and -1 in case of errors.
+*/
+int MapSnapshot(const char *file_name, MappedSnapshot *snapshot);
+
+
+/*
+    Unmaps a binary snapshot.
+*/
+void UnmapSnapshot(MappedSnapshot *snapshot);
+
+
+/*
+    Copies the record index of a binary snapshot in the layout of the last version (the fields missing from an older
+    version, the device and the content hash, are 0).
+*/
+void ReadSnapshotRecord(const MappedSnapshot *snapshot, uint64_t index, SnapshotFileRecord *record);
+
+
+/*
+    Decodes in the path buffer the path of the record index from a binary snapshot. If the path buffer holds the path of
+    the previous record (previous_index == index - 1), only the rest of the path is added, otherwise the path is decoded
+    from the closest restart. Returns 0 on success and -1 if the snapshot is not valid or the allocation of memory fails.
+*/
+int DecodeSnapshotPath(const MappedSnapshot *snapshot, uint64_t index, uint64_t previous_index, PathBuffer *path);
+
+
+/*
+    Converts a snapshot from the text format to the binary format or from the binary format to the text format 
+    (depending on the format of the input file). Returns 0 on success and -1 in case of errors.
+*/
+int ConvertSnapshot(const char *input_file_name, const char *output_file_name);
+
+
+/*
+    Compares two paths component by component ('/' is lower than any other character), which is the order of the 
+    records in a snapshot. Returns a negative value, 0 or a positive value like strcmp.
+*/
+int ComparePaths(const char *a, size_t a_length, const char *b, size_t b_length);
+
+
+/*
+    Opens a snapshot for reading its records. Returns 0 on success and -1 if the file can't be opened or is not valid.
+*/
+int OpenSnapshotCursor(SnapshotCursor *cursor, const char *file_name);
+
+
+/*
+    Reads the next record in the path and st fields of the cursor. Returns 1 if a record was read, 0 at the end of the
+    snapshot and -1 if the record is not valid.
+*/
+int NextSnapshotRecord(SnapshotCursor *cursor);
+
+
+/*
+    Closes a snapshot opened with OpenSnapshotCursor.
+*/
+void CloseSnapshotCursor(SnapshotCursor *cursor);
+
+
+/*
+    Checks if the records of a snapshot are sorted by path (every snapshot since they are sorted, only the ones created by
+    an older version are not), reading one record at a time. Returns 1 if they are, 0 if they are not and -1 in case of
+    errors.
+*/
+int IsSortedSnapshot(const char *file_name);
+
+
+/*
+    Set of the directories already parsed, identified by (device, inode). A directory reached again through a bind 
+    mount (of itself, of an ancestor, which would create a loop, or of another parsed directory) is not parsed again.
+    The same set (with a value for each inode) is used by the inode cache.
+*/
+typedef struct{
+    uint64_t *keys;              //pairs (device, inode), inode 0 is an empty slot
+    void **values;               //a value for each pair (the node of the directory, used by the worker threads)
+    size_t capacity;             //no. of pairs
+    size_t count;
+}VisitedSet;
+
+
+/*
+    Adds a directory to the visited set and stores in value (if it is not NULL) the address of its value. Returns 1 if 
+    it was not in the set, 0 if it was already in the set and -1 if it can't be added (the allocation of memory fails
+    or the inode is not known), when the directory is parsed.
+*/
+int MarkVisitedDirectory(VisitedSet *set, dev_t dev, ino_t ino, void ***value);
+
+
+/*
+    Frees the memory used by the visited set.
+*/
+void FreeVisitedSet(VisitedSet *set);
+
+
+/*
+    A snapshot loaded in memory by the diff ("--diff"), indexed by path and by (device, inode). The inodes are known only
+    in the binary format, so the renamed entries are found only between binary snapshots.
+*/
+typedef struct{
+    size_t path_offset;      //offset of the path in paths
+    size_t path_length;
+    struct stat st;
+    uint64_t content_hash;
+    int has_content_hash;
+    int matched;             //the entry was matched with an entry of the other snapshot (same path or renamed)
+}DiffEntry;
+
+typedef struct{
+    DiffEntry *entries;
+    size_t count;
+    size_t capacity;
+    RecordBuffer paths;
+    size_t *path_index;      //open addressing table with the indexes of the entries (+1, 0 is empty)
+    size_t index_capacity;
+    VisitedSet inodes;       //(device, inode) => index of the first entry with the inode (+1)
+    RecordBuffer filters;
+}LoadedSnapshot;
+
+
+/*
+    Loads all the records of a snapshot and indexes them by path and by (device, inode). Returns 0 on success and -1 if 
+    the snapshot can't be read or the allocation of memory fails.
+*/
+int LoadSnapshot(LoadedSnapshot *snapshot, const char *file_name);
+
+
+/*
+    Returns the index of the entry with the given path or -1 if the snapshot has no such entry.
+*/
+long LookupSnapshotPath(const LoadedSnapshot *snapshot, const char *path, size_t path_length);
+
+
+/*
+    Frees the memory used by a loaded snapshot.
+*/
+void FreeLoadedSnapshot(LoadedSnapshot *snapshot);
+
+
+/*
+    Writes in the buffer the fields that changed between two entries (size, access rights, no. of hard links, type and
+    content), e.g. "size 10 => 20, hard links 1 => 2". The content is compared only if both entries have a content hash.
+    Returns the no. of fields that changed.
+*/
+int DescribeChanges(char *buffer, size_t buffer_size, const DiffEntry *prev_entry, const DiffEntry *current_entry);
+
+
+/*
+    Compares two snapshots like CompareSnapshots, printing every entry that was added, removed, modified (with the fields
+    that changed) or renamed. An entry whose inode is found at another path (not in the previous snapshot) is reported
+    as renamed instead of removed and added. Returns 1 if a difference is found, 0 if the snapshots are identical and -1
+    in case of errors.
+*/
+int DiffSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name);
+
+
+/*
+    The work done once for each inode and reused for all its hard links (the files with st_nlink > 1 are kept in the 
+    inode cache for the entire scan).
+*/
+typedef struct{
+    int analyzed;                //the syntactic analysis was performed for one of the links
+    int analysis_status;         //its result (0 => safe)
+}InodeInfo;
+
+VisitedSet inode_cache={NULL, NULL, 0, 0}; //the values are InodeInfo
+
+
+/*
+    Returns the information of the inode of a file with more hard links from the inode cache (adding it if it is not 
+    found) or NULL for the files with one link, the directories and if the allocation of memory fails.
+*/
+InodeInfo *LookupInodeInfo(const struct stat *st);
+
+
+/*
+    Frees the inode cache.
+*/
+void FreeInodeCache(VisitedSet *cache);
+
+
+/*
+    A level of the traversal made by ReadDirectories: the listing of a directory and the next entry to be parsed.
+    The frames are kept after a directory is finished and reused (with their buffers) by the next directory from
+    the same depth, so the memory is not allocated again while the traversal goes up and down the tree.
+*/
+typedef struct{
+    DirListing listing;
+    struct stat *stats;          //information of the entries (used only with io_uring)
+    int *stat_result;
+    size_t stats_capacity;
+    int batched;                 //the information of the entries was read with io_uring
+    size_t index;                //next entry of the listing
+    size_t dir_length;           //length of the path of the directory
+    int dir_fd;                  //-1 if it was closed because of the limit of open directories
+    struct stat dir_st;          //information of the directory (its identity is checked when it is opened again)
+    int cached;                  //the listing and the information of the entries were taken from the scan cache
+    int incomplete;              //the parsing stopped because of an error => the directory is not cached
+}ScanFrame;
+
+
+/*
+    Reads the listing of the directory dir_fd into a new frame on top of the stack (reusing the buffers of the frame
+    from that depth). Returns 0 on success and -1 in case of errors, when the error is printed and dir_fd is closed.
+*/
+int PushScanFrame(ScanFrame **frames, size_t *frame_capacity, size_t *depth, int dir_fd, const struct stat *dir_st, PathBuffer *path, size_t root_length, char *dir_buffer, StatxRing *ring);
+
+
+/*
+    Opens again the directory of a frame whose fd was closed because of the limit of open directories, using ".." from
+    its sub-directory (child_fd) or, if that is not the same directory anymore, its path relative to the monitored directory.
+    Returns the new fd or -1 in case of errors.
+*/
+int ReopenFrame(const ScanFrame *frame, int child_fd, int root_fd, const PathBuffer *path, size_t root_length);
+
+
+/*
+    Parses through the directory (given as argument for monitoring) and his sub_directories.
+    The directory is walked with its file descriptor (openat, fstatat), so the kernel resolves only the name of
+    each entry and not the full path again. The full path is built in the path buffer only for writing the snapshot record.
+    The traversal is iterative, with an explicit stack of frames, so the depth of the tree is not limited by the stack
+    of the process. Only max_open_dirs directories are kept open, the others being opened again when the traversal 
+    returns to them. The records of the mount points (with "--one-file-system") and of the directories already parsed
+    are written, but their content is not.
+*/
+void ReadDirectories(int root_fd, PathBuffer *path, SnapshotWriter *snapshot, char *isolated_path, char *dir_buffer, StatxRing *ring);
+
+
+/*
+    A directory parsed by the worker threads. The worker that takes it from a deque reads its listing and the information
+    of its entries and creates a node (pushed to its own deque) for each sub-directory. The records are written later, 
+    in the order of the sequential traversal, by the thread that called ReadDirectoriesParallel.
+*/
+typedef struct DirNode{
+    int dir_fd;                  //opened by the parent worker, or -1 if it is opened later with the relative path
+    char *path;                  //full path of the directory
+    DirListing listing;
+    struct stat *stats;          //information for each entry of the listing
+    struct DirNode **children;   //node of each sub-directory (NULL for the other entries or if it can't be opened)
+    size_t stat_count;           //no. of entries with information (the parsing stops at the first failing fstatat)
+    int read_failed;             //the directory could not be opened or read
+    int stat_failed;             //fstatat failed for the entry stat_count
+    int alloc_failed;            //the allocation of memory failed for the entry stat_count
+    int incomplete;              //the writing of the records stopped because of an error => the directory is not cached
+    int cached;                  //the listing and the information of the entries were taken from the scan cache
+    struct stat dir_st;          //information of the directory (from its parent)
+    struct DirNode **owner_slot; //its element from the children of the parent (cleared if it is written at another path)
+    int done;                    //set by the worker when the node is ready for writing
+}DirNode;
+
+
+/*
+    Deque of directories for a worker thread. The owner pushes and pops at the bottom (depth first), the other
+    workers steal from the top (the directories closer to the root, which usually have larger subtrees).
+*/
+typedef struct{
+    DirNode **tasks;
+    size_t head;
+    size_t count;
+    size_t capacity;
+    pthread_mutex_t lock;
+}WorkDeque;
+
+
+/*
+    State shared by the worker threads of a parallel scan.
+*/
+typedef struct{
+    WorkDeque *deques;
+    int worker_count;
+    int root_fd;
+    size_t root_length;          //length of the root path (the directories are opened relative to root_fd after it)
+    dev_t root_dev;              //device of the monitored directory (for "--one-file-system")
+    VisitedSet claims;           //the directories pushed by the workers (with their nodes)
+    pthread_mutex_t claims_lock;
+    long pending;                //no. of directories pushed and not parsed yet (the workers stop when it becomes 0)
+    long queued;                 //no. of directories waiting in the deques
+    long idle_workers;
+    long task_fds;               //no. of fds kept open for the directories from the deques
+    long max_task_fds;           //limit for task_fds (MAX_TASK_FDS or less if the limit of open files is lower)
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+}WorkerPool;
+
+
+/*
+    Arguments of a worker thread.
+*/
+typedef struct{
+    WorkerPool *pool;
+    int id;
+    char *dir_buffer;            //each worker has its own getdents64 buffer
+    StatxRing *ring;             //and its own io_uring (NULL if fstatat is used)
+}WorkerArgs;
+
+
+/*
+    Pushes a directory to the bottom of a deque. Returns 0 on success and -1 if the allocation of memory fails.
+*/
+int PushTask(WorkDeque *deque, DirNode *node);
+
+
+/*
+    Takes a directory from the bottom of the worker's own deque (bottom=1) or from the top of another deque (bottom=0).
+    Returns NULL if the deque is empty.
+*/
+DirNode *TakeTask(WorkDeque *deque, int bottom);
+
+
+/*
+    Reads the listing and the information of the entries of a directory node, then creates and pushes the nodes of its
+    sub-directories to the deque of the worker (except the mount points with "--one-file-system" and the bind mounts 
+    of an ancestor). Marks the node as done at the end.
+*/
+void ScanDirectoryNode(WorkerArgs *worker, DirNode *node);
+
+
+/*
+    Function executed by the worker threads: takes directories from its own deque or steals them from the others,
+    until no directory is left to parse.
+*/
+void *ScanWorker(void *arg);
+
+
+/*
+    Frees a directory node (not its children).
+*/
+void FreeDirNode(DirNode *node);
+
+
+/*
+    Frees a directory node and all the nodes of its sub-directories (used when the writing stops because of an error).
+*/
+void FreeDirTree(DirNode *root);
+
+
+/*
+    Parses the monitored directory with scan_threads worker threads (each with its own deque and stealing work from the
+    others when it becomes idle). The calling thread writes the records in the same order as ReadDirectories, as soon as
+    the directories are parsed, so the snapshot is identical to the one created by the sequential traversal (the
+    visited set is checked by the calling thread, in the same order).
+*/
+void ReadDirectoriesParallel(int root_fd, PathBuffer *path, SnapshotWriter *snapshot, char *isolated_path);
+
+
+/*
+    An entry of the in-memory model of a monitored directory kept by "--watch" (the information written in its record).
+*/
+typedef struct{
+    char *path;                  //relative to the monitored directory (without the leading '/')
+    size_t path_length;
+    struct stat st;
+    int wd;                      //inotify watch of a directory (-1 for the other entries or if it is not watched)
+    int removed;                 //removed by the changes applied, dropped when the additions are merged
+}WatchRecord;
+
+
+/*
+    A file system of the monitored directory marked with fanotify ("--watch-backend=fanotify"). The file handles of its
+    events are opened on one of its directories.
+*/
+typedef struct{
+    dev_t dev;
+    int fsid[2];                 //the file system ID reported with the file handles (from statfs)
+    int mount_fd;                //-1 => the file system could not be marked
+}WatchFilesystem;
+
+
+/*
+    A directory resolved from its file handle with "--watch-backend=fanotify" (an entry of a direct-mapped cache, emptied
+    when a directory is moved).
+*/
+typedef struct{
+    unsigned char key[2*sizeof(int) + sizeof(struct file_handle) + MAX_HANDLE_SZ]; //the file system ID and the file handle
+    size_t key_length;           //0 => empty
+    char *path;                  //relative to the monitored directory (NULL => outside of it)
+}WatchHandle;
+
+
+/*
+    The model of a monitored directory with "--watch": the records of all its entries, sorted like in the snapshot, and
+    the relative path of each directory watched with inotify (indexed by watch descriptor). The events only collect the
+    paths that changed; when they are applied, only those paths are checked again with fstatat (the new directories are
+    parsed with their sub-directories and watched), so the snapshot is written from the model without parsing the tree.
+    With fanotify there are no watches: the file systems are marked and the directory of each event is resolved from
+    its file handle.
+*/
+typedef struct{
+    WatchRecord *records;        //sorted by path (ComparePaths)
+    size_t count;
+    size_t capacity;
+    WatchRecord *additions;      //records added by the changes applied (sorted and merged at the end)
+    size_t addition_count;
+    size_t addition_capacity;
+    size_t removed_count;
+    char **watched;              //relative path of the directory of each watch descriptor (NULL => not used)
+    size_t watched_capacity;
+    long watch_count;
+    char **changed;              //the paths from the events, not applied yet
+    size_t changed_count;
+    size_t changed_capacity;
+    uint64_t *linked;            //pairs (device, inode) of the files with several links that changed (the records of
+    size_t linked_count;         //their other links are checked again, inotify reports only the link that changed)
+    size_t linked_capacity;
+    int unknown_links;           //a path not in the model was deleted or excluded (it could be a link of a file of the
+                                 //model) => all the files with several links are checked again
+    int overflow;                //events were lost => the directory is parsed again entirely
+    int inotify_fd;
+    int root_fd;
+    struct stat root_st;
+    const char *root;            //path of the monitored directory (for inotify_add_watch)
+    char *isolated_path;
+    char *dir_buffer;
+    int watch_failed;            //a directory could not be watched (its error is printed only once)
+    int fanotify_fd;             //"--watch-backend=fanotify" => the file systems are marked instead (-1 with inotify)
+    WatchFilesystem *filesystems;
+    size_t filesystem_count;
+    char *root_real;             //canonical path of the monitored directory (the resolved directories start with it)
+    size_t root_real_length;
+    WatchHandle *handles;        //WATCH_HANDLE_CACHE_SIZE directories resolved from their file handles
+}WatchModel;
+
+
+/*
+    Creates a snapshot file in the output directory. The name of the snapshot file contains the name of the monitored
+    directory and a timestamp. This function calls read_directories (for parsing through the directory) and GetPreviousSnapshotThenCompare
+    (for comparing the current snapshot with the previous one). With a watch model ("--watch") the records are written
+    from the model instead of parsing the directory.
+*/
+void CreateSnapshot(char *path, char *output_path, char *isolated_path, WatchModel *model);
+
+
+/*
+    Creates the inotify instance (or the fanotify instance with "--watch-backend=fanotify") and parses the monitored
+    directory into the model, watching all its directories. Returns 0 on success and -1 in case of errors.
+*/
+int StartWatchModel(WatchModel *model, const char *path, char *isolated_path);
+
+
+/*
+    Watches and parses a directory (relative_path, "" for the monitored directory) and its sub-directories, adding their
+    entries to the additions of the model. The directory is watched (or its file system marked with fanotify, once)
+    before it is read, so an entry created in the meantime produces an event. Returns 0 on success and -1 if the
+    allocation of memory fails.
+*/
+int WatchSubtree(WatchModel *model, const char *relative_path, const struct stat *dir_st);
+
+
+/*
+    Reads the pending inotify (or fanotify) events and adds the paths they name (and their directories) to the changed
+    paths. Returns the no. of events read or -1 in case of errors.
+*/
+long ReadWatchEvents(WatchModel *model);
+
+
+/*
+    Checks again the changed paths and updates the model (or parses the directory again after lost events). Returns the
+    no. of records added, removed or changed (0 => the snapshot would be the same) or -1 in case of errors.
+*/
+long ApplyWatchChanges(WatchModel *model);
+
+
+/*
+    Writes the records of the model with their full path. Returns 0 on success and -1 in case of errors.
+*/
+int WriteWatchRecords(const WatchModel *model, PathBuffer *root_path, SnapshotWriter *snapshot);
+
+
+/*
+    Removes the watches and frees the model.
+*/
+void StopWatchModel(WatchModel *model);
+
+
+/*
+    Monitors a directory with "--watch": the first snapshot is written from the model built by the first scan, then the
+    model is updated from the inotify (or fanotify) events and a new snapshot (or the changes, with "--journal") is written only when
+    a record changed, watch_latency ms after the first event of the changes. Runs until SIGINT or SIGTERM.
+*/
+void WatchDirectory(char *path, char *output_path, char *isolated_path);
+
+
+/*
+    The manifest of a monitored directory ("DIR_Snapshot.manifest" in the output directory) records the snapshot that is
+    kept for it, so the previous snapshot is found without parsing the output directory. It is a small text file, 
+    replaced atomically (written in a temporary file, then renamed) after every comparison.
+*/
+typedef struct{
+    char snapshot[NAME_MAX + 1]; //name of the snapshot file (in the output directory)
+    int binary;
+    long long size;              //size of the snapshot file
+    uint64_t records;            //no. of records
+    uint64_t hash;               //FNV-1a of the snapshot (without the header of the binary format)
+    int content_hashes;          //the snapshot has the content hashes of the files ("--content-hash")
+    int has_tree;                //the hash tree was saved with the snapshot
+    uint64_t tree;               //hash of the root of the tree
+    int journal;                 //"--journal": the snapshot is the base of the journal and the size, no. of records and
+                                 //hash are the ones of the last scan (base + journal)
+}SnapshotManifest;
+
+
+/*
+    Reads the manifest of the monitored directory. Returns 0 on success and -1 if it does not exist or is not valid.
+*/
+int ReadManifest(const char *output_path, const char *dir_name, SnapshotManifest *manifest);
+
+
+/*
+    Replaces the manifest of the monitored directory (through a temporary file). Returns 0 on success and -1 in case 
+    of errors.
+*/
+int WriteManifest(const char *output_path, const char *dir_name, const SnapshotManifest *manifest);
+
+
+/*
+    Finds the previous snapshot by parsing the output directory (only if there is no manifest, e.g. for the snapshots 
+    created by an older version): the newest file named "DIR_Snapshot_TIMESTAMP" that is not the current snapshot.
+    Returns 1 if a snapshot is found, 0 if not and -1 if the output directory can't be opened.
+*/
+int FindPreviousSnapshot(const char *output_path, const char *dir_name, const char *current_name, char *previous_name, size_t size);
+
+
+/*
+    Finds the previous snapshot of the monitored directory with its manifest and calls the compare_snapshots function
+    (or diff_snapshots with "--diff"). If the manifest shows that the previous snapshot has the same size, no. of records
+    and hash as the current one, they are not compared. Otherwise, if the hash tree of the previous snapshot was saved,
+    only the directories whose hashes differ are compared (without reading the snapshot files). After comparation, if a
+    difference is found, the previous snapshot is overriden. The manifest is updated with the snapshot that is kept.
+*/
+void GetPreviousSnapshotThenCompare(const char *output_path, const char *snapshot_file_name, const SnapshotManifest *current, const MerkleTree *tree);
+
+
+/*
+    Journal of a monitored directory ("--journal"): the base snapshot and the changes found in the next scans, appended
+    to "DIR_Snapshot.journal" instead of writing a complete snapshot every time. Every scan that found changes adds a
+    "Run: TIMESTAMP" line followed by a record for each entry added, removed or modified. The records have the text
+    format of the snapshot, with the change instead of "Path" ("Added: ", "Modified: " and "Removed: ", the last one
+    without the other fields). The first line of the journal is "Base: " and the name of its base snapshot, so a journal
+    left by a compaction interrupted by a crash is not applied to another base.
+    The state of the previous scan is the base merged with the last change of each path from the journal.
+*/
+enum{JOURNAL_ADDED, JOURNAL_MODIFIED, JOURNAL_REMOVED};
+
+typedef struct{
+    DiffEntry record;            //the path and, except for JOURNAL_REMOVED, the fields of the entry
+    int change;
+    time_t run;                  //time of the scan that found the change
+    off_t offset;                //offset of the change in the journal file
+}JournalEntry;
+
+typedef struct{
+    JournalEntry *entries;       //sorted by path (the changes of a path in the order of the runs)
+    size_t count;
+    size_t capacity;
+    RecordBuffer paths;
+    long runs;                   //no. of scans in the journal
+}LoadedJournal;
+
+
+/*
+    Loads the journal of the monitored directory if it belongs to the base snapshot, only with the runs made until the
+    given time (0 => all the runs) and, with last_only, only with the last change of each path. Returns 0 on success,
+    1 if the journal does not exist or has another base (the journal is empty) and -1 if it is not valid or the
+    allocation of memory fails.
+*/
+int LoadJournal(LoadedJournal *journal, const char *journal_name, const char *base_name, time_t until, int last_only);
+
+
+/*
+    Frees the memory used by a loaded journal.
+*/
+void FreeLoadedJournal(LoadedJournal *journal);
+
+
+/*
+    Creates an empty journal for a base snapshot (through a temporary file). Returns 0 on success and -1 in case of errors.
+*/
+int ResetJournal(const char *journal_name, const char *base_name);
+
+
+/*
+    Copies the current snapshot (from the memory file) to a new base snapshot in the output directory and syncs it.
+    Returns 0 on success and -1 in case of errors.
+*/
+int WriteBaseSnapshot(int snapshot_fd, const char *file_name);
+
+
+/*
+    State of the monitored directory at the end of a journal: the records of the base snapshot merged with the last
+    change of each path from the journal, returned in the order of the snapshots (without the removed entries).
+*/
+typedef struct{
+    SnapshotCursor base;
+    int base_status;
+    int advance_base;            //the current entry is the record of the base (it is read again at the next call)
+    const LoadedJournal *journal;
+    size_t next;                 //the next change from the journal
+    const char *path;            //the current entry
+    size_t path_length;
+    DiffEntry entry;
+}JournalState;
+
+
+/*
+    Opens the state of a base snapshot with a journal loaded with last_only. Returns 0 on success and -1 in case of errors.
+*/
+int OpenJournalState(JournalState *state, const char *base_file_name, const LoadedJournal *journal);
+
+
+/*
+    Moves to the next entry of the state. Returns 1 if an entry was read, 0 at the end and -1 in case of errors (also
+    when the base snapshot is not sorted).
+*/
+int NextJournalState(JournalState *state);
+
+
+/*
+    Closes the base snapshot of the state.
+*/
+void CloseJournalState(JournalState *state);
+
+
+/*
+    Compares the current snapshot (written in a memory file) with the state of the previous scan (the base and the
+    journal) in a single pass and appends the changes to the journal. The first scan (or a scan after a compaction)
+    writes the base snapshot. The manifest is updated with the base and the size, no. of records and hash of the
+    current snapshot, so an unchanged directory does not write anything.
+*/
+void UpdateJournal(const char *output_path, int snapshot_fd, const SnapshotManifest *current);
+
+
+/*
+    History of a monitored directory ("--history=N"): when the journal is compacted, its base and the journal itself are
+    kept as a generation ("DIR_Snapshot_TIMESTAMP" with the extension of the base, ".journal" and ".index") instead of
+    being deleted, so the base is a keyframe and the journal the chain of deltas after it. The index has a line
+    "OFFSET RUN PATH" for every change of the journal, sorted by path, so the changes of a path are read without
+    parsing the journal. The snapshots kept without a journal are keyframes without deltas.
+*/
+typedef struct{
+    char base[NAME_MAX + 1];     //the keyframe
+    char journal[NAME_MAX + 1];  //its journal ("" => none)
+    time_t time;                 //time of the keyframe (from its name)
+    int archived;                //the journal was archived (it has an index)
+}HistoryGeneration;
+
+
+/*
+    Finds the generations of the monitored directory in the output directory, sorted by time. Returns the no. of
+    generations and -1 in case of errors.
+*/
+long ListHistory(const char *output_path, const char *dir_name, HistoryGeneration **generations);
+
+
+/*
+    Archives the journal of the monitored directory as a generation of its base (writes its index and renames it), then
+    deletes the oldest archived generations over history_generations. Returns 0 on success and -1 in case of errors.
+*/
+int ArchiveJournal(const char *output_path, const char *dir_name, const char *journal_name);
+
+
+/*
+    Rebuilds the snapshot of a monitored directory at a given time ("%Y.%m.%d_%H:%M:%S") from the latest keyframe made
+    until then and the runs of its journal made until then (the next runs are not read). The snapshot is written in the
+    format of the keyframe. Returns 0 on success and -1 in case of errors.
+*/
+int RebuildSnapshotAt(const char *output_path, const char *dir_name, const char *timestamp, const char *output_file_name);
+
+
+/*
+    Prints every change of a path found in the journals of the monitored directory (through the indexes of the archived
+    journals). Returns the no. of changes and -1 in case of errors.
+*/
+long PrintPathHistory(const char *output_path, const char *dir_name, const char *path);
+
+
+/*
+    Compares the current snapshot (created when the program is executed) with the previous snapshot found in the output dir. 
+    Returns 1 if a difference is found, 0 if the snapshot are identical and -1 in case of errors.
+*/
+int CompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name);
+
+
+/*
+    Compares two snapshots sorted by path by merging their records in a single pass (one record of each snapshot in
+    memory), printing the entries added, removed and modified if print_changes is set (like DiffSnapshots, but without
+    finding the renamed entries). Returns 1 if a difference is found, 0 if the snapshots are identical, -1 in case of
+    errors and -2 if a snapshot is not sorted by path (nothing is printed then, unless print_changes is set).
+*/
+int StreamCompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, int print_changes);
+
+
+/*
+    External sort of the records of a snapshot, for comparing snapshots of any size within a memory budget
+    ("--compare-memory") and the snapshots that are not sorted by path. The records are read in runs that fit in the
+    budget, each run is sorted by path and written to a temporary file (in the directory of the snapshot), then the runs
+    are merged with a heap (k-way merge), so the records are returned sorted while only a buffer of each run is kept in
+    memory. A snapshot that fits in one run is sorted in memory, without temporary files. When the buffers of all the
+    runs (at least MIN_RUN_BUFFER_SIZE each) don't fit in the budget, the runs are merged in several passes.
+*/
+typedef struct{
+    uint64_t size;
+    uint64_t nlink;
+    uint64_t content_hash;
+    uint64_t path_offset;        //offset of the path in memory (in a run file the path follows the record)
+    uint32_t path_length;
+    uint32_t mode;
+    uint32_t flags;              //RECORD_HAS_CONTENT_HASH
+    uint32_t reserved;
+}SortRecord;
+
+typedef struct{
+    int fd;
+    char *buffer;
+    size_t buffer_size;
+    size_t start;                //the bytes from start to end were read but not used
+    size_t end;
+    off_t offset;                //offset of the next read
+    SortRecord record;           //the current record of the run
+    PathBuffer path;
+}RunReader;
+
+typedef struct{
+    SortRecord *records;         //the records of the run being read (all the records if they fit in one run)
+    size_t count;
+    size_t next;
+    char *paths;
+    size_t paths_length;
+    RunReader *runs;             //the runs written in temporary files
+    size_t run_count;
+    size_t *heap;                //the runs with records left, ordered by their current path
+    size_t heap_count;
+    int advance_run;             //the current record is from the run at the top of the heap (it moves at the next call)
+    long runs_written;           //no. of runs written (with the runs of the merge passes)
+    RecordBuffer filters;
+    const char *path;            //the current record (the path is not terminated with '\0')
+    size_t path_length;
+    struct stat st;
+    uint64_t content_hash;
+    int has_content_hash;
+}SortedSnapshot;
+
+
+/*
+    Sorts the records of a snapshot within the memory budget. Returns 0 on success and -1 in case of errors.
+*/
+int OpenSortedSnapshot(SortedSnapshot *snapshot, const char *file_name, size_t memory);
+
+
+/*
+    Moves to the next record of a sorted snapshot. Returns 1 if a record was read, 0 at the end and -1 in case of errors.
+*/
+int NextSortedRecord(SortedSnapshot *snapshot);
+
+
+/*
+    Closes a sorted snapshot (and its temporary files).
+*/
+void CloseSortedSnapshot(SortedSnapshot *snapshot);
+
+
+/*
+    Compares two snapshots through external sorts sharing the memory budget, streaming the entries added, removed and
+    modified in the order of the paths (printed if print_changes is set, like DiffSnapshots, but without finding the
+    renamed entries). Returns 1 if a difference is found, 0 if the snapshots are identical and -1 in case of errors.
+*/
+int SortMergeSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, size_t memory, int print_changes);
+
+
+/*
+    Parallel comparison of two snapshots ("--compare-threads=N"). The paths are split into shards at the paths of evenly
+    spaced records of the previous snapshot (by record index in the binary format and by byte offset in the text format)
+    and the start of each shard in the current snapshot is found with a binary search, so the split reads only a few
+    records. The shards are compared by N threads, each with its own cursors on both snapshots, and the results are
+    merged in the order of the shards, so the counts and the changes printed are the same as with one thread.
+*/
+typedef struct{
+    uint64_t prev_start;         //position of the first record of the shard in each snapshot
+    uint64_t current_start;
+    PathBuffer end;              //the first path after the shard (empty for the last shard)
+    RecordBuffer output;         //the changes found (printed with "--diff")
+    long added;
+    long removed;
+    long modified;
+    int status;                  //0 if the shard was compared, -1 in case of errors and -2 if a snapshot is not sorted
+}CompareShard;
+
+typedef struct{
+    const char *prev_file_name;
+    const char *current_file_name;
+    CompareShard *shards;
+    size_t count;
+    size_t next;                 //the next shard to be compared (taken with an atomic increment)
+    int print_changes;
+}ParallelCompare;
+
+
+/*
+    Moves the cursor to a position of the snapshot (the index of a record in the binary format, the offset of the
+    "Path: " line of a record in the text format), so the next call of NextSnapshotRecord reads that record. The order
+    of the records is checked again from there. Returns 0 on success and -1 in case of errors.
+*/
+int SeekSnapshotCursor(SnapshotCursor *cursor, uint64_t position);
+
+
+/*
+    Compares the shards taken from the parallel comparison until all of them are taken (the thread function).
+*/
+void *CompareShardWorker(void *arg);
+
+
+/*
+    Compares two snapshots with compare_threads threads, printing the changes if print_changes is set (without finding
+    the renamed entries). Returns 1 if a difference is found, 0 if the snapshots are identical, -1 in case of errors and
+    -2 if a snapshot is not sorted by path (it is compared by one thread then).
+*/
+int ParallelCompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, int print_changes);
+
+
+/*
+    Compares two binary snapshots by the same fields as the text format (path, size, access rights, no. of hard links and
+    the content hash when both records have one), so a change of the inode or of the mtime alone is not a difference. Returns 1 if a difference is found, 0 if the 
+    snapshots are identical and -1 in case of errors.
+*/
+int CompareBinarySnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name);
+
+
+/*
+    Checks if two snapshot files are identical byte by byte: the sizes are compared first, then both files are mapped
+    (with MADV_SEQUENTIAL) and compared with memcmp in blocks of COMPARE_BLOCK_SIZE (read with pread if they can't be
+    mapped). The offset of the first byte that differs is stored in first_difference (-1 if the sizes are different).
+    Returns 1 if the files are different, 0 if they are identical and -1 in case of errors.
+*/
+int CompareSnapshotBytes(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, off_t *first_difference);
+
+
+/*
+    Reads up to length bytes from the offset of a file (until the end of the file). Returns the no. of bytes read or -1.
+*/
+ssize_t ReadBlock(int fd, char *buffer, size_t length, off_t offset);
+
+
+/*
+    Checks if a directory entry given as parameter has all the access permissions missing and creates a new grandchild 
+    process in that case for running the script and analyzing syntactically the dir entry. For the hard links of an 
+    inode already analyzed, the result is taken from the inode cache.
+*/
+void CheckPermissionsAndAnalyze(const char *dir_entry, struct stat permissions, char *isolated_path, int snapshot_fd);
+
+
+/*
+    Performs the syntactic analysis for the files that have all the permissions missing by running the scripy 'verifiy_for_malicious'.
+    The result of the analysis is written to the pipe (for transmitting information to the child process)
+*/
+int AnalyzeFile(const char *dir_entry, int pipe_fd);
+
+
+/*
+    Depending on the result transmitted through the pipe, this function takes the decision of moving the corrupted file
+    to the isolated directory or not. Returns the result of the analysis.
+*/
+int ResultOfAnalysis(int pipe_fd[2], const char *dir_entry, char *isolated_path);
+
+
+/*
+    Moves the file to the isolated directory if the result of the analysis is not 0 (the file is malicious or corrupted).
+*/
+void HandleAnalysisResult(int file_status, const char *dir_entry, char *isolated_path);
+
+
+/*
+    Converts a size given in the command line (e.g. "4096", "64K", "1M", "2G") to bytes.
+    Returns 0 on success and -1 if the size is not valid.
+*/
+int ParseSize(const char *text, size_t *size);
+
+
+/*
+    Checks if an argument from the command line is an option (starting with "--").
+*/
+int IsOption(const char *argument);
+
+
+/*
+    Parses an option given in the command line ("--name=value") and stores its value in the corresponding global variable.
+    The program exits if the option is unknown or its value is not valid.
+*/
+void ParseOption(const char *argument);
+
+
+/*
+    FUNCTION IMPLEMENTATIONS
+*/
+/*
+    APPEND TO PATH FUNCTION
+*/
+ssize_t AppendToPath(PathBuffer *path, const char *name){
+
+    size_t name_length=strlen(name);
+    size_t previous_length=path->length;
+
+    if(path->length + name_length + 2 > path->capacity){ //+2 is for '/' and null terminator
+        size_t new_capacity=path->capacity ? path->capacity : PATH_MAX;
+        while(path->length + name_length + 2 > new_capacity) new_capacity*=2;
+
+        char *new_data=realloc(path->data, new_capacity);
+        if(new_data == NULL) return -1;
+
+        path->data=new_data;
+        path->capacity=new_capacity;
+    }
+
+    path->data[path->length++]='/';
+    memcpy(path->data + path->length, name, name_length + 1);
+    path->length+=name_length;
+
+    return previous_length;
+}
+
+
+/*
+    READ DIRECTORY LISTING FUNCTION
+*/
+int ReadDirectoryListing(int dir_fd, DirListing *listing, char *buffer, size_t buffer_size){
+
+    listing->count=0;
+    listing->names_length=0;
+
+    size_t bytes_read=0;
+    ssize_t nread;
+
+    long getdents_calls=0;
+
+    while((nread=syscall(SYS_getdents64, dir_fd, buffer, buffer_size)) > 0){
+        getdents_calls++;
+        bytes_read+=nread;
+
+        //walking the records from the buffer in place
+        for(ssize_t offset=0; offset < nread;){
+            struct linux_dirent64 *record=(struct linux_dirent64 *)(buffer + offset);
+            offset+=record->d_reclen;
+
+            //not storing the entries "." & ".."
+            if(strcmp(record->d_name, ".") == 0 || strcmp(record->d_name, "..") == 0) continue;
+
+            if(AppendListingEntry(listing, record->d_name, strlen(record->d_name), record->d_type, record->d_ino) == -1) return -1;
+        }
+    }
+    getdents_calls++; //the last call (returning 0 or an error) is counted too
+
+    //readdir makes one getdents64 call for each full internal buffer and one more at the end of the directory
+    __atomic_add_fetch(&count_readdir_calls, (long)((bytes_read + LIBC_DIR_BUFFER_SIZE - 1)/LIBC_DIR_BUFFER_SIZE + 1), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&count_getdents_calls, getdents_calls, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&count_dir_entries, (long)listing->count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&count_directories, 1, __ATOMIC_RELAXED);
+
+    if(nread == -1) return -1;
+    SortDirListing(listing);
+
+    return 0;
+}
+
+
+/*
+    APPEND LISTING ENTRY FUNCTION
+*/
+int AppendListingEntry(DirListing *listing, const char *name, size_t name_length, unsigned char d_type, ino_t d_ino){
+
+    name_length++; //+1 is for the null terminator
+
+    if(listing->count == listing->capacity){
+        size_t new_capacity=listing->capacity ? listing->capacity*2 : 64;
+        ListingEntry *new_entries=realloc(listing->entries, new_capacity*sizeof(ListingEntry));
+        if(new_entries == NULL) return -1;
+        listing->entries=new_entries;
+        listing->capacity=new_capacity;
+    }
+    if(listing->names_length + name_length > listing->names_capacity){
+        size_t new_capacity=listing->names_capacity ? listing->names_capacity : 4096;
+        while(listing->names_length + name_length > new_capacity) new_capacity*=2;
+        char *new_names=realloc(listing->names, new_capacity);
+        if(new_names == NULL) return -1;
+        listing->names=new_names;
+        listing->names_capacity=new_capacity;
+    }
+
+    ListingEntry *entry=&listing->entries[listing->count++];
+    entry->name_offset=listing->names_length;
+    entry->d_type=d_type;
+    entry->d_ino=d_ino;
+
+    memcpy(listing->names + listing->names_length, name, name_length - 1);
+    listing->names[listing->names_length + name_length - 1]='\0';
+    listing->names_length+=name_length;
+
+    return 0;
+}
+
+
+/*
+    FREE DIR LISTING FUNCTION
+*/
+void FreeDirListing(DirListing *listing){
+
+    free(listing->entries);
+    free(listing->names);
+    listing->entries=NULL;
+    listing->names=NULL;
+    listing->count=listing->capacity=0;
+    listing->names_length=listing->names_capacity=0;
+}
+
+
+/*
+    COMPARE LISTING ENTRIES FUNCTION (used by qsort_r, the argument is the buffer with the names)
+*/
+static int CompareListingEntries(const void *a, const void *b, void *names){
+
+    return strcmp((const char *)names + ((const ListingEntry *)a)->name_offset, (const char *)names + ((const ListingEntry *)b)->name_offset);
+}
+
+
+/*
+    SORT DIR LISTING FUNCTION
+*/
+void SortDirListing(DirListing *listing){
+
+    if(listing->count > 1) qsort_r(listing->entries, listing->count, sizeof(ListingEntry), CompareListingEntries, listing->names);
+}
+
+
+/*
+    ADD FILTER RULE FUNCTION
+*/
+int AddFilterRule(const char *pattern, int include){
+
+    size_t length=strlen(pattern);
+    int dir_only=0, anchored=0;
+
+    while(length > 0 && pattern[length-1] == '/'){ //"name/" => only directories
+        length--;
+        dir_only=1;
+    }
+    while(length > 0 && pattern[0] == '/'){        //"/path" => relative to the monitored directory
+        pattern++;
+        length--;
+        anchored=1;
+    }
+    if(length == 0) return -1;
+    if(memchr(pattern, '/', length) != NULL) anchored=1;
+
+    if(filters.count == filters.capacity){
+        size_t new_capacity=filters.capacity ? filters.capacity*2 : 16;
+        FilterRule *new_rules=realloc(filters.rules, new_capacity*sizeof(FilterRule));
+        if(new_rules == NULL) return -1;
+        filters.rules=new_rules;
+        filters.capacity=new_capacity;
+    }
+
+    FilterRule *rule=&filters.rules[filters.count];
+    rule->pattern=strndup(pattern, length);
+    if(rule->pattern == NULL) return -1;
+    rule->length=length;
+    rule->include=include;
+    rule->dir_only=dir_only;
+    rule->anchored=anchored;
+
+    //the most common patterns are compared directly, without fnmatch
+    size_t wildcards=strcspn(rule->pattern, "*?[\\");
+    if(wildcards == length) rule->kind=FILTER_LITERAL;
+    else if(rule->pattern[0] == '*' && length > 1 && strcspn(rule->pattern + 1, "*?[\\") == length - 1) rule->kind=FILTER_SUFFIX;
+    else if(wildcards == length - 1 && rule->pattern[length-1] == '*') rule->kind=FILTER_PREFIX;
+    else rule->kind=FILTER_GLOB;
+
+    filters.count++;
+    return 0;
+}
+
+
+/*
+    READ FILTER FILE FUNCTION
+*/
+int ReadFilterFile(const char *file_name){
+
+    FILE *file=fopen(file_name, "r");
+    if(file == NULL){
+        fprintf(stderr, "*read_filter_file* error: Failed to open the filter file  \"%s\"\n", file_name);
+        return -1;
+    }
+
+    char *line=NULL;
+    size_t line_capacity=0;
+    ssize_t line_length;
+    int line_no=0, result=0;
+
+    while(result == 0 && (line_length=getline(&line, &line_capacity, file)) != -1){
+        line_no++;
+        while(line_length > 0 && (line[line_length-1] == '\n' || line[line_length-1] == '\r')) line[--line_length]='\0';
+        if(line_length == 0 || line[0] == '#') continue;
+
+        if(strncmp(line, "exclude ", strlen("exclude ")) == 0) result=AddFilterRule(line + strlen("exclude "), 0);
+        else if(strncmp(line, "include ", strlen("include ")) == 0) result=AddFilterRule(line + strlen("include "), 1);
+        else result=-1;
+
+        if(result == -1) fprintf(stderr, "*read_filter_file* error: Invalid rule on line %d (\"exclude PATTERN\" or \"include PATTERN\")  \"%s\"\n", line_no, file_name);
+    }
+
+    free(line);
+    fclose(file);
+    return result;
+}
+
+
+/*
+    COMPILE FILTERS FUNCTION
+*/
+int CompileFilters(FilterSet *set){
+
+    if(set->count == 0) return 0;
+
+    set->index_capacity=16;
+    while(set->index_capacity < set->count*2) set->index_capacity*=2;
+    set->name_index=calloc(set->index_capacity, sizeof(size_t));
+    set->other_rules=malloc(set->count*sizeof(size_t));
+    if(set->name_index == NULL || set->other_rules == NULL) return -1;
+
+    size_t header_capacity=0;
+    for(size_t i=0; i < set->count; i++){
+        FilterRule *rule=&set->rules[i];
+        header_capacity+=rule->length + 32;
+
+        if(rule->dir_only) set->has_dir_only=1;
+        if(rule->anchored) set->has_anchored=1;
+        if(rule->kind == FILTER_LITERAL && !rule->anchored){
+            size_t slot=HashBytes(rule->pattern, rule->length) & (set->index_capacity - 1);
+            while(set->name_index[slot] != 0) slot=(slot + 1) & (set->index_capacity - 1);
+            set->name_index[slot]=i + 1;
+        }
+        else set->other_rules[set->other_count++]=i;
+    }
+
+    //the rules are recorded in the snapshot, so a snapshot is not compared only with the entries another set of rules kept
+    set->header=malloc(header_capacity + 2);
+    if(set->header == NULL) return -1;
+    for(size_t i=0; i < set->count; i++){
+        FilterRule *rule=&set->rules[i];
+        set->header_length+=sprintf(set->header + set->header_length, "Filter: %s %s%s%s\n", rule->include ? "include" : "exclude", rule->anchored ? "/" : "", rule->pattern, rule->dir_only ? "/" : "");
+    }
+    set->header[set->header_length++]='\n';
+    set->header[set->header_length]='\0';
+
+    return 0;
+}
+
+
+/*
+    MATCH FILTERS FUNCTION
+*/
+long MatchFilters(const FilterSet *set, const char *name, const char *relative_path, int is_dir){
+
+    long first=-1;
+    size_t name_length=strlen(name);
+    size_t path_length=relative_path ? strlen(relative_path) : 0;
+
+    //the literal names: the first rule with the same name (for the directories or for any entry)
+    size_t slot=HashBytes(name, name_length) & (set->index_capacity - 1);
+    for(; set->name_index[slot] != 0; slot=(slot + 1) & (set->index_capacity - 1)){
+        size_t i=set->name_index[slot] - 1;
+        const FilterRule *rule=&set->rules[i];
+        if((first == -1 || (long)i < first) && (!rule->dir_only || is_dir) && rule->length == name_length && memcmp(rule->pattern, name, name_length) == 0) first=(long)i;
+    }
+
+    for(size_t j=0; j < set->other_count; j++){
+        size_t i=set->other_rules[j];
+        if(first != -1 && (long)i > first) break; //the literal name was given before
+        const FilterRule *rule=&set->rules[i];
+        if(rule->dir_only && !is_dir) continue;
+
+        const char *subject=rule->anchored ? relative_path : name;
+        size_t subject_length=rule->anchored ? path_length : name_length;
+
+        int matched;
+        switch(rule->kind){
+            case FILTER_LITERAL: matched=subject_length == rule->length && memcmp(subject, rule->pattern, rule->length) == 0; break;
+            case FILTER_SUFFIX: matched=subject_length >= rule->length - 1 && memcmp(subject + subject_length - (rule->length - 1), rule->pattern + 1, rule->length - 1) == 0 && 
+                                        (!rule->anchored || memchr(subject, '/', subject_length - (rule->length - 1)) == NULL); break;
+            case FILTER_PREFIX: matched=subject_length >= rule->length - 1 && memcmp(subject, rule->pattern, rule->length - 1) == 0 && 
+                                        (!rule->anchored || memchr(subject + rule->length - 1, '/', subject_length - (rule->length - 1)) == NULL); break;
+            default: matched=fnmatch(rule->pattern, subject, rule->anchored ? FNM_PATHNAME : 0) == 0;
+        }
+        if(matched){
+            first=(long)i;
+            break;
+        }
+    }
+
+    return first;
+}
+
+
+/*
+    FILTER LISTING FUNCTION
+*/
+int FilterListing(int dir_fd, DirListing *listing, const char *relative_path){
+
+    if(filters.count == 0) return 0;
+
+    //the path of the entries is built in a buffer only if a rule is matched against it
+    char *entry_path=NULL;
+    size_t dir_length=0;
+    if(filters.has_anchored){
+        if(relative_path[0] == '/') relative_path++;
+        dir_length=strlen(relative_path);
+        entry_path=malloc(dir_length + NAME_MAX + 2); //+2 is for '/' and null terminator
+        if(entry_path == NULL) return -1;
+        memcpy(entry_path, relative_path, dir_length);
+        if(dir_length > 0) entry_path[dir_length++]='/';
+    }
+
+    size_t kept=0;
+    long excluded=0, pruned=0;
+
+    for(size_t i=0; i < listing->count; i++){
+        ListingEntry *entry=&listing->entries[i];
+        const char *name=listing->names + entry->name_offset;
+
+        int is_dir=entry->d_type == DT_DIR;
+        if(entry->d_type == DT_UNKNOWN && filters.has_dir_only){ //the file system does not return the type of the entries
+            struct stat st;
+            is_dir=fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        if(entry_path != NULL) strcpy(entry_path + dir_length, name);
+
+        long rule=MatchFilters(&filters, name, entry_path, is_dir);
+        if(rule != -1 && !filters.rules[rule].include){ //the names stay in the buffer, only the entry is removed
+            excluded++;
+            if(is_dir) pruned++;
+            continue;
+        }
+        listing->entries[kept++]=*entry;
+    }
+    listing->count=kept;
+
+    __atomic_add_fetch(&count_excluded_entries, excluded, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&count_pruned_dirs, pruned, __ATOMIC_RELAXED);
+
+    free(entry_path);
+    return 0;
+}
+
+
+/*
+    HASH BYTES FUNCTION
+*/
+uint64_t HashBytes(const void *data, size_t length){
+
+    return UpdateHash(14695981039346656037ULL, data, length);
+}
+
+
+/*
+    UPDATE HASH FUNCTION
+*/
+uint64_t UpdateHash(uint64_t hash, const void *data, size_t length){
+
+    const unsigned char *bytes=data;
+
+    for(size_t i=0; i < length; i++){
+        hash^=bytes[i];
+        hash*=1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+/*
+    OPEN SCAN CACHE FUNCTION
+*/
+int OpenScanCache(ScanCache *cache, const char *output_path, const char *dir_name){
+
+    memset(cache, 0, sizeof(*cache));
+    cache->scan_start=time(NULL);
+
+    size_t name_length=strlen(output_path) + strlen(dir_name) + 32;
+    cache->file_name=malloc(name_length);
+    cache->temp_name=malloc(name_length);
+    if(cache->file_name == NULL || cache->temp_name == NULL){
+        CloseScanCache(cache);
+        return -1;
+    }
+    snprintf(cache->file_name, name_length, "%s/%s_Scan.cache", output_path, dir_name);
+    snprintf(cache->temp_name, name_length, "%s/%s_Scan.cache.tmp", output_path, dir_name);
+
+    //the cache starts with the magic and the hash of the filters (the listings from the cache are already filtered,
+    //so a cache created with other rules is not used)
+    uint64_t filter_hash=HashBytes(filters.header, filters.header_length);
+    size_t data_offset=strlen(SCAN_CACHE_MAGIC) + sizeof(filter_hash);
+
+    //mapping the previous cache (if it exists and it is valid)
+    int cache_fd=open(cache->file_name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(cache_fd != -1 && fstat(cache_fd, &st) == 0 && (size_t)st.st_size > data_offset){
+        cache->map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, cache_fd, 0);
+        if(cache->map == MAP_FAILED) cache->map=NULL;
+        else if(memcmp(cache->map, SCAN_CACHE_MAGIC, strlen(SCAN_CACHE_MAGIC)) != 0 || memcmp(cache->map + strlen(SCAN_CACHE_MAGIC), &filter_hash, sizeof(filter_hash)) != 0){
+            munmap(cache->map, st.st_size);
+            cache->map=NULL;
+        }
+        else cache->map_size=st.st_size;
+    }
+    if(cache_fd != -1) close(cache_fd);
+
+    //indexing the directories of the previous cache by the hash of their path
+    size_t dir_count=0;
+    for(size_t offset=data_offset; cache->map && offset + sizeof(CacheDirHeader) <= cache->map_size;){
+        CacheDirHeader header;
+        memcpy(&header, cache->map + offset, sizeof(header));
+        if(header.record_length < sizeof(header) || header.record_length > cache->map_size - offset) break;
+        dir_count++;
+        offset+=header.record_length;
+    }
+    if(dir_count > 0){
+        cache->index_capacity=16;
+        while(cache->index_capacity < dir_count*2) cache->index_capacity*=2;
+        cache->index=calloc(cache->index_capacity, sizeof(size_t));
+    }
+    for(size_t offset=data_offset, i=0; cache->index && i < dir_count; i++){
+        CacheDirHeader header;
+        memcpy(&header, cache->map + offset, sizeof(header));
+
+        if(sizeof(header) + header.path_length <= header.record_length){
+            size_t slot=HashBytes(cache->map + offset + sizeof(header), header.path_length) & (cache->index_capacity - 1);
+            while(cache->index[slot] != 0) slot=(slot + 1) & (cache->index_capacity - 1);
+            cache->index[slot]=offset + 1;
+        }
+        offset+=header.record_length;
+    }
+
+    //creating the new cache
+    cache->output=fopen(cache->temp_name, "w");
+    if(cache->output == NULL || fwrite(SCAN_CACHE_MAGIC, 1, strlen(SCAN_CACHE_MAGIC), cache->output) != strlen(SCAN_CACHE_MAGIC) ||
+       fwrite(&filter_hash, sizeof(filter_hash), 1, cache->output) != 1){
+        CloseScanCache(cache);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+    LOOKUP SCAN CACHE FUNCTION
+*/
+const char *LookupScanCache(ScanCache *cache, const char *relative_path, const struct stat *dir_st){
+
+    if(cache->index == NULL) return NULL;
+
+    size_t path_length=strlen(relative_path);
+    size_t slot=HashBytes(relative_path, path_length) & (cache->index_capacity - 1);
+
+    for(; cache->index[slot] != 0; slot=(slot + 1) & (cache->index_capacity - 1)){
+        const char *record=cache->map + cache->index[slot] - 1;
+        CacheDirHeader header;
+        memcpy(&header, record, sizeof(header));
+
+        if(header.path_length != path_length || memcmp(record + sizeof(header), relative_path, path_length) != 0) continue;
+
+        //the same directory, not changed since the previous scan
+        if(header.dev == (uint64_t)dir_st->st_dev && header.ino == (uint64_t)dir_st->st_ino &&
+           header.mtime_sec == dir_st->st_mtim.tv_sec && header.mtime_nsec == dir_st->st_mtim.tv_nsec &&
+           header.ctime_sec == dir_st->st_ctim.tv_sec && header.ctime_nsec == dir_st->st_ctim.tv_nsec){
+            __atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+            return record;
+        }
+        return NULL;
+    }
+
+    return NULL;
+}
+
+
+/*
+    READ CACHED LISTING FUNCTION
+*/
+int ReadCachedListing(const char *record, DirListing *listing){
+
+    CacheDirHeader header;
+    memcpy(&header, record, sizeof(header));
+
+    listing->count=0;
+    listing->names_length=0;
+
+    const char *end=record + header.record_length;
+    const char *position=record + sizeof(header) + header.path_length;
+
+    for(uint32_t i=0; i < header.entry_count && position + sizeof(CacheEntryHeader) <= end; i++){
+        CacheEntryHeader entry;
+        memcpy(&entry, position, sizeof(entry));
+        position+=sizeof(entry);
+        if(entry.name_length > (size_t)(end - position)) break;
+
+        if(AppendListingEntry(listing, position, entry.name_length, IFTODT(entry.mode), entry.ino) == -1) return -1;
+        position+=entry.name_length;
+    }
+
+    return 0;
+}
+
+
+/*
+    READ CACHED STATS FUNCTION
+*/
+void ReadCachedStats(const char *record, struct stat *stats){
+
+    CacheDirHeader header;
+    memcpy(&header, record, sizeof(header));
+
+    const char *end=record + header.record_length;
+    const char *position=record + sizeof(header) + header.path_length;
+
+    for(uint32_t i=0; i < header.entry_count && position + sizeof(CacheEntryHeader) <= end; i++){
+        CacheEntryHeader entry;
+        memcpy(&entry, position, sizeof(entry));
+        position+=sizeof(entry) + entry.name_length;
+
+        memset(&stats[i], 0, sizeof(struct stat));
+        stats[i].st_size=entry.size;
+        stats[i].st_nlink=entry.nlink;
+        stats[i].st_dev=entry.dev;
+        stats[i].st_ino=entry.ino;
+        stats[i].st_mode=entry.mode;
+        stats[i].st_mtim.tv_sec=entry.mtime_sec;
+        stats[i].st_mtim.tv_nsec=entry.mtime_nsec;
+        stats[i].st_ctim.tv_sec=entry.ctime_sec;
+        stats[i].st_ctim.tv_nsec=entry.ctime_nsec;
+    }
+}
+
+
+/*
+    APPEND SCAN CACHE FUNCTION
+*/
+void AppendScanCache(ScanCache *cache, const char *relative_path, const struct stat *dir_st, const DirListing *listing, const struct stat *stats){
+
+    if(cache->output == NULL || cache->failed) return;
+
+    //a directory changed during this second could change again with the same mtime => not caching it
+    if(dir_st->st_mtim.tv_sec >= cache->scan_start || dir_st->st_ctim.tv_sec >= cache->scan_start) return;
+
+    CacheDirHeader header;
+    memset(&header, 0, sizeof(header));
+    header.path_length=strlen(relative_path);
+    header.entry_count=listing->count;
+    header.dev=dir_st->st_dev;
+    header.ino=dir_st->st_ino;
+    header.mtime_sec=dir_st->st_mtim.tv_sec;
+    header.mtime_nsec=dir_st->st_mtim.tv_nsec;
+    header.ctime_sec=dir_st->st_ctim.tv_sec;
+    header.ctime_nsec=dir_st->st_ctim.tv_nsec;
+
+    size_t record_length=sizeof(header) + header.path_length;
+    for(size_t i=0; i < listing->count; i++) record_length+=sizeof(CacheEntryHeader) + strlen(listing->names + listing->entries[i].name_offset);
+    if(record_length > UINT32_MAX) return;
+    header.record_length=record_length;
+
+    int failed=fwrite(&header, sizeof(header), 1, cache->output) != 1;
+    failed|=fwrite(relative_path, 1, header.path_length, cache->output) != header.path_length;
+
+    for(size_t i=0; !failed && i < listing->count; i++){
+        const char *name=listing->names + listing->entries[i].name_offset;
+        CacheEntryHeader entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.size=stats[i].st_size;
+        entry.nlink=stats[i].st_nlink;
+        entry.dev=stats[i].st_dev;
+        entry.ino=stats[i].st_ino;
+        entry.mode=stats[i].st_mode;
+        entry.mtime_sec=stats[i].st_mtim.tv_sec;
+        entry.mtime_nsec=stats[i].st_mtim.tv_nsec;
+        entry.ctime_sec=stats[i].st_ctim.tv_sec;
+        entry.ctime_nsec=stats[i].st_ctim.tv_nsec;
+        entry.name_length=strlen(name);
+
+        failed|=fwrite(&entry, sizeof(entry), 1, cache->output) != 1;
+        failed|=fwrite(name, 1, entry.name_length, cache->output) != entry.name_length;
+    }
+
+    if(failed) cache->failed=1;
+}
+
+
+/*
+    CLOSE SCAN CACHE FUNCTION
+*/
+void CloseScanCache(ScanCache *cache){
+
+    if(cache->output != NULL){
+        //the new cache replaces the previous one only if it was written completely
+        if(fclose(cache->output) != 0) cache->failed=1;
+        if(cache->failed) unlink(cache->temp_name);
+        else rename(cache->temp_name, cache->file_name);
+    }
+    if(cache->map != NULL) munmap(cache->map, cache->map_size);
+
+    free(cache->index);
+    free(cache->file_name);
+    free(cache->temp_name);
+    cache->output=NULL;
+    cache->map=NULL;
+    cache->index=NULL;
+    cache->file_name=cache->temp_name=NULL;
+}
+
+
+/*
+    SETUP STATX RING FUNCTION
+*/
+int SetupStatxRing(StatxRing *ring, unsigned int depth){
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->ring_fd=syscall(__NR_io_uring_setup, depth, &params);
+    if(ring->ring_fd == -1) return -1;
+    ring->depth=depth;
+
+    ring->sq_ring_size=params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+    ring->cq_ring_size=params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){ //the submission and completion rings share one mapping
+        if(ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size=ring->cq_ring_size;
+        ring->cq_ring_size=ring->sq_ring_size;
+    }
+
+    ring->sq_ring=mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED){
+        ring->sq_ring=NULL;
+        CloseStatxRing(ring);
+        return -1;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) ring->cq_ring=ring->sq_ring;
+    else{
+        ring->cq_ring=mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED){
+            ring->cq_ring=NULL;
+            CloseStatxRing(ring);
+            return -1;
+        }
+    }
+
+    ring->sqes_size=params.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sqes=mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED){
+        ring->sqes=NULL;
+        CloseStatxRing(ring);
+        return -1;
+    }
+
+    char *sq=ring->sq_ring, *cq=ring->cq_ring;
+    ring->sq_head=(unsigned int *)(sq + params.sq_off.head);
+    ring->sq_tail=(unsigned int *)(sq + params.sq_off.tail);
+    ring->sq_mask=(unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->sq_array=(unsigned int *)(sq + params.sq_off.array);
+    ring->cq_head=(unsigned int *)(cq + params.cq_off.head);
+    ring->cq_tail=(unsigned int *)(cq + params.cq_off.tail);
+    ring->cq_mask=(unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes=(struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    ring->buffers=malloc(depth*sizeof(struct statx));
+    ring->free_slots=malloc(depth*sizeof(unsigned int));
+    if(ring->buffers == NULL || ring->free_slots == NULL){
+        CloseStatxRing(ring);
+        return -1;
+    }
+    for(unsigned int i=0; i < depth; i++) ring->free_slots[i]=i;
+    ring->free_count=depth;
+
+    return 0;
+}
+
+
+/*
+    CLOSE STATX RING FUNCTION
+*/
+void CloseStatxRing(StatxRing *ring){
+
+    if(ring->sqes != NULL) munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring != NULL) munmap(ring->sq_ring, ring->sq_ring_size);
+    if(ring->ring_fd > 0) close(ring->ring_fd);
+    free(ring->buffers);
+    free(ring->free_slots);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd=-1;
+}
+
+
+/*
+    STAT LISTING WITH RING FUNCTION
+*/
+//after io_uring_enter failed: the requests not taken by the kernel are withdrawn and the ones in flight are waited for
+//(their completions are dropped), so their statx buffers are free again and no request of this listing can complete
+//later in the listing of another directory; the ring is not used anymore
+static void AbandonStatxRing(StatxRing *ring){
+
+    //without SQPOLL the kernel reads the submission queue only in io_uring_enter
+    unsigned int head=__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE), tail=*ring->sq_tail;
+    for(; tail != head; tail--) ring->free_slots[ring->free_count++]=(unsigned int)(ring->sqes[(tail - 1) & *ring->sq_mask].user_data & 0xffffffffu);
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+
+    while(ring->free_count < ring->depth){
+        unsigned int cq_head=*ring->cq_head;
+        while(cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+            ring->free_slots[ring->free_count++]=(unsigned int)(ring->cqes[cq_head & *ring->cq_mask].user_data & 0xffffffffu);
+            cq_head++;
+        }
+        __atomic_store_n(ring->cq_head, cq_head, __ATOMIC_RELEASE);
+        if(ring->free_count == ring->depth) break;
+
+        int entered;
+        do entered=syscall(__NR_io_uring_enter, ring->ring_fd, 0, ring->depth - ring->free_count, IORING_ENTER_GETEVENTS, NULL, 0);
+        while(entered == -1 && errno == EINTR);
+        if(entered == -1){
+            //the requests in flight can't be waited for => their buffers are not freed with the ring (they could still
+            //be written by the kernel)
+            ring->buffers=NULL;
+            break;
+        }
+    }
+    ring->failed=1;
+}
+
+int StatListingWithRing(StatxRing *ring, int dir_fd, const DirListing *listing, struct stat *stats, int *result){
+
+    size_t next=0, completed=0;
+    if(ring->failed) return -1;
+
+    while(completed < listing->count){
+        //filling the submission queue with the next entries (at most one request for each free statx buffer)
+        unsigned int tail=*ring->sq_tail;
+        while(next < listing->count && ring->free_count > 0){
+            unsigned int slot=ring->free_slots[--ring->free_count];
+            unsigned int index=tail & *ring->sq_mask;
+            struct io_uring_sqe *sqe=&ring->sqes[index];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode=IORING_OP_STATX;
+            sqe->fd=dir_fd;
+            sqe->addr=(unsigned long)(listing->names + listing->entries[next].name_offset);
+            sqe->len=statx_mask;
+            sqe->off=(unsigned long)&ring->buffers[slot];
+            sqe->statx_flags=AT_SYMLINK_NOFOLLOW;
+            sqe->user_data=((unsigned long long)next << 32) | slot;
+
+            ring->sq_array[index]=index;
+            tail++;
+            next++;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        //submitting the batch (with the requests not taken by a previous call, if the kernel took only a part of them)
+        //and waiting for at least one completion
+        unsigned int to_submit=tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        int entered;
+        do entered=syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        while(entered == -1 && errno == EINTR);
+        if(entered == -1){
+            AbandonStatxRing(ring);
+            return -1;
+        }
+        __atomic_add_fetch(&count_uring_enters, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&count_statx_requests, (long)entered, __ATOMIC_RELAXED);
+
+        //consuming all the completions that arrived
+        unsigned int head=*ring->cq_head;
+        while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+            struct io_uring_cqe *cqe=&ring->cqes[head & *ring->cq_mask];
+            size_t entry=(size_t)(cqe->user_data >> 32);
+            unsigned int slot=(unsigned int)(cqe->user_data & 0xffffffffu);
+
+            if(cqe->res == 0){
+                struct statx *stx=&ring->buffers[slot];
+                memset(&stats[entry], 0, sizeof(struct stat));
+                stats[entry].st_mode=stx->stx_mode;
+                stats[entry].st_nlink=stx->stx_nlink;
+                stats[entry].st_size=stx->stx_size;
+                stats[entry].st_ino=stx->stx_ino;
+                stats[entry].st_dev=makedev(stx->stx_dev_major, stx->stx_dev_minor);
+                stats[entry].st_mtim.tv_sec=stx->stx_mtime.tv_sec;
+                stats[entry].st_mtim.tv_nsec=stx->stx_mtime.tv_nsec;
+                stats[entry].st_ctim.tv_sec=stx->stx_ctime.tv_sec;
+                stats[entry].st_ctim.tv_nsec=stx->stx_ctime.tv_nsec;
+                result[entry]=0;
+            }
+            //the request failed (or IORING_OP_STATX is not supported by the kernel) => trying again with fstatat
+            else result[entry]=fstatat(dir_fd, listing->names + listing->entries[entry].name_offset, &stats[entry], AT_SYMLINK_NOFOLLOW);
+
+            ring->free_slots[ring->free_count++]=slot;
+            completed++;
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+
+/*
+    BUILD PERMISSION TABLE FUNCTION
+*/
+void BuildPermissionTable(void){
+
+    const char letters[]="rwxrwxrwx";
+
+    for(int mode=0; mode < 512; mode++){
+        char *text=permission_strings[mode];
+        for(int bit=0, position=0; bit < 9; bit++, position++){
+            if(bit == 3 || bit == 6) text[position++]=' ';
+            text[position]=(mode & (0400 >> bit)) ? letters[bit] : '-';
+        }
+        text[11]='\0';
+    }
+}
+
+
+/*
+    FORMAT UNSIGNED FUNCTION
+*/
+char *FormatUnsigned(char *end, unsigned long long value){
+
+    static const char digit_pairs[201]=
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    while(value >= 100){
+        unsigned int pair=(unsigned int)(value % 100)*2;
+        value/=100;
+        *--end=digit_pairs[pair + 1];
+        *--end=digit_pairs[pair];
+    }
+    if(value >= 10){
+        *--end=digit_pairs[value*2 + 1];
+        *--end=digit_pairs[value*2];
+    }
+    else *--end=(char)('0' + value);
+
+    return end;
+}
+
+
+/*
+    RESERVE RECORD BUFFER FUNCTION
+*/
+int ReserveRecordBuffer(RecordBuffer *buffer, size_t length){
+
+    if(buffer->length + length <= buffer->capacity) return 0;
+
+    size_t new_capacity=buffer->capacity ? buffer->capacity : 4096;
+    while(buffer->length + length > new_capacity) new_capacity*=2;
+    char *new_data=realloc(buffer->data, new_capacity);
+    if(new_data == NULL) return -1;
+
+    buffer->data=new_data;
+    buffer->capacity=new_capacity;
+    return 0;
+}
+
+
+/*
+    ENCODE SNAPSHOT RECORD FUNCTION
+*/
+int EncodeSnapshotRecord(RecordBuffer *buffer, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash){
+
+    //the text around the path has at most 160 characters (two numbers of 20 digits, a sign, the labels and the hash)
+    if(ReserveRecordBuffer(buffer, path_length + 160) == -1) return -1;
+
+    char *out=buffer->data + buffer->length;
+    char digits[24];
+    char *first;
+
+    //the same text as "Path: %s\nSize: %ld bytes\nAccess Rights: %s\nHard Links: %ld\n\n"
+    memcpy(out, "Path: ", 6);
+    out+=6;
+    memcpy(out, path, path_length);
+    out+=path_length;
+
+    memcpy(out, "\nSize: ", 7);
+    out+=7;
+    if(st->st_size < 0) *out++='-';
+    first=FormatUnsigned(digits + sizeof(digits), st->st_size < 0 ? -(unsigned long long)st->st_size : (unsigned long long)st->st_size);
+    memcpy(out, first, digits + sizeof(digits) - first);
+    out+=digits + sizeof(digits) - first;
+
+    memcpy(out, " bytes\nAccess Rights: ", 22);
+    out+=22;
+    memcpy(out, permission_strings[st->st_mode & 0777], 11);
+    out+=11;
+
+    memcpy(out, "\nHard Links: ", 13);
+    out+=13;
+    first=FormatUnsigned(digits + sizeof(digits), (unsigned long long)st->st_nlink);
+    memcpy(out, first, digits + sizeof(digits) - first);
+    out+=digits + sizeof(digits) - first;
+
+    //"Content Hash: %016llx" only for the files hashed with "--content-hash"
+    if(content_hash != NULL){
+        memcpy(out, "\nContent Hash: ", 15);
+        out+=15;
+        for(int shift=60; shift >= 0; shift-=4) *out++="0123456789abcdef"[(*content_hash >> shift) & 0xf];
+    }
+
+    *out++='\n';
+    *out++='\n';
+
+    buffer->length=out - buffer->data;
+    return 0;
+}
+
+
+/*
+    OPEN SNAPSHOT WRITER FUNCTION
+*/
+//creates a temporary file in the directory (without a name, so it is deleted when it is closed)
+static int CreateTemporaryFile(const char *directory){
+
+    int fd=open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(fd != -1) return fd;
+
+    //a file system without O_TMPFILE => a file deleted right after it is created
+    char name[PATH_MAX];
+    if(snprintf(name, sizeof(name), "%s/.temporary_XXXXXX", directory) >= (int)sizeof(name)) return -1;
+    fd=mkstemp(name);
+    if(fd != -1) unlink(name);
+
+    return fd;
+}
+
+void OpenSnapshotWriter(SnapshotWriter *writer, int fd, const char *file_name, int binary, const char *filters, size_t filters_length){
+
+    memset(writer, 0, sizeof(*writer));
+    writer->fd=fd;
+    writer->strings_fd=-1;
+    writer->hash=HashBytes(NULL, 0);
+    writer->chunk_size=write_buffer_size < WRITE_CHUNK_SIZE ? write_buffer_size : WRITE_CHUNK_SIZE;
+    writer->binary=binary;
+    writer->filters=filters;
+    writer->filters_length=filters_length;
+
+    //a separate ring with its own queue, so the completions of the writes are not mixed with the statx requests
+    if(write_uring){
+        writer->ring=malloc(sizeof(StatxRing));
+        if(writer->ring != NULL && SetupStatxRing(writer->ring, 2) == -1){
+            fprintf(stderr, "*create_snapshots* error: Failed to create the io_uring (%s) => using writev for  \"%s\"\n", strerror(errno), monitored_directory);
+            free(writer->ring);
+            writer->ring=NULL;
+        }
+    }
+
+    //the space for the header of the binary format (it is written when the snapshot is closed)
+    if(binary){
+        SnapshotFileHeader empty;
+        memset(&empty, 0, sizeof(empty));
+        if(WriteSnapshotData(writer, (const char *)&empty, sizeof(empty)) == -1) writer->failed=1;
+
+        //the table of paths waits in a temporary file next to the snapshot (the records come first in the file)
+        char directory[PATH_MAX];
+        const char *slash=strrchr(file_name, '/');
+        if(slash == NULL) snprintf(directory, sizeof(directory), ".");
+        else snprintf(directory, sizeof(directory), "%.*s", slash == file_name ? 1 : (int)(slash - file_name), file_name);
+        writer->strings_fd=CreateTemporaryFile(directory);
+        if(writer->strings_fd == -1){
+            fprintf(stderr, "*create_snapshots* error: Failed to create the temporary file of the paths (%s) for  \"%s\"\n", strerror(errno), file_name);
+            writer->failed=1;
+        }
+    }
+}
+
+
+/*
+    RESERVE SNAPSHOT CHUNK FUNCTION
+*/
+RecordBuffer *ReserveSnapshotChunk(SnapshotWriter *writer, size_t length){
+
+    ChunkSet *set=&writer->sets[writer->current];
+
+    if(set->count > 0 && set->chunks[set->count-1].length + length <= set->chunks[set->count-1].capacity) return &set->chunks[set->count-1];
+
+    //the last chunk is full => using the next one (a record is never split between chunks)
+    if(set->count == set->capacity){
+        size_t new_capacity=set->capacity ? set->capacity*2 : 16;
+        RecordBuffer *new_chunks=realloc(set->chunks, new_capacity*sizeof(RecordBuffer));
+        if(new_chunks == NULL) return NULL;
+        memset(new_chunks + set->capacity, 0, (new_capacity - set->capacity)*sizeof(RecordBuffer));
+        set->chunks=new_chunks;
+        set->capacity=new_capacity;
+    }
+
+    RecordBuffer *chunk=&set->chunks[set->count];
+    if(chunk->capacity < length || chunk->capacity < writer->chunk_size){
+        size_t new_capacity=length > writer->chunk_size ? length : writer->chunk_size;
+        char *new_data=realloc(chunk->data, new_capacity);
+        if(new_data == NULL) return NULL;
+        chunk->data=new_data;
+        chunk->capacity=new_capacity;
+    }
+    chunk->length=0;
+    set->count++;
+
+    return chunk;
+}
+
+
+/*
+    WRITE SNAPSHOT DATA FUNCTION
+*/
+int WriteSnapshotData(SnapshotWriter *writer, const char *data, size_t length){
+
+    //the data is split in pieces of the size of a chunk (unlike the records)
+    while(length > 0){
+        size_t piece=length < writer->chunk_size ? length : writer->chunk_size;
+        RecordBuffer *chunk=ReserveSnapshotChunk(writer, piece);
+        if(chunk == NULL) return -1;
+
+        memcpy(chunk->data + chunk->length, data, piece);
+        chunk->length+=piece;
+        writer->sets[writer->current].length+=piece;
+        data+=piece;
+        length-=piece;
+
+        if(writer->sets[writer->current].length >= write_buffer_size) FlushSnapshotWriter(writer);
+    }
+
+    return 0;
+}
+
+
+/*
+    WRITE SNAPSHOT RECORD FUNCTION
+*/
+int WriteSnapshotRecord(SnapshotWriter *writer, const char *path, size_t path_length, const struct stat *st){
+
+    HashPool *pool=writer->hashes;
+
+    //without content hashes (or while no record is waiting) the other entries are written directly
+    //(head and tail are changed only by the writer, so they are read without the lock)
+    if(pool == NULL || (!S_ISREG(st->st_mode) && pool->head == pool->tail)) return AppendSnapshotRecord(writer, path, path_length, st, NULL);
+
+    if(pool->tail - pool->head == CONTENT_HASH_WINDOW && DrainHashPool(writer, 0) == -1) return -1;
+
+    HashJob *job=&pool->jobs[pool->tail % CONTENT_HASH_WINDOW];
+    if(job->path.capacity < path_length + 1){
+        char *new_data=realloc(job->path.data, path_length + 1);
+        if(new_data == NULL) return -1;
+        job->path.data=new_data;
+        job->path.capacity=path_length + 1;
+    }
+    memcpy(job->path.data, path, path_length);
+    job->path.data[path_length]='\0';
+    job->path.length=path_length;
+    job->st=*st;
+
+    //an empty file is not opened (its hash is the hash of no data), an unchanged file is not read again
+    job->cacheable=0;
+    if(S_ISREG(st->st_mode) && st->st_size == 0){
+        ContentHashState state;
+        StartContentHash(&state);
+        job->content_hash=FinishContentHash(&state);
+        job->state=HASH_READY;
+        __atomic_add_fetch(&count_hashed_files, 1, __ATOMIC_RELAXED);
+    }
+    else if(S_ISREG(st->st_mode) && pool->cache != NULL && LookupHashCache(pool->cache, st, &job->content_hash)){
+        job->state=HASH_READY;
+        job->cacheable=1;
+        count_cached_hashes++;
+    }
+    else job->state=S_ISREG(st->st_mode) ? HASH_PENDING : HASH_NONE;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->tail++;
+    if(job->state == HASH_PENDING) pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return DrainHashPool(writer, 0);
+}
+
+
+/*
+    APPEND SNAPSHOT RECORD FUNCTION
+*/
+int AppendSnapshotRecord(SnapshotWriter *writer, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash){
+
+    if(writer->tree != NULL) AddMerkleRecord(writer->tree, path, path_length, st, content_hash);
+    if(writer->binary) return WriteBinaryRecord(writer, path, path_length, st, content_hash);
+
+    //the record is encoded directly in the chunk (the text around the path has at most 160 characters)
+    RecordBuffer *chunk=ReserveSnapshotChunk(writer, path_length + 160);
+    if(chunk == NULL) return -1;
+
+    size_t previous_length=chunk->length;
+    if(EncodeSnapshotRecord(chunk, path, path_length, st, content_hash) == -1) return -1;
+    writer->sets[writer->current].length+=chunk->length - previous_length;
+    writer->record_count++;
+
+    if(writer->sets[writer->current].length >= write_buffer_size) FlushSnapshotWriter(writer);
+    return 0;
+}
+
+
+/*
+    DRAIN HASH POOL FUNCTION
+*/
+int DrainHashPool(SnapshotWriter *writer, int wait_all){
+
+    HashPool *pool=writer->hashes;
+    int result=0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(pool->head < pool->tail){
+        HashJob *job=&pool->jobs[pool->head % CONTENT_HASH_WINDOW];
+        if(job->state == HASH_PENDING){
+            if(!wait_all && pool->tail - pool->head < CONTENT_HASH_WINDOW) break;
+            pthread_cond_wait(&pool->done_cond, &pool->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        //the slot is not used by the threads anymore => the record is written without the lock
+        if(AppendSnapshotRecord(writer, job->path.data, job->path.length, &job->st, job->state == HASH_READY ? &job->content_hash : NULL) == -1) result=-1;
+        if(job->state == HASH_READY && job->cacheable && pool->cache != NULL) AddHashCache(pool->cache, &job->st, job->content_hash);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->head++;
+        if(pool->next < pool->head) pool->next=pool->head; //the records written without hashing are not taken anymore
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return result;
+}
+
+
+/*
+    START CONTENT HASH FUNCTION
+*/
+static inline uint64_t RotateLeft(uint64_t value, int bits){
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t ContentRound(uint64_t lane, uint64_t input){
+    return RotateLeft(lane + input*CONTENT_PRIME_2, 31)*CONTENT_PRIME_1;
+}
+
+static inline uint64_t Read64(const unsigned char *data){
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+void StartContentHash(ContentHashState *state){
+
+    memset(state, 0, sizeof(*state));
+    state->lanes[0]=CONTENT_PRIME_1 + CONTENT_PRIME_2;
+    state->lanes[1]=CONTENT_PRIME_2;
+    state->lanes[2]=0;
+    state->lanes[3]=-CONTENT_PRIME_1;
+}
+
+
+/*
+    UPDATE CONTENT HASH FUNCTION
+*/
+void UpdateContentHash(ContentHashState *state, const void *data, size_t length){
+
+    const unsigned char *position=data, *end=position + length;
+    state->total_length+=length;
+
+    //completing the stripe from the previous call
+    if(state->stripe_length > 0){
+        size_t missing=32 - state->stripe_length;
+        if(length < missing){
+            memcpy(state->stripe + state->stripe_length, position, length);
+            state->stripe_length+=length;
+            return;
+        }
+        memcpy(state->stripe + state->stripe_length, position, missing);
+        position+=missing;
+        for(int lane=0; lane < 4; lane++) state->lanes[lane]=ContentRound(state->lanes[lane], Read64(state->stripe + 8*lane));
+        state->stripe_length=0;
+    }
+
+    //the lanes are kept in locals, so the compiler keeps them in registers for the entire block
+    uint64_t lane0=state->lanes[0], lane1=state->lanes[1], lane2=state->lanes[2], lane3=state->lanes[3];
+    for(; end - position >= 32; position+=32){
+        lane0=ContentRound(lane0, Read64(position));
+        lane1=ContentRound(lane1, Read64(position + 8));
+        lane2=ContentRound(lane2, Read64(position + 16));
+        lane3=ContentRound(lane3, Read64(position + 24));
+    }
+    state->lanes[0]=lane0;
+    state->lanes[1]=lane1;
+    state->lanes[2]=lane2;
+    state->lanes[3]=lane3;
+
+    memcpy(state->stripe, position, end - position);
+    state->stripe_length=end - position;
+}
+
+
+/*
+    FINISH CONTENT HASH FUNCTION
+*/
+uint64_t FinishContentHash(const ContentHashState *state){
+
+    uint64_t hash;
+    if(state->total_length >= 32){
+        hash=RotateLeft(state->lanes[0], 1) + RotateLeft(state->lanes[1], 7) + RotateLeft(state->lanes[2], 12) + RotateLeft(state->lanes[3], 18);
+        for(int lane=0; lane < 4; lane++){
+            hash^=ContentRound(0, state->lanes[lane]);
+            hash=hash*CONTENT_PRIME_1 + CONTENT_PRIME_4;
+        }
+    }
+    else hash=state->lanes[2] + CONTENT_PRIME_5;
+    hash+=state->total_length;
+
+    //the bytes of the last incomplete stripe
+    const unsigned char *position=state->stripe, *end=state->stripe + state->stripe_length;
+    for(; end - position >= 8; position+=8){
+        hash^=ContentRound(0, Read64(position));
+        hash=RotateLeft(hash, 27)*CONTENT_PRIME_1 + CONTENT_PRIME_4;
+    }
+    if(end - position >= 4){
+        uint32_t value;
+        memcpy(&value, position, sizeof(value));
+        hash^=(uint64_t)value*CONTENT_PRIME_1;
+        hash=RotateLeft(hash, 23)*CONTENT_PRIME_2 + CONTENT_PRIME_3;
+        position+=4;
+    }
+    for(; position < end; position++){
+        hash^=*position*CONTENT_PRIME_5;
+        hash=RotateLeft(hash, 11)*CONTENT_PRIME_1;
+    }
+
+    hash^=hash >> 33;
+    hash*=CONTENT_PRIME_2;
+    hash^=hash >> 29;
+    hash*=CONTENT_PRIME_3;
+    hash^=hash >> 32;
+
+    return hash;
+}
+
+
+/*
+    HASH FILE CONTENT FUNCTION
+*/
+int HashFileContent(const char *path, const struct stat *st, char *buffer, uint64_t *hash){
+
+    //O_NOATIME is allowed only for the owner of the file (or root)
+    int fd=open(path, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC | O_NOATIME);
+    if(fd == -1 && errno == EPERM) fd=open(path, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC);
+    if(fd == -1) return -1;
+
+    //the file was replaced after its record was created => its content is not the one of the record
+    struct stat file_st;
+    if(fstat(fd, &file_st) == -1 || !S_ISREG(file_st.st_mode) || (st->st_ino != 0 && (file_st.st_ino != st->st_ino || file_st.st_dev != st->st_dev))){
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    ContentHashState state;
+    StartContentHash(&state);
+    long bytes=0;
+    ssize_t length;
+    while((length=read(fd, buffer, CONTENT_HASH_BUFFER_SIZE)) != 0){
+        if(length == -1 && errno == EINTR) continue;
+        if(length == -1){
+            close(fd);
+            return -1;
+        }
+        UpdateContentHash(&state, buffer, length);
+        bytes+=length;
+    }
+
+    //the file was written after its record was created (or while it was read) => the hash is not cached
+    int changed=fstat(fd, &file_st) == -1 || file_st.st_size != st->st_size || file_st.st_mtim.tv_sec != st->st_mtim.tv_sec ||
+                file_st.st_mtim.tv_nsec != st->st_mtim.tv_nsec || file_st.st_ctim.tv_sec != st->st_ctim.tv_sec || file_st.st_ctim.tv_nsec != st->st_ctim.tv_nsec;
+    close(fd);
+
+    *hash=FinishContentHash(&state);
+    __atomic_add_fetch(&count_hashed_bytes, bytes, __ATOMIC_RELAXED);
+    return changed;
+}
+
+
+/*
+    START HASH POOL FUNCTION
+*/
+int StartHashPool(HashPool *pool, int thread_count){
+
+    memset(pool, 0, sizeof(*pool));
+    pool->jobs=calloc(CONTENT_HASH_WINDOW, sizeof(HashJob));
+    pool->threads=malloc(thread_count*sizeof(pthread_t));
+    if(pool->jobs == NULL || pool->threads == NULL){
+        free(pool->jobs);
+        free(pool->threads);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for(; pool->thread_count < thread_count; pool->thread_count++){
+        if(pthread_create(&pool->threads[pool->thread_count], NULL, HashWorker, pool) != 0) break;
+    }
+    if(pool->thread_count == 0){
+        StopHashPool(pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+    HASH WORKER FUNCTION
+*/
+void *HashWorker(void *arg){
+
+    HashPool *pool=arg;
+
+    //the aligned buffer lets the kernel copy whole pages (and is ready for O_DIRECT)
+    char *buffer=NULL;
+    if(posix_memalign((void **)&buffer, 4096, CONTENT_HASH_BUFFER_SIZE) != 0) buffer=NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1){
+        //the records that are not hashed are skipped (they are written without waiting)
+        while(pool->next < pool->tail && pool->jobs[pool->next % CONTENT_HASH_WINDOW].state != HASH_PENDING) pool->next++;
+        if(pool->next == pool->tail){
+            if(pool->stopping) break;
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+            continue;
+        }
+        HashJob *job=&pool->jobs[pool->next++ % CONTENT_HASH_WINDOW];
+        pthread_mutex_unlock(&pool->lock);
+
+        uint64_t hash=0;
+        int status=buffer != NULL ? HashFileContent(job->path.data, &job->st, buffer, &hash) : -1;
+        if(status != -1) __atomic_add_fetch(&count_hashed_files, 1, __ATOMIC_RELAXED);
+        else __atomic_add_fetch(&count_unhashed_files, 1, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&pool->lock);
+        job->content_hash=hash;
+        job->cacheable=status == 0;
+        job->state=status != -1 ? HASH_READY : HASH_NONE;
+        pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    free(buffer);
+    return NULL;
+}
+
+
+/*
+    STOP HASH POOL FUNCTION
+*/
+void StopHashPool(HashPool *pool){
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping=1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i=0; i < pool->thread_count; i++) pthread_join(pool->threads[i], NULL);
+
+    for(size_t i=0; i < CONTENT_HASH_WINDOW; i++) free(pool->jobs[i].path.data);
+    free(pool->jobs);
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    memset(pool, 0, sizeof(*pool));
+}
+
+
+/*
+    OPEN HASH CACHE FUNCTION
+*/
+int OpenHashCache(HashCache *cache, const char *output_path, const char *dir_name){
+
+    memset(cache, 0, sizeof(*cache));
+    cache->scan_start=time(NULL);
+    snprintf(cache->file_name, sizeof(cache->file_name), "%s/%s_Hash.cache", output_path, dir_name);
+    snprintf(cache->temp_name, sizeof(cache->temp_name), "%s/%s_Hash.cache.tmp", output_path, dir_name);
+
+    //mapping the previous table (the size must match the capacity from the header)
+    int cache_fd=open(cache->file_name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(cache_fd != -1 && fstat(cache_fd, &st) == 0 && (size_t)st.st_size > sizeof(HashCacheHeader)){
+        cache->map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, cache_fd, 0);
+        if(cache->map == MAP_FAILED) cache->map=NULL;
+        else{
+            const HashCacheHeader *header=(const HashCacheHeader *)cache->map;
+            if(memcmp(header->magic, HASH_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0 ||
+               header->capacity > (st.st_size - sizeof(HashCacheHeader))/sizeof(HashCacheEntry) ||
+               sizeof(HashCacheHeader) + header->capacity*sizeof(HashCacheEntry) != (size_t)st.st_size || header->count >= header->capacity){
+                munmap(cache->map, st.st_size);
+                cache->map=NULL;
+            }
+            else{
+                cache->map_size=st.st_size;
+                cache->entries=(const HashCacheEntry *)(cache->map + sizeof(HashCacheHeader));
+                cache->capacity=header->capacity;
+                madvise(cache->map, cache->map_size, MADV_RANDOM);
+            }
+        }
+    }
+    if(cache_fd != -1) close(cache_fd);
+
+    //the new table starts with the size of the previous one (most of the files are the same)
+    cache->table_capacity=cache->capacity > 1024 ? cache->capacity : 1024;
+    cache->table=calloc(cache->table_capacity, sizeof(HashCacheEntry));
+    if(cache->table == NULL){
+        CloseHashCache(cache);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+    HASH CACHE SLOT FUNCTION (the first entry checked for a file)
+*/
+static size_t HashCacheSlot(uint64_t dev, uint64_t ino, size_t capacity){
+
+    uint64_t key=UpdateHash(HashBytes(&dev, sizeof(dev)), &ino, sizeof(ino));
+    return key & (capacity - 1);
+}
+
+
+/*
+    LOOKUP HASH CACHE FUNCTION
+*/
+int LookupHashCache(const HashCache *cache, const struct stat *st, uint64_t *hash){
+
+    if(cache->entries == NULL || st->st_ino == 0) return 0;
+
+    //the count is smaller than the capacity, so an empty entry ends the search
+    for(size_t slot=HashCacheSlot(st->st_dev, st->st_ino, cache->capacity); cache->entries[slot].ino != 0; slot=(slot + 1) & (cache->capacity - 1)){
+        const HashCacheEntry *entry=&cache->entries[slot];
+        if(entry->dev != (uint64_t)st->st_dev || entry->ino != (uint64_t)st->st_ino) continue;
+
+        if(entry->size != st->st_size || entry->mtime_sec != st->st_mtim.tv_sec || entry->mtime_nsec != (uint32_t)st->st_mtim.tv_nsec ||
+           entry->ctime_sec != st->st_ctim.tv_sec || entry->ctime_nsec != (uint32_t)st->st_ctim.tv_nsec) return 0;
+        *hash=entry->hash;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+    ADD HASH CACHE FUNCTION
+*/
+void AddHashCache(HashCache *cache, const struct stat *st, uint64_t hash){
+
+    //a file changed in the last second could change again without changing its mtime
+    if(cache->failed || st->st_ino == 0 || st->st_mtim.tv_sec >= cache->scan_start || st->st_ctim.tv_sec >= cache->scan_start) return;
+
+    //the table is doubled when it becomes half full
+    if((cache->table_count + 1)*2 > cache->table_capacity){
+        size_t new_capacity=cache->table_capacity*2;
+        HashCacheEntry *new_table=calloc(new_capacity, sizeof(HashCacheEntry));
+        if(new_table == NULL){
+            cache->failed=1;
+            return;
+        }
+        for(size_t i=0; i < cache->table_capacity; i++){
+            if(cache->table[i].ino == 0) continue;
+            size_t slot=HashCacheSlot(cache->table[i].dev, cache->table[i].ino, new_capacity);
+            while(new_table[slot].ino != 0) slot=(slot + 1) & (new_capacity - 1);
+            new_table[slot]=cache->table[i];
+        }
+        free(cache->table);
+        cache->table=new_table;
+        cache->table_capacity=new_capacity;
+    }
+
+    //the hard links of a file have the same entry
+    size_t slot=HashCacheSlot(st->st_dev, st->st_ino, cache->table_capacity);
+    while(cache->table[slot].ino != 0 && !(cache->table[slot].dev == (uint64_t)st->st_dev && cache->table[slot].ino == (uint64_t)st->st_ino)) slot=(slot + 1) & (cache->table_capacity - 1);
+    if(cache->table[slot].ino == 0) cache->table_count++;
+
+    HashCacheEntry *entry=&cache->table[slot];
+    entry->dev=st->st_dev;
+    entry->ino=st->st_ino;
+    entry->size=st->st_size;
+    entry->mtime_sec=st->st_mtim.tv_sec;
+    entry->mtime_nsec=st->st_mtim.tv_nsec;
+    entry->ctime_sec=st->st_ctim.tv_sec;
+    entry->ctime_nsec=st->st_ctim.tv_nsec;
+    entry->hash=hash;
+}
+
+
+/*
+    CLOSE HASH CACHE FUNCTION
+*/
+void CloseHashCache(HashCache *cache){
+
+    if(cache->table != NULL && !cache->failed){
+        HashCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HASH_CACHE_MAGIC, sizeof(header.magic));
+        header.capacity=cache->table_capacity;
+        header.count=cache->table_count;
+
+        //the table is synced before the rename, so after a crash the file is either the previous table or the new one
+        int fd=open(cache->temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        struct iovec iov[2]={{&header, sizeof(header)}, {cache->table, cache->table_capacity*sizeof(HashCacheEntry)}};
+        int result=fd == -1 ? -1 : WriteAllBuffers(fd, iov, 2);
+        if(fd != -1 && fdatasync(fd) == -1) result=-1;
+        if(fd != -1 && close(fd) == -1) result=-1;
+
+        if(result == -1 || rename(cache->temp_name, cache->file_name) == -1){
+            fprintf(stderr, "*create_snapshots* error: Failed to write the hash cache  \"%s\"\n", cache->file_name);
+            unlink(cache->temp_name);
+        }
+    }
+
+    if(cache->map != NULL) munmap(cache->map, cache->map_size);
+    free(cache->table);
+    cache->map=NULL;
+    cache->entries=NULL;
+    cache->table=NULL;
+}
+
+
+/*
+    WRITE ALL BUFFERS FUNCTION
+*/
+int WriteAllBuffers(int fd, struct iovec *iov, int count){
+
+    while(count > 0){
+        int batch=count < IOV_MAX ? count : IOV_MAX;
+        ssize_t written=writev(fd, iov, batch);
+        if(written == -1 && errno == EINTR) continue;
+        if(written == -1) return -1;
+        count_snapshot_writes++;
+        count_snapshot_bytes+=written;
+
+        //skipping the buffers written entirely and moving the start of the one written partially
+        while(count > 0 && (size_t)written >= iov->iov_len){
+            written-=iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0){
+            iov->iov_base=(char *)iov->iov_base + written;
+            iov->iov_len-=written;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+    WAIT SNAPSHOT WRITE FUNCTION
+*/
+void WaitSnapshotWrite(SnapshotWriter *writer){
+
+    if(!writer->in_flight) return;
+
+    StatxRing *ring=writer->ring;
+    ChunkSet *set=&writer->sets[1 - writer->current];
+
+    int entered=0;
+    while(__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) == *ring->cq_head && entered != -1){
+        do entered=syscall(__NR_io_uring_enter, ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        while(entered == -1 && errno == EINTR);
+    }
+
+    long result=-1;
+    if(__atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) != *ring->cq_head){
+        result=ring->cqes[*ring->cq_head & *ring->cq_mask].res;
+        __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+    }
+    writer->in_flight=0;
+
+    size_t written=0;
+    if(result > 0){
+        count_snapshot_writes++;
+        count_snapshot_bytes+=result;
+        written=(size_t)result;
+    }
+
+    //the write failed or was partial (or IORING_OP_WRITEV is not supported) => writing the rest with pwrite
+    off_t start=writer->offset - writer->in_flight_length;
+    size_t chunk_start=0;
+    for(size_t i=0; !writer->failed && i < set->count; chunk_start+=set->chunks[i].length, i++){
+        while(written < chunk_start + set->chunks[i].length){
+            size_t skip=written - chunk_start;
+            ssize_t count=pwrite(writer->fd, set->chunks[i].data + skip, set->chunks[i].length - skip, start + written);
+            if(count == -1 && errno == EINTR) continue;
+            if(count <= 0){
+                writer->failed=1;
+                break;
+            }
+            count_snapshot_writes++;
+            count_snapshot_bytes+=count;
+            written+=count;
+        }
+    }
+
+    set->count=0;
+    set->length=0;
+
+    if(entered == -1){ //the ring can't be used anymore => writev is used for the rest of the snapshot
+        CloseStatxRing(ring);
+        free(ring);
+        writer->ring=NULL;
+        lseek(writer->fd, writer->offset, SEEK_SET);
+    }
+}
+
+
+/*
+    FLUSH SNAPSHOT WRITER FUNCTION
+*/
+void FlushSnapshotWriter(SnapshotWriter *writer){
+
+    ChunkSet *set=&writer->sets[writer->current];
+    if(set->length == 0) return;
+
+    for(size_t i=0; i < set->count; i++) writer->hash=UpdateHash(writer->hash, set->chunks[i].data, set->chunks[i].length);
+
+    if(set->count > set->iov_capacity){
+        struct iovec *new_iov=realloc(set->iov, set->capacity*sizeof(struct iovec));
+        if(new_iov != NULL){
+            set->iov=new_iov;
+            set->iov_capacity=set->capacity;
+        }
+    }
+    int use_iov=set->count <= set->iov_capacity; //otherwise the chunks are written one by one
+    for(size_t i=0; use_iov && i < set->count; i++){
+        set->iov[i].iov_base=set->chunks[i].data;
+        set->iov[i].iov_len=set->chunks[i].length;
+    }
+
+    //with io_uring: waiting for the previous set, submitting this one and filling the other set in the meantime
+    if(writer->ring != NULL && use_iov && set->count <= IOV_MAX){
+        WaitSnapshotWrite(writer);
+    }
+    if(writer->ring != NULL && use_iov && set->count <= IOV_MAX){
+        StatxRing *ring=writer->ring;
+        unsigned int tail=*ring->sq_tail;
+        unsigned int index=tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe=&ring->sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode=IORING_OP_WRITEV;
+        sqe->fd=writer->fd;
+        sqe->addr=(unsigned long)set->iov;
+        sqe->len=set->count;
+        sqe->off=writer->offset;
+        ring->sq_array[index]=index;
+        __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        int entered;
+        do entered=syscall(__NR_io_uring_enter, ring->ring_fd, 1, 0, 0, NULL, 0);
+        while(entered == -1 && errno == EINTR);
+
+        if(entered != -1){
+            writer->in_flight=1;
+            writer->in_flight_length=set->length;
+            writer->offset+=set->length;
+            writer->current=1 - writer->current;
+            return;
+        }
+
+        //the write could not be submitted => the ring is closed and writev is used for the rest of the snapshot
+        CloseStatxRing(ring);
+        free(ring);
+        writer->ring=NULL;
+        lseek(writer->fd, writer->offset, SEEK_SET);
+    }
+
+    //with writev (the writes made with io_uring use offsets, so the position of the file is set before)
+    if(writer->ring != NULL){
+        WaitSnapshotWrite(writer);
+        lseek(writer->fd, writer->offset, SEEK_SET);
+    }
+    if(use_iov){
+        if(WriteAllBuffers(writer->fd, set->iov, (int)set->count) == -1) writer->failed=1;
+    }
+    else{
+        for(size_t i=0; i < set->count; i++){
+            struct iovec single={set->chunks[i].data, set->chunks[i].length};
+            if(WriteAllBuffers(writer->fd, &single, 1) == -1) writer->failed=1;
+        }
+    }
+
+    writer->offset+=set->length;
+    set->count=0;
+    set->length=0;
+}
+
+
+/*
+    CLOSE SNAPSHOT WRITER FUNCTION
+*/
+//appends the end of the table of paths to the temporary file and empties the buffer
+static int SpillSnapshotStrings(SnapshotWriter *writer){
+
+    if(writer->strings_fd == -1) return -1;
+
+    struct iovec iov={writer->strings.data, writer->strings.length};
+    if(WriteAllBuffers(writer->strings_fd, &iov, 1) == -1) return -1;
+    writer->strings_written+=writer->strings.length;
+    writer->strings.length=0;
+
+    return 0;
+}
+
+//copies the table of paths after the records: the part in the temporary file is read back a chunk at a time (with the
+//buffer of the table) and passed through the chunks, so it is part of the hash of the snapshot
+static int CopySnapshotStrings(SnapshotWriter *writer){
+
+    if(writer->strings_fd == -1) return -1;
+    if(writer->strings_written == 0) return WriteSnapshotData(writer, writer->strings.data, writer->strings.length);
+    if(SpillSnapshotStrings(writer) == -1) return -1;
+
+    char *buffer=writer->strings.data;
+    size_t capacity=writer->strings.capacity;
+    for(uint64_t offset=0; offset < writer->strings_written;){
+        size_t piece=writer->strings_written - offset < capacity ? writer->strings_written - offset : capacity;
+        ssize_t count=pread(writer->strings_fd, buffer, piece, offset);
+        if(count == -1 && errno == EINTR) continue;
+        if(count <= 0) return -1;
+        if(WriteSnapshotData(writer, buffer, count) == -1) return -1;
+        offset+=count;
+    }
+
+    return 0;
+}
+
+int CloseSnapshotWriter(SnapshotWriter *writer){
+
+    //the records still waiting for their content hashes are written before the end of the snapshot
+    if(writer->hashes != NULL){
+        if(DrainHashPool(writer, 1) == -1) writer->failed=1;
+        StopHashPool(writer->hashes);
+        writer->hashes=NULL;
+    }
+
+    //binary format: the table of paths and the filters follow the records
+    SnapshotFileHeader header;
+    if(writer->binary){
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BINARY_SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version=BINARY_SNAPSHOT_VERSION;
+        header.restart_interval=PATH_RESTART_INTERVAL;
+        header.record_count=writer->record_count;
+        header.records_offset=sizeof(header);
+        header.strings_offset=header.records_offset + writer->record_count*sizeof(SnapshotFileRecord);
+        header.strings_length=writer->strings_written + writer->strings.length;
+        header.filters_offset=header.strings_offset + header.strings_length;
+        header.filters_length=writer->filters_length;
+
+        if(CopySnapshotStrings(writer) == -1 || WriteSnapshotData(writer, writer->filters, writer->filters_length) == -1) writer->failed=1;
+        if(writer->strings_fd != -1) close(writer->strings_fd);
+    }
+
+    FlushSnapshotWriter(writer);
+    WaitSnapshotWrite(writer);
+
+    //the header is written last, so an incomplete binary snapshot is not valid
+    if(writer->binary && !writer->failed && pwrite(writer->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) writer->failed=1;
+    free(writer->strings.data);
+    free(writer->previous_path.data);
+
+    for(int i=0; i < 2; i++){
+        for(size_t j=0; j < writer->sets[i].capacity; j++) free(writer->sets[i].chunks[j].data);
+        free(writer->sets[i].chunks);
+        free(writer->sets[i].iov);
+    }
+    if(writer->ring != NULL){
+        CloseStatxRing(writer->ring);
+        free(writer->ring);
+    }
+
+    //the no. of records and the hash stay in the writer (for the manifest)
+    if(writer->tree != NULL) FinishMerkleTree(writer->tree);
+    int failed=writer->failed;
+    uint64_t record_count=writer->record_count, hash=writer->hash;
+    memset(writer, 0, sizeof(*writer));
+    writer->fd=-1;
+    writer->record_count=record_count;
+    writer->hash=hash;
+
+    return failed ? -1 : 0;
+}
+
+
+/*
+    WRITE BINARY RECORD FUNCTION
+*/
+int WriteBinaryRecord(SnapshotWriter *writer, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash){
+
+    //the bytes shared with the previous path are not stored again (except for the restarts)
+    size_t shared=0;
+    if(writer->record_count % PATH_RESTART_INTERVAL != 0){
+        size_t limit=path_length < writer->previous_path.length ? path_length : writer->previous_path.length;
+        while(shared < limit && path[shared] == writer->previous_path.data[shared]) shared++;
+    }
+
+    if(ReserveRecordBuffer(&writer->strings, path_length - shared + 20) == -1 || ReserveRecordBuffer(&writer->previous_path, path_length + 1) == -1) return -1;
+
+    SnapshotFileRecord record;
+    memset(&record, 0, sizeof(record));
+    record.dev=st->st_dev;
+    record.ino=st->st_ino;
+    record.size=st->st_size;
+    record.mtime_sec=st->st_mtim.tv_sec;
+    record.mtime_nsec=st->st_mtim.tv_nsec;
+    record.nlink=st->st_nlink;
+    record.mode=st->st_mode;
+    record.path_offset=writer->strings_written + writer->strings.length;
+    if(content_hash != NULL){
+        record.content_hash=*content_hash;
+        record.flags|=RECORD_HAS_CONTENT_HASH;
+    }
+
+    AppendVarint(&writer->strings, shared);
+    AppendVarint(&writer->strings, path_length - shared);
+    memcpy(writer->strings.data + writer->strings.length, path + shared, path_length - shared);
+    writer->strings.length+=path_length - shared;
+
+    memcpy(writer->previous_path.data + shared, path + shared, path_length - shared);
+    writer->previous_path.length=path_length;
+
+    if(WriteSnapshotData(writer, (const char *)&record, sizeof(record)) == -1) return -1;
+    writer->record_count++;
+
+    //the table of paths is moved to the temporary file a chunk at a time (it is copied after the records at the end)
+    if(writer->strings.length >= writer->chunk_size && SpillSnapshotStrings(writer) == -1) return -1;
+
+    return 0;
+}
+
+
+/*
+    APPEND VARINT FUNCTION
+*/
+void AppendVarint(RecordBuffer *buffer, uint64_t value){
+
+    unsigned char *out=(unsigned char *)buffer->data + buffer->length;
+
+    while(value >= 0x80){
+        *out++=(unsigned char)(value | 0x80);
+        value>>=7;
+    }
+    *out++=(unsigned char)value;
+
+    buffer->length=(char *)out - buffer->data;
+}
+
+
+/*
+    READ VARINT FUNCTION
+*/
+const unsigned char *ReadVarint(const unsigned char *position, const unsigned char *end, uint64_t *value){
+
+    *value=0;
+    for(int shift=0; position < end && shift < 64; shift+=7){
+        unsigned char byte=*position++;
+        *value|=(uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return position;
+    }
+
+    return NULL;
+}
+
+
+/*
+    IS BINARY SNAPSHOT FUNCTION
+*/
+int IsBinarySnapshot(const char *file_name){
+
+    int fd=open(file_name, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return -1;
+
+    char magic[8];
+    int binary=read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(magic, BINARY_SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+
+    return binary;
+}
+
+
+/*
+    MAP SNAPSHOT FUNCTION
+*/
+int MapSnapshot(const char *file_name, MappedSnapshot *snapshot){
+
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    int fd=open(file_name, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return -1;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SnapshotFileHeader)){
+        close(fd);
+        return -1;
+    }
+    snapshot->map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(snapshot->map == MAP_FAILED){
+        snapshot->map=NULL;
+        return -1;
+    }
+    snapshot->map_size=st.st_size;
+
+    //checking that all the sections are inside the file
+    const SnapshotFileHeader *header=(const SnapshotFileHeader *)snapshot->map;
+    size_t size=snapshot->map_size;
+    size_t record_size=header->version == 1 ? sizeof(SnapshotFileRecordV1) : header->version == 2 ? sizeof(SnapshotFileRecordV2) :
+                       header->version == BINARY_SNAPSHOT_VERSION ? sizeof(SnapshotFileRecord) : 0;
+    if(memcmp(header->magic, BINARY_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || record_size == 0 || header->restart_interval == 0 ||
+       header->records_offset != sizeof(SnapshotFileHeader) || header->record_count > (size - header->records_offset)/record_size ||
+       header->strings_offset != header->records_offset + header->record_count*record_size ||
+       header->strings_length > size - header->strings_offset || header->filters_offset > size || header->filters_length > size - header->filters_offset){
+        UnmapSnapshot(snapshot);
+        return -1;
+    }
+
+    snapshot->header=header;
+    snapshot->records=snapshot->map + header->records_offset;
+    snapshot->record_size=record_size;
+    snapshot->strings=(const unsigned char *)snapshot->map + header->strings_offset;
+
+    return 0;
+}
+
+
+/*
+    UNMAP SNAPSHOT FUNCTION
+*/
+void UnmapSnapshot(MappedSnapshot *snapshot){
+
+    if(snapshot->map != NULL) munmap(snapshot->map, snapshot->map_size);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+
+/*
+    READ SNAPSHOT RECORD FUNCTION
+*/
+void ReadSnapshotRecord(const MappedSnapshot *snapshot, uint64_t index, SnapshotFileRecord *record){
+
+    const char *data=snapshot->records + index*snapshot->record_size;
+
+    if(snapshot->record_size == sizeof(SnapshotFileRecord)){
+        memcpy(record, data, sizeof(*record));
+        return;
+    }
+
+    //version 1 has no device, versions 1 and 2 have no content hash
+    SnapshotFileRecordV2 old;
+    if(snapshot->record_size == sizeof(SnapshotFileRecordV1)){
+        SnapshotFileRecordV1 first;
+        memcpy(&first, data, sizeof(first));
+        old=(SnapshotFileRecordV2){0, first.ino, first.size, first.mtime_sec, first.nlink, first.path_offset, first.mode, first.mtime_nsec};
+    }
+    else memcpy(&old, data, sizeof(old));
+
+    memset(record, 0, sizeof(*record));
+    record->dev=old.dev;
+    record->ino=old.ino;
+    record->size=old.size;
+    record->mtime_sec=old.mtime_sec;
+    record->nlink=old.nlink;
+    record->path_offset=old.path_offset;
+    record->mode=old.mode;
+    record->mtime_nsec=old.mtime_nsec;
+}
+
+
+/*
+    DECODE SNAPSHOT PATH FUNCTION
+*/
+int DecodeSnapshotPath(const MappedSnapshot *snapshot, uint64_t index, uint64_t previous_index, PathBuffer *path){
+
+    const SnapshotFileHeader *header=snapshot->header;
+    if(index >= header->record_count) return -1;
+
+    //continuing from the previous path or starting again from the closest restart
+    uint64_t first=index;
+    if(!(index > 0 && previous_index == index - 1)){
+        first=index - index % header->restart_interval;
+        path->length=0;
+    }
+
+    const unsigned char *end=snapshot->strings + header->strings_length;
+    for(uint64_t i=first; i <= index; i++){
+        SnapshotFileRecord record;
+        ReadSnapshotRecord(snapshot, i, &record);
+        if(record.path_offset >= header->strings_length) return -1;
+
+        uint64_t shared, suffix_length;
+        const unsigned char *position=ReadVarint(snapshot->strings + record.path_offset, end, &shared);
+        if(position != NULL) position=ReadVarint(position, end, &suffix_length);
+        if(position == NULL || shared > path->length || suffix_length > (uint64_t)(end - position)) return -1;
+
+        if(shared + suffix_length + 1 > path->capacity){
+            size_t new_capacity=path->capacity ? path->capacity : PATH_MAX;
+            while(shared + suffix_length + 1 > new_capacity) new_capacity*=2;
+            char *new_data=realloc(path->data, new_capacity);
+            if(new_data == NULL) return -1;
+            path->data=new_data;
+            path->capacity=new_capacity;
+        }
+
+        memcpy(path->data + shared, position, suffix_length);
+        path->length=shared + suffix_length;
+        path->data[path->length]='\0';
+    }
+
+    return 0;
+}
+
+
+/*
+    CONVERT SNAPSHOT FUNCTION
+*/
+int ConvertSnapshot(const char *input_file_name, const char *output_file_name){
+
+    SnapshotCursor cursor;
+    if(OpenSnapshotCursor(&cursor, input_file_name) == -1){
+        fprintf(stderr, "*convert_snapshot* error: Failed to open the snapshot file  \"%s\"\n", input_file_name);
+        return -1;
+    }
+
+    int output_fd=open(output_file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(output_fd == -1){
+        fprintf(stderr, "*convert_snapshot* error: Failed to create the output file  \"%s\"\n", output_file_name);
+        CloseSnapshotCursor(&cursor);
+        return -1;
+    }
+
+    //the output has the other format (in the text format the filters are written before the records)
+    SnapshotWriter writer;
+    OpenSnapshotWriter(&writer, output_fd, output_file_name, !cursor.binary, cursor.filters_data, cursor.filters_length);
+    int result=0;
+    if(cursor.binary && cursor.filters_length > 0) result=WriteSnapshotData(&writer, cursor.filters_data, cursor.filters_length);
+
+    int status;
+    while(result == 0 && (status=NextSnapshotRecord(&cursor)) != 0){
+        if(status == -1){
+            if(cursor.binary) fprintf(stderr, "*convert_snapshot* error: Failed to decode the record %llu  \"%s\"\n", (unsigned long long)cursor.index, input_file_name);
+            else fprintf(stderr, "*convert_snapshot* error: Invalid record on line %ld  \"%s\"\n", cursor.line_no, input_file_name);
+            result=-1;
+        }
+        else result=AppendSnapshotRecord(&writer, cursor.path.data, cursor.path.length, &cursor.st, cursor.has_content_hash ? &cursor.content_hash : NULL);
+    }
+
+    if(CloseSnapshotWriter(&writer) == -1) result=-1;
+    close(output_fd);
+    CloseSnapshotCursor(&cursor);
+
+    return result;
+}
+
+
+/*
+    COMPARE PATHS FUNCTION
+*/
+int ComparePaths(const char *a, size_t a_length, const char *b, size_t b_length){
+
+    size_t length=a_length < b_length ? a_length : b_length;
+
+    for(size_t i=0; i < length; i++){
+        if(a[i] == b[i]) continue;
+        int x=a[i] == '/' ? 0 : (unsigned char)a[i];
+        int y=b[i] == '/' ? 0 : (unsigned char)b[i];
+        return x - y;
+    }
+
+    return a_length < b_length ? -1 : a_length > b_length;
+}
+
+
+/*
+    OPEN SNAPSHOT CURSOR FUNCTION
+*/
+int OpenSnapshotCursor(SnapshotCursor *cursor, const char *file_name){
+
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->sorted=1;
+
+    cursor->binary=IsBinarySnapshot(file_name);
+    if(cursor->binary == -1) return -1;
+
+    if(cursor->binary){
+        if(MapSnapshot(file_name, &cursor->mapped) == -1) return -1;
+        cursor->filters_data=cursor->mapped.map + cursor->mapped.header->filters_offset;
+        cursor->filters_length=cursor->mapped.header->filters_length;
+        return 0;
+    }
+
+    cursor->file=fopen(file_name, "r");
+    if(cursor->file == NULL) return -1;
+
+    //the filters are before the first record, followed by an empty line
+    ssize_t line_length;
+    while((line_length=getline(&cursor->line, &cursor->line_capacity, cursor->file)) != -1){
+        cursor->line_no++;
+        if(strncmp(cursor->line, "Filter: ", 8) != 0 && !(cursor->filters.length > 0 && strcmp(cursor->line, "\n") == 0)){
+            cursor->pending=1;
+            break;
+        }
+        if(ReserveRecordBuffer(&cursor->filters, line_length) == -1){
+            CloseSnapshotCursor(cursor);
+            return -1;
+        }
+        memcpy(cursor->filters.data + cursor->filters.length, cursor->line, line_length);
+        cursor->filters.length+=line_length;
+    }
+    cursor->filters_data=cursor->filters.data;
+    cursor->filters_length=cursor->filters.length;
+
+    return 0;
+}
+
+
+/*
+    NEXT SNAPSHOT RECORD FUNCTION
+*/
+int NextSnapshotRecord(SnapshotCursor *cursor){
+
+    //keeping the previous path for checking the order of the records
+    if(cursor->path.length > 0){
+        if(cursor->previous_path.capacity < cursor->path.length + 1){
+            char *new_data=realloc(cursor->previous_path.data, cursor->path.capacity);
+            if(new_data == NULL) return -1;
+            cursor->previous_path.data=new_data;
+            cursor->previous_path.capacity=cursor->path.capacity;
+        }
+        memcpy(cursor->previous_path.data, cursor->path.data, cursor->path.length + 1);
+        cursor->previous_path.length=cursor->path.length;
+    }
+    memset(&cursor->st, 0, sizeof(cursor->st));
+    cursor->content_hash=0;
+    cursor->has_content_hash=0;
+
+    if(cursor->binary){
+        if(cursor->index >= cursor->mapped.header->record_count) return 0;
+
+        SnapshotFileRecord record_copy;
+        ReadSnapshotRecord(&cursor->mapped, cursor->index, &record_copy);
+        const SnapshotFileRecord *record=&record_copy;
+        //the path is decoded from the previous one (or from the closest restart after a seek)
+        if(DecodeSnapshotPath(&cursor->mapped, cursor->index, cursor->path.length > 0 ? cursor->index - 1 : cursor->index, &cursor->path) == -1) return -1;
+        cursor->st.st_dev=record->dev;
+        cursor->st.st_ino=record->ino;
+        cursor->st.st_size=record->size;
+        cursor->st.st_mtim.tv_sec=record->mtime_sec;
+        cursor->st.st_mtim.tv_nsec=record->mtime_nsec;
+        cursor->st.st_mode=record->mode;
+        cursor->st.st_nlink=record->nlink;
+        cursor->content_hash=record->content_hash;
+        cursor->has_content_hash=(record->flags & RECORD_HAS_CONTENT_HASH) != 0;
+        cursor->index++;
+
+        //the pages of the records and of the paths already read are released, so a large snapshot read from the
+        //beginning to the end keeps only the last pages in memory
+        if(cursor->index % CURSOR_RELEASE_INTERVAL == 0){
+            uintptr_t page_mask=~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+            char *map=cursor->mapped.map;
+            char *records_end=(char *)((uintptr_t)(cursor->mapped.records + (cursor->index - 1)*cursor->mapped.record_size) & page_mask);
+            char *strings_start=(char *)(((uintptr_t)cursor->mapped.strings + ~page_mask) & page_mask);
+            char *strings_end=(char *)((uintptr_t)(cursor->mapped.strings + record->path_offset) & page_mask);
+            if(records_end > map) madvise(map, records_end - map, MADV_DONTNEED);
+            if(strings_end > strings_start) madvise(strings_start, strings_end - strings_start, MADV_DONTNEED);
+        }
+    }
+    else{
+        //a record has 5 lines: "Path: ", "Size: ", "Access Rights: ", "Hard Links: " and an empty line
+        //(and "Content Hash: " before the empty line for the files hashed with "--content-hash")
+        for(int field=0; field < 5; field++){
+            ssize_t line_length;
+            if(cursor->pending){
+                line_length=strlen(cursor->line);
+                cursor->pending=0;
+            }
+            else{
+                line_length=getline(&cursor->line, &cursor->line_capacity, cursor->file);
+                if(line_length == -1) return field == 0 ? 0 : -1;
+                cursor->line_no++;
+            }
+            char *line=cursor->line;
+            if(line_length > 0 && line[line_length-1] == '\n') line[--line_length]='\0';
+
+            long long number;
+            switch(field){
+                case 0:
+                    if(strncmp(line, "Path: ", 6) != 0) return -1;
+                    if(cursor->path.capacity < (size_t)line_length - 5){
+                        char *new_data=realloc(cursor->path.data, line_length - 5);
+                        if(new_data == NULL) return -1;
+                        cursor->path.data=new_data;
+                        cursor->path.capacity=line_length - 5;
+                    }
+                    memcpy(cursor->path.data, line + 6, line_length - 5);
+                    cursor->path.length=line_length - 6;
+                    break;
+                case 1:
+                    if(sscanf(line, "Size: %lld bytes", &number) != 1) return -1;
+                    cursor->st.st_size=number;
+                    break;
+                case 2:
+                    if(line_length != 26 || strncmp(line, "Access Rights: ", 15) != 0) return -1;
+                    for(int bit=0, position=15; bit < 9; bit++, position++){
+                        if(bit == 3 || bit == 6) position++; //the groups of rights are separated by spaces
+                        if(line[position] != '-') cursor->st.st_mode|=0400 >> bit;
+                    }
+                    break;
+                case 3:
+                    if(sscanf(line, "Hard Links: %lld", &number) != 1) return -1;
+                    cursor->st.st_nlink=number;
+                    break;
+                default:
+                    if(!cursor->has_content_hash && strncmp(line, "Content Hash: ", 14) == 0){
+                        unsigned long long hash;
+                        if(line_length != 30 || sscanf(line + 14, "%16llx", &hash) != 1) return -1;
+                        cursor->content_hash=hash;
+                        cursor->has_content_hash=1;
+                        field--; //the empty line follows
+                        break;
+                    }
+                    if(line_length != 0) return -1;
+            }
+        }
+    }
+
+    if(cursor->previous_path.length > 0 && ComparePaths(cursor->previous_path.data, cursor->previous_path.length, cursor->path.data, cursor->path.length) >= 0) cursor->sorted=0;
+
+    return 1;
+}
+
+
+/*
+    SEEK SNAPSHOT CURSOR FUNCTION
+*/
+int SeekSnapshotCursor(SnapshotCursor *cursor, uint64_t position){
+
+    if(cursor->binary){
+        if(position > cursor->mapped.header->record_count) return -1;
+        cursor->index=position;
+    }
+    else{
+        if(fseeko(cursor->file, (off_t)position, SEEK_SET) == -1) return -1;
+        cursor->pending=0;
+    }
+    cursor->path.length=0;
+    cursor->previous_path.length=0;
+    cursor->sorted=1;
+
+    return 0;
+}
+
+
+/*
+    CLOSE SNAPSHOT CURSOR FUNCTION
+*/
+void CloseSnapshotCursor(SnapshotCursor *cursor){
+
+    if(cursor->file != NULL) fclose(cursor->file);
+    UnmapSnapshot(&cursor->mapped);
+    free(cursor->line);
+    free(cursor->filters.data);
+    free(cursor->path.data);
+    free(cursor->previous_path.data);
+    memset(cursor, 0, sizeof(*cursor));
+}
+
+
+/*
+    IS SORTED SNAPSHOT FUNCTION
+*/
+int IsSortedSnapshot(const char *file_name){
+
+    SnapshotCursor cursor;
+    if(OpenSnapshotCursor(&cursor, file_name) == -1) return -1;
+
+    int status;
+    while((status=NextSnapshotRecord(&cursor)) == 1 && cursor.sorted);
+    int sorted=status == -1 ? -1 : cursor.sorted;
+    CloseSnapshotCursor(&cursor);
+
+    return sorted;
+}
+
+
+/*
+    LOAD SNAPSHOT FUNCTION
+*/
+int LoadSnapshot(LoadedSnapshot *snapshot, const char *file_name){
+
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    SnapshotCursor cursor;
+    if(OpenSnapshotCursor(&cursor, file_name) == -1) return -1;
+
+    int status=0;
+    if(ReserveRecordBuffer(&snapshot->filters, cursor.filters_length + 1) == 0){
+        if(cursor.filters_length > 0) memcpy(snapshot->filters.data, cursor.filters_data, cursor.filters_length);
+        snapshot->filters.length=cursor.filters_length;
+    }
+    else status=-1;
+
+    while(status != -1 && (status=NextSnapshotRecord(&cursor)) == 1){
+        if(snapshot->count == snapshot->capacity){
+            size_t new_capacity=snapshot->capacity ? snapshot->capacity*2 : 1024;
+            DiffEntry *new_entries=realloc(snapshot->entries, new_capacity*sizeof(DiffEntry));
+            if(new_entries == NULL){
+                status=-1;
+                break;
+            }
+            snapshot->entries=new_entries;
+            snapshot->capacity=new_capacity;
+        }
+        if(ReserveRecordBuffer(&snapshot->paths, cursor.path.length + 1) == -1){
+            status=-1;
+            break;
+        }
+
+        DiffEntry *entry=&snapshot->entries[snapshot->count++];
+        entry->path_offset=snapshot->paths.length;
+        entry->path_length=cursor.path.length;
+        entry->st=cursor.st;
+        entry->content_hash=cursor.content_hash;
+        entry->has_content_hash=cursor.has_content_hash;
+        entry->matched=0;
+        memcpy(snapshot->paths.data + snapshot->paths.length, cursor.path.data, cursor.path.length + 1);
+        snapshot->paths.length+=cursor.path.length + 1;
+
+        //only the first entry of an inode is indexed (the other ones are its hard links)
+        void **value;
+        if(MarkVisitedDirectory(&snapshot->inodes, cursor.st.st_dev, cursor.st.st_ino, &value) == 1) *value=(void *)(uintptr_t)snapshot->count;
+    }
+    CloseSnapshotCursor(&cursor);
+
+    if(status == -1){
+        FreeLoadedSnapshot(snapshot);
+        return -1;
+    }
+
+    //indexing the entries by the hash of their path
+    snapshot->index_capacity=16;
+    while(snapshot->index_capacity < snapshot->count*2) snapshot->index_capacity*=2;
+    snapshot->path_index=calloc(snapshot->index_capacity, sizeof(size_t));
+    if(snapshot->path_index == NULL){
+        FreeLoadedSnapshot(snapshot);
+        return -1;
+    }
+    for(size_t i=0; i < snapshot->count; i++){
+        size_t slot=HashBytes(snapshot->paths.data + snapshot->entries[i].path_offset, snapshot->entries[i].path_length) & (snapshot->index_capacity - 1);
+        while(snapshot->path_index[slot] != 0) slot=(slot + 1) & (snapshot->index_capacity - 1);
+        snapshot->path_index[slot]=i + 1;
+    }
+
+    return 0;
+}
+
+
+/*
+    LOOKUP SNAPSHOT PATH FUNCTION
+*/
+long LookupSnapshotPath(const LoadedSnapshot *snapshot, const char *path, size_t path_length){
+
+    size_t slot=HashBytes(path, path_length) & (snapshot->index_capacity - 1);
+
+    for(; snapshot->path_index[slot] != 0; slot=(slot + 1) & (snapshot->index_capacity - 1)){
+        const DiffEntry *entry=&snapshot->entries[snapshot->path_index[slot] - 1];
+        if(entry->path_length == path_length && memcmp(snapshot->paths.data + entry->path_offset, path, path_length) == 0) return (long)(snapshot->path_index[slot] - 1);
+    }
+
+    return -1;
+}
+
+
+/*
+    FREE LOADED SNAPSHOT FUNCTION
+*/
+void FreeLoadedSnapshot(LoadedSnapshot *snapshot){
+
+    free(snapshot->entries);
+    free(snapshot->paths.data);
+    free(snapshot->path_index);
+    free(snapshot->filters.data);
+    FreeVisitedSet(&snapshot->inodes);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+
+/*
+    DESCRIBE CHANGES FUNCTION
+*/
+int DescribeChanges(char *buffer, size_t buffer_size, const DiffEntry *prev_entry, const DiffEntry *current_entry){
+
+    const struct stat *prev=&prev_entry->st, *current=&current_entry->st;
+    int changes=0;
+    size_t length=0;
+    buffer[0]='\0';
+
+    //the type is known only in the binary format (it is 0 in the text format)
+    if((prev->st_mode & S_IFMT) && (current->st_mode & S_IFMT) && (prev->st_mode & S_IFMT) != (current->st_mode & S_IFMT)){
+        length+=snprintf(buffer + length, buffer_size - length, "%stype changed", changes++ ? ", " : "");
+    }
+    if(prev->st_size != current->st_size && length < buffer_size){
+        length+=snprintf(buffer + length, buffer_size - length, "%ssize %lld => %lld", changes++ ? ", " : "", (long long)prev->st_size, (long long)current->st_size);
+    }
+    if((prev->st_mode & 0777) != (current->st_mode & 0777) && length < buffer_size){
+        length+=snprintf(buffer + length, buffer_size - length, "%saccess rights %.11s => %.11s", changes++ ? ", " : "", permission_strings[prev->st_mode & 0777], permission_strings[current->st_mode & 0777]);
+    }
+    if(prev->st_nlink != current->st_nlink && length < buffer_size){
+        length+=snprintf(buffer + length, buffer_size - length, "%shard links %lu => %lu", changes++ ? ", " : "", (unsigned long)prev->st_nlink, (unsigned long)current->st_nlink);
+    }
+    if(prev_entry->has_content_hash && current_entry->has_content_hash && prev_entry->content_hash != current_entry->content_hash && length < buffer_size){
+        length+=snprintf(buffer + length, buffer_size - length, "%scontent changed", changes++ ? ", " : "");
+    }
+
+    return changes;
+}
+
+
+/*
+    DIFF SNAPSHOTS FUNCTION
+*/
+int DiffSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name){
+
+    //identical files have no differences to print
+    off_t first_difference;
+    if(CompareSnapshotBytes(prev_snapshot_file_name, current_snapshot_file_name, &first_difference) == 0) return 0;
+
+    //the shards of sorted snapshots are compared by several threads (the renamed entries are not found)
+    if(compare_threads > 1){
+        int IsDifferent=ParallelCompareSnapshots(prev_snapshot_file_name, current_snapshot_file_name, 1);
+        if(IsDifferent != -2) return IsDifferent;
+    }
+
+    //with a memory budget the snapshots are not loaded in hash tables (the renamed entries are not found): sorted
+    //snapshots are merged directly, only the ones created by an older version go through the external sort
+    if(compare_memory > 0){
+        if(IsSortedSnapshot(prev_snapshot_file_name) == 1 && IsSortedSnapshot(current_snapshot_file_name) == 1) return StreamCompareSnapshots(prev_snapshot_file_name, current_snapshot_file_name, 1);
+        return SortMergeSnapshots(prev_snapshot_file_name, current_snapshot_file_name, compare_memory, 1);
+    }
+
+    LoadedSnapshot prev, current;
+    if(LoadSnapshot(&prev, prev_snapshot_file_name) == -1){
+        fprintf(stderr, "*diff_snapshots* error: Failed to load the previous snapshot file for  \"%s\"\n", monitored_directory);
+        return -1;
+    }
+    if(LoadSnapshot(&current, current_snapshot_file_name) == -1){
+        fprintf(stderr, "*diff_snapshots* error: Failed to load the current snapshot file for  \"%s\"\n", monitored_directory);
+        FreeLoadedSnapshot(&prev);
+        return -1;
+    }
+
+    long added=0, removed=0, modified=0, renamed=0;
+    char changes[256];
+
+    //the last directory reported as renamed (the entries moved with it are not printed, unless they changed)
+    const char *moved_from=NULL, *moved_to=NULL;
+    size_t moved_from_length=0, moved_to_length=0;
+
+    //the entries of the previous snapshot: modified (same path), renamed (same inode at a new path) or removed
+    for(size_t i=0; i < prev.count; i++){
+        DiffEntry *entry=&prev.entries[i];
+        const char *path=prev.paths.data + entry->path_offset;
+
+        long match=LookupSnapshotPath(&current, path, entry->path_length);
+        if(match != -1){
+            current.entries[match].matched=1;
+            if(DescribeChanges(changes, sizeof(changes), entry, &current.entries[match]) > 0){
+                fprintf(stdout, "(Diff) Modified  \"%s\"  (%s)\n", path, changes);
+                modified++;
+            }
+            continue;
+        }
+
+        //the inode is at a path that is new in the current snapshot and not matched yet (with the same type, mtime and
+        //content, so a new file reusing the inode of a deleted one is not a rename)
+        void **value;
+        if(entry->st.st_ino != 0 && MarkVisitedDirectory(&current.inodes, entry->st.st_dev, entry->st.st_ino, &value) == 0 && *value != NULL){
+            DiffEntry *target=&current.entries[(uintptr_t)*value - 1];
+            const char *target_path=current.paths.data + target->path_offset;
+
+            if(!target->matched && (target->st.st_mode & S_IFMT) == (entry->st.st_mode & S_IFMT) &&
+               target->st.st_mtim.tv_sec == entry->st.st_mtim.tv_sec && target->st.st_mtim.tv_nsec == entry->st.st_mtim.tv_nsec &&
+               !(target->has_content_hash && entry->has_content_hash && target->content_hash != entry->content_hash) &&
+               LookupSnapshotPath(&prev, target_path, target->path_length) == -1){
+                target->matched=1;
+
+                int implied=moved_from != NULL && entry->path_length > moved_from_length && path[moved_from_length] == '/' && 
+                            strncmp(path, moved_from, moved_from_length) == 0 && target->path_length > moved_to_length &&
+                            strncmp(target_path, moved_to, moved_to_length) == 0 && strcmp(target_path + moved_to_length, path + moved_from_length) == 0;
+                int changed=DescribeChanges(changes, sizeof(changes), entry, target) > 0;
+
+                //only the renames printed are counted (not the entries moved with a renamed directory)
+                if(changed) fprintf(stdout, "(Diff) Renamed   \"%s\" => \"%s\"  (%s)\n", path, target_path, changes);
+                else if(!implied) fprintf(stdout, "(Diff) Renamed   \"%s\" => \"%s\"\n", path, target_path);
+                if(changed || !implied) renamed++;
+
+                if(!implied && S_ISDIR(entry->st.st_mode)){
+                    moved_from=path;
+                    moved_from_length=entry->path_length;
+                    moved_to=target_path;
+                    moved_to_length=target->path_length;
+                }
+                continue;
+            }
+        }
+
+        fprintf(stdout, "(Diff) Removed   \"%s\"\n", path);
+        removed++;
+    }
+
+    //the entries of the current snapshot that were not matched are new
+    for(size_t i=0; i < current.count; i++){
+        if(current.entries[i].matched) continue;
+        fprintf(stdout, "(Diff) Added     \"%s\"\n", current.paths.data + current.entries[i].path_offset);
+        added++;
+    }
+
+    int IsDifferent=added > 0 || removed > 0 || modified > 0 || renamed > 0 || prev.filters.length != current.filters.length ||
+                    (prev.filters.length > 0 && memcmp(prev.filters.data, current.filters.data, prev.filters.length) != 0);
+
+    if(added > 0 || removed > 0 || modified > 0 || renamed > 0) fprintf(stdout, "(Comparing) %ld entries added, %ld removed, %ld modified and %ld renamed since the previous snapshot for  \"%s\"\n", added, removed, modified, renamed, monitored_directory);
+
+    FreeLoadedSnapshot(&prev);
+    FreeLoadedSnapshot(&current);
+
+    return IsDifferent;
+}
+
+
+/*
+    INIT MERKLE TREE FUNCTION
+*/
+void InitMerkleTree(MerkleTree *tree, uint64_t filters_hash){
+
+    memset(tree, 0, sizeof(*tree));
+
+    tree->nodes=malloc(1024*sizeof(MerkleNode));
+    tree->frames=malloc(64*sizeof(MerkleFrame));
+    if(tree->nodes == NULL || tree->frames == NULL){
+        tree->failed=1;
+        return;
+    }
+    tree->capacity=1024;
+    tree->frame_capacity=64;
+
+    //the root (its path is known from the first record)
+    memset(&tree->nodes[0], 0, sizeof(MerkleNode));
+    tree->nodes[0].record_hash=filters_hash;
+    tree->nodes[0].hash=filters_hash;
+    tree->nodes[0].files_hash=HashBytes(NULL, 0);
+    tree->count=1;
+    tree->frames[0].node=0;
+    tree->frames[0].path_length=(size_t)-1;
+    tree->frames[0].first_record=0;
+    tree->depth=1;
+}
+
+
+/*
+    FINISH MERKLE FRAME FUNCTION (the directory from the top of the stack is complete => its hash is added to its parent)
+*/
+static void FinishMerkleFrame(MerkleTree *tree){
+
+    MerkleNode *node=&tree->nodes[tree->frames[tree->depth-1].node];
+    node->subtree_size=tree->count - tree->frames[tree->depth-1].node;
+    node->entry_count=tree->record_count - tree->frames[tree->depth-1].first_record;
+    node->hash=UpdateHash(node->hash, &node->files_hash, sizeof(node->files_hash));
+    tree->depth--;
+
+    if(tree->depth > 0){
+        MerkleNode *parent=&tree->nodes[tree->frames[tree->depth-1].node];
+        parent->hash=UpdateHash(parent->hash, &node->hash, sizeof(node->hash));
+        tree->dir_path.length=tree->frames[tree->depth-1].path_length;
+    }
+}
+
+
+/*
+    ADD MERKLE RECORD FUNCTION
+*/
+void AddMerkleRecord(MerkleTree *tree, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash){
+
+    if(tree->failed || tree->map != NULL) return;
+
+    const char *name=memrchr(path, '/', path_length);
+    name=name == NULL ? path : name + 1;
+    size_t name_length=path + path_length - name;
+
+    //the first record is in the monitored directory => the path of the root
+    if(tree->frames[0].path_length == (size_t)-1){
+        tree->frames[0].path_length=path_length - name_length - (name > path);
+        if(ReserveRecordBuffer(&tree->dir_path, tree->frames[0].path_length + 1) == -1){
+            tree->failed=1;
+            return;
+        }
+        memcpy(tree->dir_path.data, path, tree->frames[0].path_length);
+        tree->dir_path.length=tree->frames[0].path_length;
+    }
+
+    //finishing the directories that do not contain the record (the root contains all of them)
+    while(tree->depth > 1){
+        size_t length=tree->frames[tree->depth-1].path_length;
+        if(path_length > length && path[length] == '/' && memcmp(path, tree->dir_path.data, length) == 0) break;
+        FinishMerkleFrame(tree);
+    }
+
+    //the hash of the record has the fields compared by compare_snapshots
+    int64_t size=st->st_size;
+    uint32_t rights=st->st_mode & 0777;
+    uint64_t links=st->st_nlink;
+    uint64_t hash=HashBytes(name, name_length);
+    hash=UpdateHash(hash, &size, sizeof(size));
+    hash=UpdateHash(hash, &rights, sizeof(rights));
+    hash=UpdateHash(hash, &links, sizeof(links));
+    if(content_hash != NULL) hash=UpdateHash(hash, content_hash, sizeof(*content_hash));
+
+    //a file has no node, its hash is added to the files hash of its directory
+    if(!S_ISDIR(st->st_mode)){
+        MerkleNode *parent=&tree->nodes[tree->frames[tree->depth-1].node];
+        parent->files_hash=UpdateHash(parent->files_hash, &hash, sizeof(hash));
+        tree->record_count++;
+        return;
+    }
+
+    //a directory stays open until a record that is not in it
+    if(tree->count == tree->capacity){
+        MerkleNode *new_nodes=realloc(tree->nodes, tree->capacity*2*sizeof(MerkleNode));
+        if(new_nodes == NULL){
+            tree->failed=1;
+            return;
+        }
+        tree->nodes=new_nodes;
+        tree->capacity*=2;
+    }
+    if(tree->depth == tree->frame_capacity){
+        MerkleFrame *new_frames=realloc(tree->frames, tree->frame_capacity*2*sizeof(MerkleFrame));
+        if(new_frames == NULL){
+            tree->failed=1;
+            return;
+        }
+        tree->frames=new_frames;
+        tree->frame_capacity*=2;
+    }
+    if(ReserveRecordBuffer(&tree->names, name_length) == -1 || ReserveRecordBuffer(&tree->dir_path, path_length + 1) == -1){
+        tree->failed=1;
+        return;
+    }
+
+    size_t index=tree->count++;
+    MerkleNode *node=&tree->nodes[index];
+    node->hash=hash;
+    node->record_hash=hash;
+    node->files_hash=HashBytes(NULL, 0);
+    node->subtree_size=1;
+    node->entry_count=1;
+    node->name_offset=tree->names.length;
+    node->name_length=(uint32_t)name_length;
+    node->reserved=0;
+    memcpy(tree->names.data + tree->names.length, name, name_length);
+    tree->names.length+=name_length;
+
+    memcpy(tree->dir_path.data, path, path_length);
+    tree->dir_path.length=path_length;
+    tree->frames[tree->depth].node=index;
+    tree->frames[tree->depth].path_length=path_length;
+    tree->frames[tree->depth].first_record=tree->record_count;
+    tree->depth++;
+    tree->record_count++;
+}
+
+
+/*
+    FINISH MERKLE TREE FUNCTION
+*/
+int FinishMerkleTree(MerkleTree *tree){
+
+    if(tree->failed) return -1;
+    while(tree->depth > 0) FinishMerkleFrame(tree);
+
+    return 0;
+}
+
+
+/*
+    WRITE MERKLE TREE FUNCTION
+*/
+int WriteMerkleTree(const MerkleTree *tree, const char *output_path, const char *dir_name){
+
+    if(tree->failed) return -1;
+
+    char tree_name[PATH_MAX], temp_name[PATH_MAX];
+    snprintf(tree_name, sizeof(tree_name), "%s/%s_Snapshot.merkle", output_path, dir_name);
+    snprintf(temp_name, sizeof(temp_name), "%s/%s_Snapshot.merkle.tmp", output_path, dir_name);
+
+    int fd=open(temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(fd == -1) return -1;
+
+    MerkleFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MERKLE_TREE_MAGIC, sizeof(header.magic));
+    header.node_count=tree->count;
+    header.names_length=tree->names.length;
+    header.root_hash=tree->nodes[0].hash;
+
+    struct iovec iov[3]={{&header, sizeof(header)}, {tree->nodes, tree->count*sizeof(MerkleNode)}, {tree->names.data, tree->names.length}};
+    int result=WriteAllBuffers(fd, iov, 3);
+    if(close(fd) == -1) result=-1;
+
+    if(result == -1 || rename(temp_name, tree_name) == -1){
+        unlink(temp_name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+    LOAD MERKLE TREE FUNCTION
+*/
+int LoadMerkleTree(MerkleTree *tree, const char *output_path, const char *dir_name){
+
+    memset(tree, 0, sizeof(*tree));
+
+    char tree_name[PATH_MAX];
+    snprintf(tree_name, sizeof(tree_name), "%s/%s_Snapshot.merkle", output_path, dir_name);
+
+    int fd=open(tree_name, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return -1;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(MerkleFileHeader)){
+        close(fd);
+        return -1;
+    }
+    tree->map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(tree->map == MAP_FAILED){
+        tree->map=NULL;
+        return -1;
+    }
+    tree->map_size=st.st_size;
+
+    //checking the sizes of the sections and that every name is inside the names
+    const MerkleFileHeader *header=(const MerkleFileHeader *)tree->map;
+    size_t size=tree->map_size - sizeof(MerkleFileHeader);
+    if(memcmp(header->magic, MERKLE_TREE_MAGIC, sizeof(header->magic)) != 0 || header->node_count == 0 || header->node_count > size/sizeof(MerkleNode) ||
+       header->names_length != size - header->node_count*sizeof(MerkleNode)){
+        FreeMerkleTree(tree);
+        return -1;
+    }
+
+    tree->nodes=(MerkleNode *)(tree->map + sizeof(MerkleFileHeader));
+    tree->count=header->node_count;
+    tree->names.data=tree->map + sizeof(MerkleFileHeader) + tree->count*sizeof(MerkleNode);
+    tree->names.length=header->names_length;
+
+    for(size_t i=0; i < tree->count; i++){
+        const MerkleNode *node=&tree->nodes[i];
+        if(node->name_offset > tree->names.length || node->name_length > tree->names.length - node->name_offset ||
+           node->subtree_size == 0 || node->subtree_size > tree->count - i){
+            FreeMerkleTree(tree);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+    FREE MERKLE TREE FUNCTION
+*/
+void FreeMerkleTree(MerkleTree *tree){
+
+    if(tree->map != NULL) munmap(tree->map, tree->map_size);
+    else{
+        free(tree->nodes);
+        free(tree->names.data);
+    }
+    free(tree->frames);
+    free(tree->dir_path.data);
+    memset(tree, 0, sizeof(*tree));
+}
+
+
+/*
+    COMPARE MERKLE TREES FUNCTION
+*/
+long CompareMerkleTrees(const MerkleTree *prev, const MerkleTree *current, long *added, long *removed, long *modified, long *changed){
+
+    long visited=0;
+    if(prev->nodes[0].hash == current->nodes[0].hash) return 0;
+
+    //the pairs of directories (with the same path) whose hashes differ
+    size_t stack_capacity=64, depth=1;
+    size_t *stack=malloc(stack_capacity*2*sizeof(size_t));
+    if(stack == NULL) return -1;
+    stack[0]=stack[1]=0;
+
+    while(depth > 0){
+        depth--;
+        size_t p=stack[2*depth], c=stack[2*depth+1];
+        if(prev->nodes[p].files_hash != current->nodes[c].files_hash) (*changed)++;
+        size_t p_end=p + prev->nodes[p].subtree_size, c_end=c + current->nodes[c].subtree_size;
+        size_t i=p + 1, j=c + 1;
+
+        //the children of both directories are sorted by name => merged like two sorted lists
+        while(i < p_end || j < c_end){
+            const MerkleNode *x=i < p_end ? &prev->nodes[i] : NULL, *y=j < c_end ? &current->nodes[j] : NULL;
+            int order;
+            if(x == NULL) order=1;
+            else if(y == NULL) order=-1;
+            else{
+                order=memcmp(prev->names.data + x->name_offset, current->names.data + y->name_offset, x->name_length < y->name_length ? x->name_length : y->name_length);
+                if(order == 0) order=x->name_length < y->name_length ? -1 : x->name_length > y->name_length;
+            }
+            visited++;
+
+            if(order < 0){      //the entire subtree was removed
+                *removed+=x->entry_count;
+                i+=x->subtree_size;
+            }
+            else if(order > 0){ //the entire subtree was added
+                *added+=y->entry_count;
+                j+=y->subtree_size;
+            }
+            else{
+                if(x->hash != y->hash){
+                    if(x->record_hash != y->record_hash) (*modified)++;
+                    if(x->files_hash != y->files_hash || x->subtree_size > 1 || y->subtree_size > 1){ //the difference is inside the directory
+                        if(depth == stack_capacity){
+                            size_t *new_stack=realloc(stack, stack_capacity*4*sizeof(size_t));
+                            if(new_stack == NULL){
+                                free(stack);
+                                return -1;
+                            }
+                            stack=new_stack;
+                            stack_capacity*=2;
+                        }
+                        stack[2*depth]=i;
+                        stack[2*depth+1]=j;
+                        depth++;
+                    }
+                }
+                i+=x->subtree_size;
+                j+=y->subtree_size;
+            }
+        }
+    }
+    free(stack);
+
+    return visited;
+}
+
+
+/*
+    MARK VISITED DIRECTORY FUNCTION
+*/
+int MarkVisitedDirectory(VisitedSet *set, dev_t dev, ino_t ino, void ***value){
+
+    if(ino == 0) return -1; //the information of the directory is not known
+
+    if((set->count + 1)*2 > set->capacity){ //keeping the table at most half full
+        size_t new_capacity=set->capacity ? set->capacity*2 : 256;
+        uint64_t *new_keys=calloc(new_capacity*2, sizeof(uint64_t));
+        void **new_values=calloc(new_capacity, sizeof(void *));
+        if(new_keys == NULL || new_values == NULL){
+            free(new_keys);
+            free(new_values);
+            return -1;
+        }
+
+        for(size_t i=0; i < set->capacity; i++){
+            if(set->keys[2*i+1] == 0) continue;
+            size_t slot=HashBytes(&set->keys[2*i], 2*sizeof(uint64_t)) & (new_capacity - 1);
+            while(new_keys[2*slot+1] != 0) slot=(slot + 1) & (new_capacity - 1);
+            new_keys[2*slot]=set->keys[2*i];
+            new_keys[2*slot+1]=set->keys[2*i+1];
+            new_values[slot]=set->values[i];
+        }
+        free(set->keys);
+        free(set->values);
+        set->keys=new_keys;
+        set->values=new_values;
+        set->capacity=new_capacity;
+    }
+
+    uint64_t key[2]={(uint64_t)dev, (uint64_t)ino};
+    size_t slot=HashBytes(key, sizeof(key)) & (set->capacity - 1);
+    for(; set->keys[2*slot+1] != 0; slot=(slot + 1) & (set->capacity - 1)){
+        if(set->keys[2*slot] == key[0] && set->keys[2*slot+1] == key[1]){
+            if(value != NULL) *value=&set->values[slot];
+            return 0;
+        }
+    }
+    set->keys[2*slot]=key[0];
+    set->keys[2*slot+1]=key[1];
+    set->values[slot]=NULL;
+    set->count++;
+    if(value != NULL) *value=&set->values[slot];
+
+    return 1;
+}
+
+
+/*
+    FREE VISITED SET FUNCTION
+*/
+void FreeVisitedSet(VisitedSet *set){
+
+    free(set->keys);
+    free(set->values);
+    set->keys=NULL;
+    set->values=NULL;
+    set->capacity=set->count=0;
+}
+
+
+/*
+    LOOKUP INODE INFO FUNCTION
+*/
+InodeInfo *LookupInodeInfo(const struct stat *st){
+
+    if(st->st_nlink < 2 || S_ISDIR(st->st_mode)) return NULL;
+
+    void **value=NULL;
+    int added=MarkVisitedDirectory(&inode_cache, st->st_dev, st->st_ino, &value);
+    if(added == -1) return NULL;
+    if(added == 1) *value=calloc(1, sizeof(InodeInfo)); //NULL if the allocation fails => the link is processed again
+
+    return *value;
+}
+
+
+/*
+    FREE INODE CACHE FUNCTION
+*/
+void FreeInodeCache(VisitedSet *cache){
+
+    for(size_t i=0; i < cache->capacity; i++) free(cache->values[i]);
+    FreeVisitedSet(cache);
+}
+
+
+/*
+    PUSH SCAN FRAME FUNCTION
+*/
+int PushScanFrame(ScanFrame **frames, size_t *frame_capacity, size_t *depth, int dir_fd, const struct stat *dir_st, PathBuffer *path, size_t root_length, char *dir_buffer, StatxRing *ring){
+
+    if(*depth == *frame_capacity){
+        size_t new_capacity=*frame_capacity ? *frame_capacity*2 : 16;
+        ScanFrame *new_frames=realloc(*frames, new_capacity*sizeof(ScanFrame));
+        if(new_frames == NULL){
+            fprintf(stderr, "*read_directories* error: Failed to allocate memory for path  \"%s\"\n", path->data);
+            close(dir_fd);
+            return -1;
+        }
+        memset(new_frames + *frame_capacity, 0, (new_capacity - *frame_capacity)*sizeof(ScanFrame));
+        *frames=new_frames;
+        *frame_capacity=new_capacity;
+    }
+
+    ScanFrame *frame=&(*frames)[*depth];
+
+    //a directory not changed since the previous scan has the same listing as the one from the scan cache
+    const char *cached_record=scan_cache ? LookupScanCache(scan_cache, path->data + root_length, dir_st) : NULL;
+    int from_cache=cached_record != NULL && ReadCachedListing(cached_record, &frame->listing) == 0;
+
+    if(!from_cache && (ReadDirectoryListing(dir_fd, &frame->listing, dir_buffer, dir_buffer_size) == -1 || FilterListing(dir_fd, &frame->listing, path->data + root_length) == -1)){
+        fprintf(stderr, "*read_directories* error: Failed to read the directory  \"%s\"\n", path->data);
+        close(dir_fd);
+        return -1;
+    }
+
+    //the information of the entries is stored in the frame with io_uring (requested in batches before writing the 
+    //records) and for writing the scan cache
+    if((ring != NULL || scan_cache != NULL) && frame->listing.count > frame->stats_capacity){
+        free(frame->stats);
+        free(frame->stat_result);
+        frame->stats=malloc(frame->listing.count*sizeof(struct stat));
+        frame->stat_result=malloc(frame->listing.count*sizeof(int));
+        frame->stats_capacity=(frame->stats != NULL && frame->stat_result != NULL) ? frame->listing.count : 0;
+    }
+    int has_stats=frame->listing.count <= frame->stats_capacity;
+
+    frame->batched=0;
+    frame->cached=from_cache && has_stats;
+    if(frame->cached) ReadCachedStats(cached_record, frame->stats);
+
+    //fstatat is used for this directory if the memory can't be allocated or the ring fails
+    else if(ring != NULL && frame->listing.count > 0 && has_stats) frame->batched=StatListingWithRing(ring, dir_fd, &frame->listing, frame->stats, frame->stat_result) == 0;
+
+    frame->index=0;
+    frame->dir_length=path->length;
+    frame->dir_fd=dir_fd;
+    frame->dir_st=*dir_st;
+    frame->incomplete=!has_stats; //the directory can't be cached without the information of its entries
+    (*depth)++;
+
+    return 0;
+}
+
+
+/*
+    REOPEN FRAME FUNCTION
+*/
+int ReopenFrame(const ScanFrame *frame, int child_fd, int root_fd, const PathBuffer *path, size_t root_length){
+
+    struct stat st;
+
+    int dir_fd=openat(child_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd != -1 && fstat(dir_fd, &st) == 0 && st.st_dev == frame->dir_st.st_dev && st.st_ino == frame->dir_st.st_ino) return dir_fd;
+    if(dir_fd != -1) close(dir_fd);
+
+    //the sub-directory was moved in the meantime => opening the directory with its path (the path buffer still 
+    //contains the path of the sub-directory, so it is truncated to the directory)
+    char *relative_path=strndup(path->data + root_length + 1, frame->dir_length - root_length - 1);
+    if(relative_path == NULL) return -1;
+    dir_fd=openat(root_fd, relative_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    free(relative_path);
+
+    return dir_fd;
+}
+
+
+/*
+    READ DIRECTORIES FUNCTION
+*/
+void ReadDirectories(int root_fd, PathBuffer *path, SnapshotWriter *snapshot, char *isolated_path, char *dir_buffer, StatxRing *ring){
+
+    ScanFrame *frames=NULL;  //explicit stack, the frames are reused for all the directories from the same depth
+    size_t frame_capacity=0;
+    size_t depth=0;
+
+    int open_dirs=0;         //no. of directory fds kept open by the frames
+    size_t first_open=1;     //the frames between the root and this depth have their fd closed
+
+    //keeping at most a quarter of the allowed open files (the rest is for the snapshot and the analysis)
+    int open_dirs_limit=max_open_dirs;
+    struct rlimit fd_limit;
+    if(getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY && (long)(fd_limit.rlim_cur/4) < open_dirs_limit)
+        open_dirs_limit=fd_limit.rlim_cur/4 > 2 ? (int)(fd_limit.rlim_cur/4) : 2;
+
+    size_t root_length=path->length;
+    struct stat root_st;
+    if(fstat(root_fd, &root_st) == -1) memset(&root_st, 0, sizeof(root_st));
+
+    VisitedSet visited={NULL, NULL, 0, 0};
+    MarkVisitedDirectory(&visited, root_st.st_dev, root_st.st_ino, NULL);
+
+    if(PushScanFrame(&frames, &frame_capacity, &depth, root_fd, &root_st, path, root_length, dir_buffer, ring) == 0) open_dirs++;
+
+    while(depth > 0){
+        ScanFrame *frame=&frames[depth-1];
+
+        if(frame->index >= frame->listing.count){ //the directory is finished => going back to the parent directory
+            if(scan_cache != NULL && !frame->incomplete) AppendScanCache(scan_cache, path->data + root_length, &frame->dir_st, &frame->listing, frame->stats);
+
+            depth--;
+            if(depth > 0){
+                ScanFrame *parent=&frames[depth-1];
+                path->data[path->length=parent->dir_length]='\0'; //truncating the path back to the parent directory
+
+                if(parent->dir_fd == -1){
+                    parent->dir_fd=ReopenFrame(parent, frame->dir_fd, frames[0].dir_fd, path, root_length);
+                    if(parent->dir_fd == -1){
+                        fprintf(stderr, "*read_directories* error: Failed to open the directory  \"%s\"\n", path->data);
+                        parent->index=parent->listing.count; //the rest of the directory can't be parsed
+                    }
+                    else{
+                        open_dirs++;
+                        count_reopened_dirs++;
+                    }
+                    first_open=depth-1;
+                }
+            }
+            close(frame->dir_fd);
+            open_dirs--;
+            continue;
+        }
+
+        size_t i=frame->index++;
+        const char *entry_name=frame->listing.names + frame->listing.entries[i].name_offset;
+ 
+        if(AppendToPath(path, entry_name) == -1){ //constructing the path of each entry
+            fprintf(stderr, "*read_directories* error: Failed to allocate memory for path  \"%s\"\n", path->data);
+            //if the allocation of memory fails for a file
+            //the loop will break => the directory will not be monitired further     
+            frame->index=frame->listing.count;
+            frame->incomplete=1;
+            continue;
+        }
+        
+        //the snapshot records the size, the access rights and the no. of hard links of every entry, so the type
+        //returned by getdents64 (d_type) cannot replace the fstatat call here (except for the files of the unchanged
+        //directories with "--incremental=prune", whose information is taken from the scan cache)
+        struct stat st;                        //get file information with fstatat (relative to the directory)      
+                                               //& print error message in case of failing  
+        int stat_failed;
+        if(frame->cached && incremental_mode == 2 && !S_ISDIR(frame->stats[i].st_mode)){
+            st=frame->stats[i];
+            stat_failed=0;
+            scan_cache->saved_stats++;
+        }
+        else{
+            stat_failed=frame->batched ? frame->stat_result[i] : fstatat(frame->dir_fd, entry_name, &st, AT_SYMLINK_NOFOLLOW);
+            if(frame->batched && !stat_failed) st=frame->stats[i];
+        }
+        if(stat_failed == -1){       
+            fprintf(stderr, "*read_directories* error: Failed to get information for file  \"%s\"\n", entry_name);      
+            path->data[path->length=frame->dir_length]='\0';
+            frame->index=frame->listing.count;
+            frame->incomplete=1;
+            continue;
+        }
+        else CheckPermissionsAndAnalyze(path->data, st, isolated_path, snapshot->fd);
+
+        if(scan_cache != NULL && !frame->incomplete) frame->stats[i]=st; //stored for writing the scan cache
+       
+        if(WriteSnapshotRecord(snapshot, path->data, path->length, &st) == -1){
+            fprintf(stderr, "*read_directories* error: Failed to allocate memory for entry  \"%s\"\n", entry_name);
+            path->data[path->length=frame->dir_length]='\0';
+            frame->index=frame->listing.count;
+            frame->incomplete=1;
+            continue;
+        }
+
+        //the record of a mount point (with "--one-file-system") or of a directory already parsed is written, 
+        //but the directory is not opened
+        if(S_ISDIR(st.st_mode) && one_file_system && st.st_dev != root_st.st_dev) count_skipped_mounts++;
+        else if(S_ISDIR(st.st_mode) && MarkVisitedDirectory(&visited, st.st_dev, st.st_ino, NULL) == 0) count_duplicate_dirs++;
+
+        //if an entry is a directory => pushing it on the stack with the fd of the sub-directory
+        //(opened relative to the current directory, without following symbolic links)
+        else if(S_ISDIR(st.st_mode)){
+            int sub_dir_fd=openat(frame->dir_fd, entry_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if(sub_dir_fd == -1) fprintf(stderr, "*read_directories* error: Failed to open the directory  \"%s\"\n", entry_name);
+            else if(PushScanFrame(&frames, &frame_capacity, &depth, sub_dir_fd, &st, path, root_length, dir_buffer, ring) == 0){
+                open_dirs++;
+
+                //over the limit of open directories => closing the one from the lowest depth (the last one to be resumed),
+                //except the root, which is used for opening again the directories by path
+                while(open_dirs > open_dirs_limit){
+                    while(first_open < depth-1 && frames[first_open].dir_fd == -1) first_open++;
+                    if(first_open >= depth-1) break;
+                    close(frames[first_open].dir_fd);
+                    frames[first_open].dir_fd=-1;
+                    open_dirs--;
+                }
+                continue; //the path stays the one of the sub-directory
+            }
+        }
+
+        path->data[path->length=frame->dir_length]='\0'; //truncating the path back to the current directory
+    }
+
+    for(size_t i=0; i < frame_capacity; i++){
+        FreeDirListing(&frames[i].listing);
+        free(frames[i].stats);
+        free(frames[i].stat_result);
+    }
+    free(frames);
+    FreeVisitedSet(&visited);
+}
+
+
+/*
+    PUSH TASK FUNCTION
+*/
+int PushTask(WorkDeque *deque, DirNode *node){
+
+    pthread_mutex_lock(&deque->lock);
+
+    if(deque->count == deque->capacity){ //the ring buffer is full => doubling its capacity
+        size_t new_capacity=deque->capacity ? deque->capacity*2 : 256;
+        DirNode **new_tasks=malloc(new_capacity*sizeof(DirNode *));
+        if(new_tasks == NULL){
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for(size_t i=0; i < deque->count; i++) new_tasks[i]=deque->tasks[(deque->head + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks=new_tasks;
+        deque->capacity=new_capacity;
+        deque->head=0;
+    }
+
+    deque->tasks[(deque->head + deque->count) % deque->capacity]=node;
+    deque->count++;
+
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+
+/*
+    TAKE TASK FUNCTION
+*/
+DirNode *TakeTask(WorkDeque *deque, int bottom){
+
+    DirNode *node=NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->count > 0){
+        if(bottom) node=deque->tasks[(deque->head + deque->count - 1) % deque->capacity];
+        else{
+            node=deque->tasks[deque->head];
+            deque->head=(deque->head + 1) % deque->capacity;
+        }
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return node;
+}
+
+
+/*
+    SCAN DIRECTORY NODE FUNCTION
+*/
+void ScanDirectoryNode(WorkerArgs *worker, DirNode *node){
+
+    WorkerPool *pool=worker->pool;
+    int *stat_result=NULL;  //used only with io_uring
+
+    int dir_fd=node->dir_fd;
+    if(dir_fd == -1){
+        const char *relative_path=node->path[pool->root_length] ? node->path + pool->root_length + 1 : ".";
+        dir_fd=openat(pool->root_fd, relative_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    else __atomic_sub_fetch(&pool->task_fds, 1, __ATOMIC_RELAXED);
+
+    //a directory not changed since the previous scan has the same listing as the one from the scan cache
+    const char *cached_record=NULL;
+    if(dir_fd != -1 && scan_cache != NULL){
+        cached_record=LookupScanCache(scan_cache, node->path + pool->root_length, &node->dir_st);
+        if(cached_record != NULL && ReadCachedListing(cached_record, &node->listing) == -1) cached_record=NULL;
+    }
+
+    if(dir_fd == -1 || (cached_record == NULL && (ReadDirectoryListing(dir_fd, &node->listing, worker->dir_buffer, dir_buffer_size) == -1 || 
+                        FilterListing(dir_fd, &node->listing, node->path + pool->root_length) == -1))){
+        node->read_failed=1;
+    }
+    else if(node->listing.count > 0){
+        node->stats=malloc(node->listing.count*sizeof(struct stat));
+        node->children=calloc(node->listing.count, sizeof(DirNode *));
+        if(node->stats == NULL || node->children == NULL) node->alloc_failed=1;
+
+        else if(cached_record != NULL){
+            ReadCachedStats(cached_record, node->stats);
+            node->cached=1;
+        }
+
+        //with io_uring the information of all the entries is requested in batches before creating the sub-directories
+        else if(worker->ring != NULL){
+            stat_result=malloc(node->listing.count*sizeof(int));
+            if(stat_result != NULL && StatListingWithRing(worker->ring, dir_fd, &node->listing, node->stats, stat_result) == -1){
+                free(stat_result); //=> using fstatat for this directory
+                stat_result=NULL;
+            }
+        }
+    }
+
+    size_t path_length=strlen(node->path);
+
+    for(size_t i=0; !node->read_failed && !node->alloc_failed && i < node->listing.count; i++){
+        const char *entry_name=node->listing.names + node->listing.entries[i].name_offset;
+
+        //with "--incremental=prune" the information of the files from an unchanged directory is taken from the scan cache
+        int stat_failed=0;
+        if(node->cached && incremental_mode == 2 && !S_ISDIR(node->stats[i].st_mode)) __atomic_add_fetch(&scan_cache->saved_stats, 1, __ATOMIC_RELAXED);
+        else stat_failed=stat_result ? stat_result[i] : fstatat(dir_fd, entry_name, &node->stats[i], AT_SYMLINK_NOFOLLOW);
+        if(stat_failed == -1){
+            node->stat_failed=1;
+            break;
+        }
+        node->stat_count++;
+
+        if(!S_ISDIR(node->stats[i].st_mode)) continue;
+
+        //the mount points (with "--one-file-system") are not parsed
+        if(one_file_system && node->stats[i].st_dev != pool->root_dev) continue;
+
+        DirNode *child=calloc(1, sizeof(DirNode));
+        if(child != NULL) child->path=malloc(path_length + strlen(entry_name) + 2); //+2 is for '/' and null terminator
+        if(child == NULL || child->path == NULL){
+            if(child != NULL) free(child);
+            node->stat_count--;
+            node->alloc_failed=1;
+            break;
+        }
+        sprintf(child->path, "%s/%s", node->path, entry_name);
+        child->dir_st=node->stats[i];
+
+        //the fd of the sub-directory is opened now only while the no. of fds kept in the deques is under the limit,
+        //otherwise the worker that takes it opens it with its path relative to the monitored directory
+        child->dir_fd=-1;
+        if(__atomic_add_fetch(&pool->task_fds, 1, __ATOMIC_RELAXED) <= pool->max_task_fds){
+            child->dir_fd=openat(dir_fd, entry_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if(child->dir_fd == -1) __atomic_sub_fetch(&pool->task_fds, 1, __ATOMIC_RELAXED);
+            if(child->dir_fd == -1 && errno != EMFILE && errno != ENFILE){ //the error is printed when the records are written
+                free(child->path);
+                free(child);
+                continue;
+            }
+        }
+        else __atomic_sub_fetch(&pool->task_fds, 1, __ATOMIC_RELAXED);
+
+        //a directory already claimed by a worker (reached again through a bind mount, including the loops) is not
+        //parsed again. The claim keeps the node, so the thread writing the records can take it from the first path
+        //in the order of the sequential traversal
+        void **claim=NULL;
+        pthread_mutex_lock(&pool->claims_lock);
+        int claimed=MarkVisitedDirectory(&pool->claims, child->dir_st.st_dev, child->dir_st.st_ino, &claim) == 0;
+        if(!claimed){
+            if(claim != NULL) *claim=child;
+            child->owner_slot=&node->children[i];
+            node->children[i]=child;
+        }
+        pthread_mutex_unlock(&pool->claims_lock);
+        if(claimed){
+            if(child->dir_fd != -1){
+                close(child->dir_fd);
+                __atomic_sub_fetch(&pool->task_fds, 1, __ATOMIC_RELAXED);
+            }
+            free(child->path);
+            free(child);
+            continue;
+        }
+
+        __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+        if(PushTask(&pool->deques[worker->id], child) == -1){ //the node is already claimed => it stays as a failed directory
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+            if(child->dir_fd != -1){
+                close(child->dir_fd);
+                __atomic_sub_fetch(&pool->task_fds, 1, __ATOMIC_RELAXED);
+            }
+            pthread_mutex_lock(&pool->done_lock);
+            child->read_failed=1;
+            child->done=1;
+            pthread_cond_broadcast(&pool->done_cond);
+            pthread_mutex_unlock(&pool->done_lock);
+            continue;
+        }
+        __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+
+        //waking up an idle worker for stealing the new directory
+        if(__atomic_load_n(&pool->idle_workers, __ATOMIC_SEQ_CST) > 0){
+            pthread_mutex_lock(&pool->idle_lock);
+            pthread_cond_signal(&pool->idle_cond);
+            pthread_mutex_unlock(&pool->idle_lock);
+        }
+    }
+
+    free(stat_result);
+    if(dir_fd != -1) close(dir_fd);
+
+    pthread_mutex_lock(&pool->done_lock); //the node is ready for writing its records
+    node->done=1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->done_lock);
+}
+
+
+/*
+    SCAN WORKER FUNCTION
+*/
+void *ScanWorker(void *arg){
+
+    WorkerArgs *args=arg;
+    WorkerPool *pool=args->pool;
+
+    unsigned int seed=args->id + 1;
+
+    while(1){
+        DirNode *node=TakeTask(&pool->deques[args->id], 1);
+
+        //the own deque is empty => trying to steal from the others, starting with a random worker
+        for(int attempt=0; node == NULL && attempt < pool->worker_count; attempt++){
+            int victim=(rand_r(&seed) + attempt) % pool->worker_count;
+            if(victim != args->id) node=TakeTask(&pool->deques[victim], 0);
+        }
+
+        if(node != NULL){
+            __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+            ScanDirectoryNode(args, node);
+
+            if(__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0){ //the last directory => waking up everyone
+                pthread_mutex_lock(&pool->idle_lock);
+                pthread_cond_broadcast(&pool->idle_cond);
+                pthread_mutex_unlock(&pool->idle_lock);
+            }
+            continue;
+        }
+
+        //nothing to steal => waiting for a new directory or for the end of the scan
+        pthread_mutex_lock(&pool->idle_lock);
+        __atomic_add_fetch(&pool->idle_workers, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) != 0)
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        __atomic_sub_fetch(&pool->idle_workers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->idle_lock);
+
+        if(__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) break;
+    }
+
+    return NULL;
+}
+
+
+/*
+    FREE DIR NODE FUNCTION
+*/
+void FreeDirNode(DirNode *node){
+
+    FreeDirListing(&node->listing);
+    free(node->stats);
+    free(node->children);
+    free(node->path);
+    free(node);
+}
+
+
+/*
+    FREE DIR TREE FUNCTION
+*/
+void FreeDirTree(DirNode *root){
+
+    size_t capacity=64, count=0;
+    DirNode **nodes=malloc(capacity*sizeof(DirNode *));
+    if(nodes == NULL) return;
+    nodes[count++]=root;
+
+    while(count > 0){
+        DirNode *node=nodes[--count];
+        for(size_t i=0; node->children != NULL && i < node->listing.count; i++){
+            if(node->children[i] == NULL) continue;
+            if(count == capacity){
+                DirNode **new_nodes=realloc(nodes, capacity*2*sizeof(DirNode *));
+                if(new_nodes == NULL) break;
+                nodes=new_nodes;
+                capacity*=2;
+            }
+            nodes[count++]=node->children[i];
+        }
+        FreeDirNode(node);
+    }
+
+    free(nodes);
+}
+
+
+/*
+    READ DIRECTORIES PARALLEL FUNCTION
+*/
+void ReadDirectoriesParallel(int root_fd, PathBuffer *path, SnapshotWriter *snapshot, char *isolated_path){
+
+    WorkerPool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.worker_count=scan_threads;
+    pool.root_fd=root_fd;
+    pool.root_length=path->length;
+
+    //keeping at most a quarter of the allowed open files in the deques (the rest is for the workers and the analysis)
+    struct rlimit fd_limit;
+    pool.max_task_fds=MAX_TASK_FDS;
+    if(getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY && (long)(fd_limit.rlim_cur/4) < pool.max_task_fds)
+        pool.max_task_fds=(long)(fd_limit.rlim_cur/4);
+    pthread_mutex_init(&pool.idle_lock, NULL);
+    pthread_cond_init(&pool.idle_cond, NULL);
+    pthread_mutex_init(&pool.done_lock, NULL);
+    pthread_cond_init(&pool.done_cond, NULL);
+
+    pool.deques=calloc(pool.worker_count, sizeof(WorkDeque));
+    WorkerArgs *args=calloc(pool.worker_count, sizeof(WorkerArgs));
+    pthread_t *threads=calloc(pool.worker_count, sizeof(pthread_t));
+    DirNode *root=calloc(1, sizeof(DirNode));
+    if(root != NULL) root->path=strdup(path->data);
+
+    if(pool.deques == NULL || args == NULL || threads == NULL || root == NULL || root->path == NULL){
+        fprintf(stderr, "*read_directories* error: Failed to allocate memory for the worker threads of  \"%s\"\n", monitored_directory);
+        if(root != NULL) free(root->path);
+        free(root);
+        free(threads);
+        free(args);
+        free(pool.deques);
+        close(root_fd);
+        return;
+    }
+
+    for(int i=0; i < pool.worker_count; i++) pthread_mutex_init(&pool.deques[i].lock, NULL);
+    for(int i=0; i < pool.worker_count; i++){
+        args[i].pool=&pool;
+        args[i].id=i;
+        args[i].dir_buffer=malloc(dir_buffer_size);
+        if(args[i].dir_buffer == NULL){ //using only the workers that have a buffer
+            fprintf(stderr, "*read_directories* error: Failed to allocate memory for the worker %d of  \"%s\"\n", i, monitored_directory);
+            pool.worker_count=i;
+            break;
+        }
+        if(uring_depth > 0){ //the worker uses fstatat if its io_uring can't be created
+            args[i].ring=malloc(sizeof(StatxRing));
+            if(args[i].ring != NULL && SetupStatxRing(args[i].ring, uring_depth) == -1){
+                free(args[i].ring);
+                args[i].ring=NULL;
+            }
+        }
+    }
+    if(pool.worker_count == 0){
+        for(int i=0; i < scan_threads; i++){
+            pthread_mutex_destroy(&pool.deques[i].lock);
+            if(args[i].ring != NULL){
+                CloseStatxRing(args[i].ring);
+                free(args[i].ring);
+            }
+        }
+        free(root->path);
+        free(root);
+        free(threads);
+        free(args);
+        free(pool.deques);
+        close(root_fd);
+        return;
+    }
+
+    if(fstat(root_fd, &root->dir_st) == -1) memset(&root->dir_st, 0, sizeof(root->dir_st));
+    pool.root_dev=root->dir_st.st_dev;
+    pthread_mutex_init(&pool.claims_lock, NULL);
+    MarkVisitedDirectory(&pool.claims, root->dir_st.st_dev, root->dir_st.st_ino, NULL);
+
+    //the root directory uses a duplicate of root_fd, because root_fd is used for opening the directories by path
+    root->dir_fd=dup(root_fd);
+    if(root->dir_fd != -1) pool.task_fds=1;
+    pool.pending=1;
+    pool.queued=1;
+    if(PushTask(&pool.deques[0], root) == -1){
+        fprintf(stderr, "*read_directories* error: Failed to allocate memory for the worker threads of  \"%s\"\n", monitored_directory);
+        if(root->dir_fd != -1) close(root->dir_fd);
+        root->done=1;
+        root->read_failed=1;
+        pool.pending=pool.queued=0;
+    }
+
+    int started=0;
+    for(; started < pool.worker_count; started++){
+        if(pthread_create(&threads[started], NULL, ScanWorker, &args[started]) != 0){
+            fprintf(stderr, "*read_directories* error: Failed to create the worker threads for  \"%s\"\n", monitored_directory);
+            break;
+        }
+    }
+    if(started == 0){ //no worker => parsing the root (and all the directories pushed by it) in this thread
+        pool.worker_count=1;
+        ScanWorker(&args[0]);
+    }
+
+    //writing the records in the order of the sequential traversal with an explicit stack of (directory, entry index)
+    typedef struct{
+        DirNode *node;
+        size_t index;
+        size_t parent_length;  //length of the path before entering the directory
+    }WriteFrame;
+
+    size_t stack_capacity=64, stack_size=0;
+    WriteFrame *stack=malloc(stack_capacity*sizeof(WriteFrame));
+    if(stack != NULL) stack[stack_size++]=(WriteFrame){root, 0, path->length};
+
+    //the directories already parsed are checked here, in the order of the sequential traversal, so the content of a
+    //directory reached through more paths is written at the same path by both traversals. The nodes found at the
+    //other paths (only if a claim could not be added) could still be parsed by the workers, so they are freed after
+    //the workers are finished
+    VisitedSet visited={NULL, NULL, 0, 0};
+    MarkVisitedDirectory(&visited, root->dir_st.st_dev, root->dir_st.st_ino, NULL);
+    DirNode **skipped=NULL;
+    size_t skipped_count=0, skipped_capacity=0;
+
+    while(stack != NULL && stack_size > 0){
+        WriteFrame *frame=&stack[stack_size-1];
+        DirNode *node=frame->node;
+
+        if(frame->index == 0){ //waiting for the worker that parses the directory
+            pthread_mutex_lock(&pool.done_lock);
+            while(!__atomic_load_n(&node->done, __ATOMIC_ACQUIRE)) pthread_cond_wait(&pool.done_cond, &pool.done_lock);
+            pthread_mutex_unlock(&pool.done_lock);
+
+            if(node->read_failed) fprintf(stderr, "*read_directories* error: Failed to read the directory  \"%s\"\n", path->data);
+        }
+
+        if(frame->index >= node->stat_count){ //all the entries were written => printing the errors and going back
+            if(!node->read_failed && frame->index < node->listing.count){
+                const char *entry_name=node->listing.names + node->listing.entries[frame->index].name_offset;
+                if(node->stat_failed) fprintf(stderr, "*read_directories* error: Failed to get information for file  \"%s\"\n", entry_name);
+                else if(node->alloc_failed) fprintf(stderr, "*read_directories* error: Failed to allocate memory for entry  \"%s\"\n", entry_name);
+            }
+            else if(scan_cache != NULL && !node->read_failed && !node->incomplete) AppendScanCache(scan_cache, path->data + pool.root_length, &node->dir_st, &node->listing, node->stats);
+            path->data[path->length=frame->parent_length]='\0';
+            stack_size--;
+            FreeDirNode(node);
+            continue;
+        }
+
+        size_t i=frame->index++;
+        const char *entry_name=node->listing.names + node->listing.entries[i].name_offset;
+        size_t current_length=path->length;
+
+        if(AppendToPath(path, entry_name) == -1){
+            fprintf(stderr, "*read_directories* error: Failed to allocate memory for path  \"%s\"\n", path->data);
+            frame->index=node->stat_count;
+            node->stat_failed=node->alloc_failed=0; //the error was already printed
+            node->incomplete=1;
+            continue;
+        }
+
+        CheckPermissionsAndAnalyze(path->data, node->stats[i], isolated_path, snapshot->fd);
+
+        if(WriteSnapshotRecord(snapshot, path->data, path->length, &node->stats[i]) == -1){
+            fprintf(stderr, "*read_directories* error: Failed to allocate memory for entry  \"%s\"\n", entry_name);
+            path->data[path->length=current_length]='\0';
+            frame->index=node->stat_count;
+            node->stat_failed=node->alloc_failed=0;
+            node->incomplete=1;
+            continue;
+        }
+
+        if(S_ISDIR(node->stats[i].st_mode) && one_file_system && node->stats[i].st_dev != pool.root_dev) count_skipped_mounts++;
+        else if(S_ISDIR(node->stats[i].st_mode) && MarkVisitedDirectory(&visited, node->stats[i].st_dev, node->stats[i].st_ino, NULL) == 0){
+            count_duplicate_dirs++;
+            if(node->children[i] != NULL){
+                if(skipped_count == skipped_capacity){
+                    size_t new_capacity=skipped_capacity ? skipped_capacity*2 : 16;
+                    DirNode **new_skipped=realloc(skipped, new_capacity*sizeof(DirNode *));
+                    if(new_skipped == NULL){
+                        fprintf(stderr, "*read_directories* error: Failed to allocate memory for path  \"%s\"\n", path->data);
+                        break;
+                    }
+                    skipped=new_skipped;
+                    skipped_capacity=new_capacity;
+                }
+                skipped[skipped_count++]=node->children[i];
+                node->children[i]=NULL;
+            }
+        }
+        else if(S_ISDIR(node->stats[i].st_mode)){
+            if(stack_size == stack_capacity){
+                WriteFrame *new_stack=realloc(stack, stack_capacity*2*sizeof(WriteFrame));
+                if(new_stack == NULL){
+                    fprintf(stderr, "*read_directories* error: Failed to allocate memory for path  \"%s\"\n", path->data);
+                    break;
+                }
+                stack=new_stack;
+                stack_capacity*=2;
+            }
+
+            //the directory was claimed by the worker of another path (parsed later by the sequential traversal) 
+            //=> taking its node from there
+            DirNode *child=node->children[i];
+            void **claim=NULL;
+            pthread_mutex_lock(&pool.claims_lock);
+            if(MarkVisitedDirectory(&pool.claims, node->stats[i].st_dev, node->stats[i].st_ino, &claim) == 0 && claim != NULL && *claim != NULL){
+                if(child == NULL){
+                    child=*claim;
+                    *child->owner_slot=NULL;
+                }
+                *claim=NULL;
+            }
+            pthread_mutex_unlock(&pool.claims_lock);
+
+            if(child == NULL) fprintf(stderr, "*read_directories* error: Failed to open the directory  \"%s\"\n", entry_name);
+            else{
+                node->children[i]=NULL;
+                stack[stack_size++]=(WriteFrame){child, 0, current_length};
+                continue;
+            }
+        }
+
+        path->data[path->length=current_length]='\0'; //truncating the path back to the current directory
+    }
+
+    for(int i=0; i < started; i++) pthread_join(threads[i], NULL);
+
+    //freeing what was left in case of errors (the nodes from the stack and their sub-directories)
+    if(stack == NULL){
+        fprintf(stderr, "*read_directories* error: Failed to allocate memory for path  \"%s\"\n", path->data);
+        FreeDirTree(root);
+    }
+    while(stack != NULL && stack_size > 0) FreeDirTree(stack[--stack_size].node);
+    while(skipped_count > 0) FreeDirTree(skipped[--skipped_count]);
+    free(skipped);
+    FreeVisitedSet(&visited);
+    FreeVisitedSet(&pool.claims);
+    pthread_mutex_destroy(&pool.claims_lock);
+
+    for(int i=0; i < scan_threads; i++){
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].tasks);
+        free(args[i].dir_buffer);
+        if(args[i].ring != NULL){
+            CloseStatxRing(args[i].ring);
+            free(args[i].ring);
+        }
+    }
+    pthread_mutex_destroy(&pool.idle_lock);
+    pthread_cond_destroy(&pool.idle_cond);
+    pthread_mutex_destroy(&pool.done_lock);
+    pthread_cond_destroy(&pool.done_cond);
+    free(stack);
+    free(threads);
+    free(args);
+    free(pool.deques);
+    close(root_fd);
+}
+
+
+/*
+    CREATE SNAPSHOT FUNCTION    
+*/
+void CreateSnapshot(char *path, char *output_path, char *isolated_path, WatchModel *model){
+
+    char *dir_name=basename((char *)path);  //from libgen library, gets the name of the input directory
+    monitored_directory=dir_name; //storing the name in the global variable
+
+    DIR *dir_check=opendir(path); //checking if the directory given as argument for monitoring   
+                                  //exist. If the path is incorrect the error message will be printed to stderr 
+                                  //and it will be skipped
+    if(dir_check == NULL){
+        fprintf(stderr, "*create_snapshots* error: The provided directory for monitoring does not exist  \"%s\"\n", dir_name);
+        return;
+    }
+    closedir(dir_check);
+
+    dir_check=opendir(output_path); //checking if the output directory given as argument exists. 
+                                    //creates the output directory in case of non-existance
+    if(dir_check == NULL) mkdir(output_path, 0777);
+    else closedir(dir_check); 
+
+    dir_check=opendir(isolated_path); //checking if the isolated directory given as argument exists. 
+                                      //creates the isolated directory in case of non-existance
+    if(dir_check == NULL) mkdir(isolated_path, 0777);
+    else closedir(dir_check); 
+
+    //buffer for storing the name of the snapshot file
+    char snapshot_file_name[FILENAME_MAX];
+  
+    time_t now;                                         
+    struct tm *timestamp;  
+    char timestamp_str[32];
+
+    time(&now); // --> gets the current time
+    timestamp=localtime(&now);
+    strftime(timestamp_str,sizeof(timestamp_str),"%Y.%m.%d_%H:%M:%S", timestamp);
+
+    //constructing the snapshot file name with: output_path --> directory name --> snapshot number --> and timestamp
+    snprintf(snapshot_file_name, sizeof(snapshot_file_name), "%s/%s_Snapshot_%s.%s", output_path, dir_name, timestamp_str, binary_snapshots ? "bin" : "txt");
+  
+    //with "--journal" the snapshot is written in memory (only its changes are written in the output directory)
+    int snapshot_fd=journal_compaction > 0 ? memfd_create(snapshot_file_name, MFD_CLOEXEC) : open(snapshot_file_name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR); 
+    if(snapshot_fd == -1){
+        fprintf(stderr, "*create_snapshots* error: Failed to open the snapshot file for  \"%s\"\n", dir_name);
+        return;
+    }
+
+    int root_fd=open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC); //the traversal is made relative to this fd
+    if(root_fd == -1){
+        fprintf(stderr, "*create_snapshots* error: Failed to open the directory  \"%s\"\n", dir_name);
+        close(snapshot_fd);
+        return;
+    }
+
+    PathBuffer root_path={NULL, 0, 0};
+    root_path.data=strdup(path);
+    if(root_path.data == NULL){
+        fprintf(stderr, "*create_snapshots* error: Failed to allocate memory for path  \"%s\"\n", dir_name);
+        close(root_fd);
+        close(snapshot_fd);
+        return;
+    }
+    root_path.length=strlen(path);
+    root_path.capacity=root_path.length + 1;
+
+    //the getdents64 buffer is shared by all the levels, because each directory is read entirely before parsing it
+    char *dir_buffer=malloc(dir_buffer_size);
+    if(dir_buffer == NULL){
+        fprintf(stderr, "*create_snapshots* error: Failed to allocate memory for reading the directory  \"%s\"\n", dir_name);
+        free(root_path.data);
+        close(root_fd);
+        close(snapshot_fd);
+        return;
+    }
+
+    ScanCache cache;
+    if(incremental_mode > 0 && model == NULL){ //without the cache, the directory is parsed entirely
+        if(OpenScanCache(&cache, output_path, dir_name) == 0) scan_cache=&cache;
+        else fprintf(stderr, "*create_snapshots* error: Failed to open the scan cache => parsing the entire directory  \"%s\"\n", dir_name);
+    }
+
+    StatxRing ring;
+    int use_ring=0;
+    if(uring_depth > 0 && scan_threads == 1 && model == NULL){ //with more threads each worker creates its own io_uring
+        use_ring=SetupStatxRing(&ring, uring_depth) == 0;
+        if(!use_ring) fprintf(stderr, "*create_snapshots* error: Failed to create the io_uring (%s) => using fstatat for  \"%s\"\n", strerror(errno), dir_name);
+    }
+
+    //the records are written through a buffer, flushed with writev (or io_uring) when it is full
+    SnapshotWriter snapshot;
+    OpenSnapshotWriter(&snapshot, snapshot_fd, snapshot_file_name, binary_snapshots, filters.header, filters.header_length);
+
+    //the hash tree of the records is built while they are written
+    MerkleTree tree;
+    InitMerkleTree(&tree, HashBytes(filters.header, filters.header_length));
+    snapshot.tree=&tree;
+
+    //the content of the files is hashed by other threads while the directories are parsed
+    //(the files not changed since the previous scan are not read again)
+    HashPool hash_pool;
+    HashCache hash_cache;
+    int use_hash_cache=0;
+    if(content_hash_threads > 0){
+        if(StartHashPool(&hash_pool, content_hash_threads) == 0) snapshot.hashes=&hash_pool;
+        else fprintf(stderr, "*create_snapshots* error: Failed to start the hashing threads => no content hashes for  \"%s\"\n", dir_name);
+    }
+    if(snapshot.hashes != NULL){
+        use_hash_cache=OpenHashCache(&hash_cache, output_path, dir_name) == 0;
+        if(use_hash_cache) hash_pool.cache=&hash_cache;
+        else fprintf(stderr, "*create_snapshots* error: Failed to open the hash cache => hashing all the files for  \"%s\"\n", dir_name);
+    }
+    int content_hashes=snapshot.hashes != NULL;
+
+    //the active filters are recorded at the beginning of the snapshot (only if rules were given)
+    //in the binary format they are stored after the table of paths
+    if(!binary_snapshots && filters.header_length > 0) WriteSnapshotData(&snapshot, filters.header, filters.header_length);
+
+    clock_t start=clock();  //getting the cpu time used for the read_directories function
+    if(model != NULL){
+        if(WriteWatchRecords(model, &root_path, &snapshot) == -1) fprintf(stderr, "*create_snapshots* error: Failed to allocate memory for the records of the model  \"%s\"\n", dir_name);
+    }
+    else if(scan_threads > 1) ReadDirectoriesParallel(root_fd, &root_path, &snapshot, isolated_path);
+    else ReadDirectories(root_fd, &root_path, &snapshot, isolated_path, dir_buffer, use_ring ? &ring : NULL);
+    if(CloseSnapshotWriter(&snapshot) == -1) fprintf(stderr, "*create_snapshots* error: Failed to write the snapshot file for  \"%s\"\n", dir_name);
+    if(use_hash_cache) CloseHashCache(&hash_cache);
+    clock_t end=clock();
+
+    //the information recorded in the manifest (the name of the snapshot is the one without the output path)
+    SnapshotManifest manifest;
+    memset(&manifest, 0, sizeof(manifest));
+    snprintf(manifest.snapshot, sizeof(manifest.snapshot), "%s", strrchr(snapshot_file_name, '/') + 1);
+    manifest.binary=binary_snapshots;
+    manifest.records=snapshot.record_count;
+    manifest.hash=snapshot.hash;
+    struct stat snapshot_st;
+    manifest.size=fstat(snapshot_fd, &snapshot_st) == 0 ? snapshot_st.st_size : -1;
+    manifest.content_hashes=content_hashes;
+    manifest.has_tree=!tree.failed;
+    manifest.tree=tree.failed ? 0 : tree.nodes[0].hash;
+
+    if(use_ring) CloseStatxRing(&ring);
+    free(dir_buffer);
+    FreeInodeCache(&inode_cache);
+
+    if(scan_cache != NULL){
+        fprintf(stdout, "(Incremental) %ld of %ld directories were not changed since the previous scan (%ld fstatat calls saved) for  \"%s\"\n", scan_cache->hits, count_directories + scan_cache->hits, scan_cache->saved_stats, dir_name);
+        CloseScanCache(scan_cache);
+        scan_cache=NULL;
+    }
+    free(root_path.data);
+
+    double time=(double)(end-start)/CLOCKS_PER_SEC;  
+   
+    if(snapshot_fd != -1) fprintf(stdout, "(Creating) Snapshot created successfully for  \"%s\"  in %g (s)\n", dir_name, time);
+    if(count_reopened_dirs > 0) fprintf(stdout, "(Reading) %ld directories opened again because of the limit of %d open directories for  \"%s\"\n", count_reopened_dirs, max_open_dirs, dir_name);
+    fprintf(stdout, "(Writing) %ld bytes of the snapshot written with %ld %s for  \"%s\"\n", count_snapshot_bytes, count_snapshot_writes, write_uring ? "io_uring writes" : "writev calls", dir_name);
+    if(count_reused_analyses > 0) fprintf(stdout, "(Checking Permissions) %ld hard links reused the analysis of their inode for  \"%s\"\n", count_reused_analyses, dir_name);
+    if(count_skipped_mounts > 0 || count_duplicate_dirs > 0) fprintf(stdout, "(Reading) %ld mount points not crossed and %ld directories already parsed (bind mounts) skipped for  \"%s\"\n", count_skipped_mounts, count_duplicate_dirs, dir_name);
+    if(filters.count > 0) fprintf(stdout, "(Filtering) %ld entries excluded (%ld of them directories, not parsed) by %zu rules for  \"%s\"\n", count_excluded_entries, count_pruned_dirs, filters.count, dir_name);
+    if(content_hashes) fprintf(stdout, "(Hashing) %ld files (%ld bytes) hashed by %d threads, %ld hashes taken from the hash cache, %ld files could not be read for  \"%s\"\n", count_hashed_files, count_hashed_bytes, content_hash_threads, count_cached_hashes, count_unhashed_files, dir_name);
+    if(uring_depth > 0) fprintf(stdout, "(Reading) %ld statx requests submitted with %ld io_uring_enter calls for  \"%s\"\n", count_statx_requests, count_uring_enters, dir_name);
+    fprintf(stdout, "(Reading) %ld entries from %ld directories read with %ld getdents64 calls => %ld syscalls saved compared to readdir for  \"%s\"\n", count_dir_entries, count_directories, count_getdents_calls, count_readdir_calls > count_getdents_calls ? count_readdir_calls - count_getdents_calls : 0, dir_name);
+    
+    if(journal_compaction > 0) UpdateJournal(output_path, snapshot_fd, &manifest);
+    close(snapshot_fd);
+    if(journal_compaction == 0) GetPreviousSnapshotThenCompare(output_path, snapshot_file_name, &manifest, &tree);
+    FreeMerkleTree(&tree);
+}
+
+
+/*
+    START WATCH MODEL FUNCTION
+*/
+static int CompareWatchRecords(const void *a, const void *b){
+
+    const WatchRecord *x=a, *y=b;
+    return ComparePaths(x->path, x->path_length, y->path, y->path_length);
+}
+
+//the additions are sorted and merged with the records that were not removed
+static int MergeWatchRecords(WatchModel *model){
+
+    if(model->addition_count == 0 && model->removed_count == 0) return 0;
+    if(model->addition_count > 1) qsort(model->additions, model->addition_count, sizeof(WatchRecord), CompareWatchRecords);
+
+    size_t count=model->count - model->removed_count + model->addition_count;
+    WatchRecord *records=malloc((count ? count : 1)*sizeof(WatchRecord));
+    if(records == NULL) return -1;
+
+    size_t i=0, j=0, k=0;
+    while(i < model->count || j < model->addition_count){
+        if(i < model->count && model->records[i].removed){
+            free(model->records[i++].path);
+            continue;
+        }
+        if(j == model->addition_count || (i < model->count && CompareWatchRecords(&model->records[i], &model->additions[j]) < 0)) records[k++]=model->records[i++];
+        else records[k++]=model->additions[j++];
+    }
+
+    free(model->records);
+    model->records=records;
+    model->count=k;
+    model->capacity=count;
+    model->addition_count=0;
+    model->removed_count=0;
+
+    return 0;
+}
+
+//adds a path to the changed paths (the same path named by consecutive events is added once)
+static int AddWatchChange(WatchModel *model, const char *dir_path, const char *name){
+
+    size_t dir_length=strlen(dir_path), name_length=name ? strlen(name) : 0;
+    size_t length=dir_length + (dir_length > 0 && name_length > 0) + name_length;
+    if(length == 0) return 0; //the monitored directory itself has no record
+
+    if(model->changed_count > 0){
+        const char *last=model->changed[model->changed_count - 1];
+        if(strlen(last) == length && strncmp(last, dir_path, dir_length) == 0 && (name_length == 0 || strcmp(last + length - name_length, name) == 0)) return 0;
+    }
+    if(model->changed_count == MAX_WATCH_CHANGES){ //too many paths => parsing the directory again costs less
+        model->overflow=1;
+        return 0;
+    }
+    if(model->changed_count == model->changed_capacity){
+        size_t new_capacity=model->changed_capacity ? model->changed_capacity*2 : 256;
+        char **new_changed=realloc(model->changed, new_capacity*sizeof(char *));
+        if(new_changed == NULL) return -1;
+        model->changed=new_changed;
+        model->changed_capacity=new_capacity;
+    }
+
+    char *path=malloc(length + 1);
+    if(path == NULL) return -1;
+    memcpy(path, dir_path, dir_length);
+    if(dir_length > 0 && name_length > 0) path[dir_length]='/';
+    if(name_length > 0) memcpy(path + length - name_length, name, name_length);
+    path[length]='\0';
+    model->changed[model->changed_count++]=path;
+
+    return 0;
+}
+
+//adds a record to the additions of the model
+static WatchRecord *AddWatchRecord(WatchModel *model, const char *path, size_t path_length, const struct stat *st){
+
+    if(model->addition_count == model->addition_capacity){
+        size_t new_capacity=model->addition_capacity ? model->addition_capacity*2 : 1024;
+        WatchRecord *new_additions=realloc(model->additions, new_capacity*sizeof(WatchRecord));
+        if(new_additions == NULL) return NULL;
+        model->additions=new_additions;
+        model->addition_capacity=new_capacity;
+    }
+
+    WatchRecord *record=&model->additions[model->addition_count];
+    record->path=strndup(path, path_length);
+    if(record->path == NULL) return NULL;
+    record->path_length=path_length;
+    record->st=*st;
+    record->wd=-1;
+    record->removed=0;
+    model->addition_count++;
+
+    return record;
+}
+
+//the information of an entry changed (the fields of the record and the ones identifying its content in the hash cache)
+static int WatchRecordChanged(const struct stat *old, const struct stat *st){
+
+    return old->st_size != st->st_size || old->st_mode != st->st_mode || old->st_nlink != st->st_nlink || old->st_ino != st->st_ino ||
+           old->st_dev != st->st_dev || old->st_mtim.tv_sec != st->st_mtim.tv_sec || old->st_mtim.tv_nsec != st->st_mtim.tv_nsec ||
+           old->st_ctim.tv_sec != st->st_ctim.tv_sec || old->st_ctim.tv_nsec != st->st_ctim.tv_nsec;
+}
+
+//adds a file with several hard links to the inodes whose other links are checked again (inotify reports only the
+//link that changed)
+static int AddLinkedInode(WatchModel *model, const struct stat *st){
+
+    if(S_ISDIR(st->st_mode)) return 0;
+    if(model->linked_count == model->linked_capacity){
+        size_t new_capacity=model->linked_capacity ? model->linked_capacity*2 : 64;
+        uint64_t *new_linked=realloc(model->linked, new_capacity*2*sizeof(uint64_t));
+        if(new_linked == NULL) return -1;
+        model->linked=new_linked;
+        model->linked_capacity=new_capacity;
+    }
+    model->linked[2*model->linked_count]=st->st_dev;
+    model->linked[2*model->linked_count + 1]=st->st_ino;
+    model->linked_count++;
+
+    return 0;
+}
+
+//checks an entry like ReadDirectories does (with the full path) before its record is added or changed
+static void AnalyzeWatchEntry(WatchModel *model, const char *relative_path, const struct stat *st){
+
+    size_t length=strlen(model->root) + strlen(relative_path) + 2;
+    char *full_path=malloc(length);
+    if(full_path == NULL) return;
+    snprintf(full_path, length, "%s/%s", model->root, relative_path);
+    CheckPermissionsAndAnalyze(full_path, *st, model->isolated_path, -1);
+    free(full_path);
+}
+
+int StartWatchModel(WatchModel *model, const char *path, char *isolated_path){
+
+    memset(model, 0, sizeof(*model));
+    model->root=path;
+    model->isolated_path=isolated_path;
+    model->root_fd=open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    model->inotify_fd=-1;
+    model->fanotify_fd=-1;
+    model->dir_buffer=malloc(dir_buffer_size);
+
+    //fanotify reports the directory of each event by its file handle, resolved to a path under the canonical one
+    if(watch_fanotify){
+        model->fanotify_fd=fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY | O_LARGEFILE);
+        model->root_real=realpath(path, NULL);
+        model->root_real_length=model->root_real ? strlen(model->root_real) : 0;
+        model->handles=calloc(WATCH_HANDLE_CACHE_SIZE, sizeof(WatchHandle));
+    }
+    else model->inotify_fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(model->root_fd == -1 || (watch_fanotify ? model->fanotify_fd == -1 || model->root_real == NULL || model->handles == NULL : model->inotify_fd == -1) ||
+       model->dir_buffer == NULL || fstat(model->root_fd, &model->root_st) == -1 || WatchSubtree(model, "", &model->root_st) == -1 || MergeWatchRecords(model) == -1){
+        StopWatchModel(model);
+        return -1;
+    }
+    model->linked_count=0; //all the links are in the model
+
+    return 0;
+}
+
+
+/*
+    WATCH SUBTREE FUNCTION
+*/
+//watches a directory with inotify by its full path (its watch descriptor is the same if it was already watched),
+//returns -1 only if the allocation of memory fails
+static int AddInotifyWatch(WatchModel *model, const char *dir_path, size_t dir_record){
+
+    const uint32_t mask=IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE |
+                        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+    size_t full_length=strlen(model->root) + strlen(dir_path) + 2;
+    char *full_path=malloc(full_length);
+    if(full_path == NULL) return -1;
+    snprintf(full_path, full_length, dir_path[0] ? "%s/%s" : "%s%s", model->root, dir_path);
+    int wd=inotify_add_watch(model->inotify_fd, full_path, mask);
+    free(full_path);
+
+    if(wd == -1){
+        if(!model->watch_failed) fprintf(stderr, "*watch_subtree* error: Failed to watch the directory (%s) => its changes are not seen  \"%s\"\n", strerror(errno), dir_path[0] ? dir_path : monitored_directory);
+        model->watch_failed=1;
+        return 0;
+    }
+    if((size_t)wd >= model->watched_capacity){
+        size_t new_capacity=model->watched_capacity ? model->watched_capacity : 256;
+        while(new_capacity <= (size_t)wd) new_capacity*=2;
+        char **new_watched=realloc(model->watched, new_capacity*sizeof(char *));
+        if(new_watched == NULL) return -1;
+        memset(new_watched + model->watched_capacity, 0, (new_capacity - model->watched_capacity)*sizeof(char *));
+        model->watched=new_watched;
+        model->watched_capacity=new_capacity;
+    }
+    if(model->watched[wd] == NULL) model->watch_count++;
+    free(model->watched[wd]);
+    model->watched[wd]=strdup(dir_path);
+
+    //the record of the directory keeps its watch (for removing it with the directory)
+    if(dir_record != SIZE_MAX) model->additions[dir_record].wd=wd;
+
+    return 0;
+}
+
+//marks the file system of a directory with fanotify (once for each file system, so only the directories on other
+//file systems than the monitored one add a mark), returns -1 only if the allocation of memory fails
+static int MarkWatchFilesystem(WatchModel *model, int dir_fd, dev_t dev, const char *dir_path){
+
+    const uint64_t mask=FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ATTRIB | FAN_MODIFY | FAN_CLOSE_WRITE |
+                        FAN_DELETE_SELF | FAN_MOVE_SELF | FAN_ONDIR;
+
+    for(size_t i=0; i < model->filesystem_count; i++){
+        if(model->filesystems[i].dev == dev) return 0;
+    }
+    WatchFilesystem *new_filesystems=realloc(model->filesystems, (model->filesystem_count + 1)*sizeof(WatchFilesystem));
+    if(new_filesystems == NULL) return -1;
+    model->filesystems=new_filesystems;
+    WatchFilesystem *filesystem=&model->filesystems[model->filesystem_count++];
+    memset(filesystem, 0, sizeof(*filesystem));
+    filesystem->dev=dev;
+    filesystem->mount_fd=-1;
+
+    //the directory events need a mark of the whole file system (not of the mount)
+    struct statfs fs_info;
+    if(fstatfs(dir_fd, &fs_info) == -1 || fanotify_mark(model->fanotify_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, dir_fd, NULL) == -1 ||
+       (filesystem->mount_fd=fcntl(dir_fd, F_DUPFD_CLOEXEC, 0)) == -1){
+        if(!model->watch_failed) fprintf(stderr, "*watch_subtree* error: Failed to mark the file system with fanotify (%s) => its changes are not seen  \"%s\"\n", strerror(errno), dir_path[0] ? dir_path : monitored_directory);
+        model->watch_failed=1;
+        return 0;
+    }
+    memcpy(filesystem->fsid, &fs_info.f_fsid, sizeof(filesystem->fsid));
+    model->watch_count++;
+
+    return 0;
+}
+
+int WatchSubtree(WatchModel *model, const char *relative_path, const struct stat *dir_st){
+
+    //explicit stack of the directories to be parsed, with the index of their record in the additions (a bind mount of
+    //a directory already parsed by this call is not parsed again)
+    typedef struct{
+        char *path;
+        size_t record;           //SIZE_MAX for the monitored directory
+        dev_t dev;
+    }WatchFrame;
+    WatchFrame *stack=NULL;
+    size_t depth=0, stack_capacity=0;
+    VisitedSet visited;
+    memset(&visited, 0, sizeof(visited));
+    MarkVisitedDirectory(&visited, dir_st->st_dev, dir_st->st_ino, NULL);
+
+    DirListing listing;
+    memset(&listing, 0, sizeof(listing));
+    PathBuffer entry_path={NULL, 0, 0};
+    int result=0;
+
+    char *first=strdup(relative_path);
+    if(first == NULL) return -1;
+    stack=malloc(16*sizeof(WatchFrame));
+    if(stack == NULL){
+        free(first);
+        return -1;
+    }
+    stack_capacity=16;
+    stack[depth].path=first;
+    stack[depth].dev=dir_st->st_dev;
+    stack[depth++].record=relative_path[0] && model->addition_count > 0 && strcmp(model->additions[model->addition_count - 1].path, relative_path) == 0 ? model->addition_count - 1 : SIZE_MAX;
+
+    while(depth > 0 && result == 0){
+        char *dir_path=stack[--depth].path;
+        size_t dir_record=stack[depth].record;
+        dev_t dir_dev=stack[depth].dev;
+
+        if(model->fanotify_fd == -1 && AddInotifyWatch(model, dir_path, dir_record) == -1){
+            free(dir_path);
+            result=-1;
+            break;
+        }
+
+        int dir_fd=openat(model->root_fd, dir_path[0] ? dir_path : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if(dir_fd != -1 && model->fanotify_fd != -1 && MarkWatchFilesystem(model, dir_fd, dir_dev, dir_path) == -1){
+            close(dir_fd);
+            free(dir_path);
+            result=-1;
+            break;
+        }
+        if(dir_fd == -1 || ReadDirectoryListing(dir_fd, &listing, model->dir_buffer, dir_buffer_size) == -1 || FilterListing(dir_fd, &listing, dir_path) == -1){
+            fprintf(stderr, "*watch_subtree* error: Failed to read the directory  \"%s\"\n", dir_path[0] ? dir_path : monitored_directory);
+            if(dir_fd != -1) close(dir_fd);
+            free(dir_path);
+            continue;
+        }
+
+        for(size_t i=0; i < listing.count && result == 0; i++){
+            const char *name=listing.names + listing.entries[i].name_offset;
+            entry_path.length=0;
+            if((dir_path[0] && AppendToPath(&entry_path, dir_path) == -1) || AppendToPath(&entry_path, name) == -1){
+                result=-1;
+                break;
+            }
+            const char *entry=entry_path.data + 1; //without the leading '/'
+
+            struct stat st;
+            if(fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1){
+                fprintf(stderr, "*watch_subtree* error: Failed to get information for file  \"%s\"\n", name);
+                continue;
+            }
+            AnalyzeWatchEntry(model, entry, &st);
+            if(AddWatchRecord(model, entry, entry_path.length - 1, &st) == NULL || (st.st_nlink > 1 && AddLinkedInode(model, &st) == -1)){
+                result=-1;
+                break;
+            }
+
+            //the same rules as ReadDirectories for the mount points and the directories already parsed
+            if(S_ISDIR(st.st_mode) && one_file_system && st.st_dev != model->root_st.st_dev) count_skipped_mounts++;
+            else if(S_ISDIR(st.st_mode) && MarkVisitedDirectory(&visited, st.st_dev, st.st_ino, NULL) == 0) count_duplicate_dirs++;
+            else if(S_ISDIR(st.st_mode)){
+                if(depth == stack_capacity){
+                    WatchFrame *new_stack=realloc(stack, stack_capacity*2*sizeof(WatchFrame));
+                    if(new_stack == NULL){
+                        result=-1;
+                        break;
+                    }
+                    stack=new_stack;
+                    stack_capacity*=2;
+                }
+                if((stack[depth].path=strdup(entry)) == NULL) result=-1;
+                else{
+                    stack[depth].dev=st.st_dev;
+                    stack[depth++].record=model->addition_count - 1;
+                }
+            }
+        }
+
+        close(dir_fd);
+        free(dir_path);
+    }
+
+    while(depth > 0) free(stack[--depth].path);
+    free(stack);
+    free(entry_path.data);
+    FreeDirListing(&listing);
+    FreeVisitedSet(&visited);
+
+    return result;
+}
+
+
+/*
+    READ WATCH EVENTS FUNCTION
+*/
+//empties the cache of the directories resolved from their file handles (a directory was moved, so their paths can
+//be different)
+static void ClearWatchHandles(WatchModel *model){
+
+    for(size_t i=0; i < WATCH_HANDLE_CACHE_SIZE; i++){
+        free(model->handles[i].path);
+        model->handles[i].path=NULL;
+        model->handles[i].key_length=0;
+    }
+}
+
+//finds the path of the directory of a fanotify event from its file handle, relative to the monitored directory (NULL
+//if it is outside of it or it was deleted), returns -1 only if the allocation of memory fails
+static int ResolveWatchHandle(WatchModel *model, const struct fanotify_event_info_fid *fid, const char **path){
+
+    const struct file_handle *handle=(const struct file_handle *)fid->handle;
+    const unsigned char *key=(const unsigned char *)&fid->fsid; //the file handle follows the file system ID
+    size_t key_length=sizeof(fid->fsid) + sizeof(struct file_handle) + handle->handle_bytes;
+    *path=NULL;
+    if(handle->handle_bytes > MAX_HANDLE_SZ) return 0;
+
+    WatchHandle *cached=&model->handles[HashBytes(key, key_length) % WATCH_HANDLE_CACHE_SIZE];
+    if(cached->key_length == key_length && memcmp(cached->key, key, key_length) == 0){
+        *path=cached->path;
+        return 0;
+    }
+
+    //the handle is opened on the file system of the event (the path of the directory is the one in that mount)
+    int mount_fd=-1;
+    for(size_t i=0; i < model->filesystem_count && mount_fd == -1; i++){
+        if(model->filesystems[i].mount_fd != -1 && memcmp(model->filesystems[i].fsid, &fid->fsid, sizeof(fid->fsid)) == 0) mount_fd=model->filesystems[i].mount_fd;
+    }
+    if(mount_fd == -1) return 0;
+    int dir_fd=open_by_handle_at(mount_fd, (struct file_handle *)handle, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd == -1) return 0; //deleted (its deletion is reported in its directory)
+
+    char link[64], resolved[PATH_MAX];
+    struct stat st;
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dir_fd);
+    ssize_t length=fstat(dir_fd, &st) == 0 && st.st_nlink > 0 ? readlink(link, resolved, sizeof(resolved) - 1) : -1;
+    close(dir_fd);
+    if(length == -1) return 0;
+    resolved[length]='\0';
+
+    const char *relative=NULL;
+    size_t root_length=model->root_real_length;
+    if(root_length == 1) relative=resolved + 1; //the monitored directory is "/"
+    else if((size_t)length >= root_length && memcmp(resolved, model->root_real, root_length) == 0 && (resolved[root_length] == '/' || resolved[root_length] == '\0'))
+        relative=resolved + root_length + (resolved[root_length] == '/');
+
+    free(cached->path);
+    cached->path=NULL;
+    cached->key_length=0;
+    if(relative != NULL && (cached->path=strdup(relative)) == NULL) return -1;
+    memcpy(cached->key, key, key_length);
+    cached->key_length=key_length;
+    *path=cached->path;
+
+    return 0;
+}
+
+//reads the events of the marked file systems, only the ones of the directories under the monitored one are kept
+static long ReadFanotifyEvents(WatchModel *model){
+
+    char buffer[65536] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    long events=0;
+    int check_root=0;
+
+    while(1){
+        ssize_t length=read(model->fanotify_fd, buffer, sizeof(buffer));
+        if(length == -1 && errno != EAGAIN && errno != EINTR) return -1;
+        if(length <= 0) break;
+
+        for(size_t offset=0; offset + sizeof(struct fanotify_event_metadata) <= (size_t)length;){
+            struct fanotify_event_metadata event; //the events are aligned only to 4 bytes (the mask has 8)
+            memcpy(&event, buffer + offset, sizeof(event));
+            if(event.event_len < sizeof(event) || offset + event.event_len > (size_t)length) break;
+            const char *position=buffer + offset;
+            offset+=event.event_len;
+            events++;
+            if(event.mask & FAN_Q_OVERFLOW){
+                model->overflow=1;
+                continue;
+            }
+            if(event.mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) check_root=1;
+
+            //the record of the directory of the event, with the name of the entry ("." => the directory itself)
+            const struct fanotify_event_info_fid *fid=(const struct fanotify_event_info_fid *)(position + event.metadata_len);
+            if(event.event_len < event.metadata_len + sizeof(*fid) + sizeof(struct file_handle) ||
+               (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME && fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID)) continue;
+            const struct file_handle *handle=(const struct file_handle *)fid->handle;
+            const char *name=fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ? (const char *)handle->f_handle + handle->handle_bytes : NULL;
+            if(name != NULL && strcmp(name, ".") == 0) name=NULL;
+
+            const char *dir_path=NULL;
+            if(ResolveWatchHandle(model, fid, &dir_path) == -1) return -1;
+            if(dir_path != NULL){
+                if(AddWatchChange(model, dir_path, name) == -1) return -1;
+                if(name != NULL && AddWatchChange(model, dir_path, NULL) == -1) return -1;
+            }
+            if((event.mask & FAN_ONDIR) && (event.mask & (FAN_MOVED_FROM | FAN_MOVED_TO))) ClearWatchHandles(model);
+        }
+    }
+
+    //a directory was deleted or moved somewhere on the file system => checking that it was not the monitored one
+    struct stat st;
+    if(check_root && (stat(model->root, &st) == -1 || st.st_dev != model->root_st.st_dev || st.st_ino != model->root_st.st_ino)){
+        fprintf(stderr, "*read_watch_events* error: The monitored directory was deleted or moved => Stopping the watch for  \"%s\"\n", monitored_directory);
+        watch_stopping=1;
+    }
+
+    return events;
+}
+
+long ReadWatchEvents(WatchModel *model){
+
+    if(model->fanotify_fd != -1) return ReadFanotifyEvents(model);
+
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    long events=0;
+
+    while(1){
+        ssize_t length=read(model->inotify_fd, buffer, sizeof(buffer));
+        if(length == -1) return errno == EAGAIN || errno == EINTR ? events : -1;
+        if(length == 0) return events;
+
+        for(char *position=buffer; position < buffer + length;){
+            const struct inotify_event *event=(const struct inotify_event *)position;
+            position+=sizeof(struct inotify_event) + event->len;
+            events++;
+
+            if(event->mask & IN_Q_OVERFLOW){
+                model->overflow=1;
+                continue;
+            }
+            if(event->wd < 0 || (size_t)event->wd >= model->watched_capacity || model->watched[event->wd] == NULL) continue;
+            const char *dir_path=model->watched[event->wd];
+
+            if(event->mask & IN_IGNORED){ //the directory was deleted (or its watch removed)
+                free(model->watched[event->wd]);
+                model->watched[event->wd]=NULL;
+                model->watch_count--;
+                continue;
+            }
+            if((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) && dir_path[0] == '\0'){
+                fprintf(stderr, "*read_watch_events* error: The monitored directory was deleted or moved => Stopping the watch for  \"%s\"\n", monitored_directory);
+                watch_stopping=1;
+                continue;
+            }
+
+            //an entry changed => its record and the one of its directory (size, no. of hard links) are checked again
+            if(AddWatchChange(model, dir_path, event->len > 0 ? event->name : NULL) == -1) return -1;
+            if(event->len > 0 && AddWatchChange(model, dir_path, NULL) == -1) return -1;
+        }
+    }
+}
+
+
+/*
+    APPLY WATCH CHANGES FUNCTION
+*/
+static int CompareChangedPaths(const void *a, const void *b){
+
+    const char *x=*(char * const *)a, *y=*(char * const *)b;
+    return ComparePaths(x, strlen(x), y, strlen(y));
+}
+
+//finds the record of a path in the model (-1 if it is not there or it was removed)
+static long FindWatchRecord(const WatchModel *model, const char *path, size_t path_length){
+
+    size_t low=0, high=model->count;
+    while(low < high){
+        size_t middle=low + (high - low)/2;
+        int order=ComparePaths(model->records[middle].path, model->records[middle].path_length, path, path_length);
+        if(order == 0) return model->records[middle].removed ? -1 : (long)middle;
+        if(order < 0) low=middle + 1;
+        else high=middle;
+    }
+
+    return -1;
+}
+
+static int CompareInodes(const void *a, const void *b){
+
+    const uint64_t *x=a, *y=b;
+    if(x[0] != y[0]) return x[0] < y[0] ? -1 : 1;
+    return x[1] < y[1] ? -1 : x[1] > y[1];
+}
+
+//checks again the other links of the files that changed, returns the no. of records changed
+static long UpdateLinkedRecords(WatchModel *model){
+
+    if(model->linked_count == 0 && !model->unknown_links) return 0;
+    if(model->linked_count > 1) qsort(model->linked, model->linked_count, 2*sizeof(uint64_t), CompareInodes);
+
+    long changes=0;
+    for(size_t i=0; i < model->count; i++){
+        WatchRecord *record=&model->records[i];
+        uint64_t key[2]={record->st.st_dev, record->st.st_ino};
+        if(S_ISDIR(record->st.st_mode) || (!(model->unknown_links && record->st.st_nlink > 1) &&
+           (model->linked_count == 0 || bsearch(key, model->linked, model->linked_count, 2*sizeof(uint64_t), CompareInodes) == NULL))) continue;
+
+        struct stat st;
+        if(fstatat(model->root_fd, record->path, &st, AT_SYMLINK_NOFOLLOW) == 0 && st.st_ino == record->st.st_ino && WatchRecordChanged(&record->st, &st)){
+            record->st=st;
+            changes++;
+        }
+    }
+    model->linked_count=0;
+    model->unknown_links=0;
+
+    return changes;
+}
+
+//removes a record and, for a directory, the records of its content (they follow it in the order of the paths),
+//with their watches if they still watch the same path, returns the no. of records removed
+static long RemoveWatchSubtree(WatchModel *model, size_t index){
+
+    const WatchRecord *first=&model->records[index];
+    long removed=0;
+
+    for(size_t i=index; i < model->count; i++){
+        WatchRecord *record=&model->records[i];
+        if(i > index && !(record->path_length > first->path_length && record->path[first->path_length] == '/' &&
+           memcmp(record->path, first->path, first->path_length) == 0)) break;
+        if(record->removed) continue;
+
+        if(record->wd >= 0 && (size_t)record->wd < model->watched_capacity && model->watched[record->wd] != NULL &&
+           strcmp(model->watched[record->wd], record->path) == 0){
+            inotify_rm_watch(model->inotify_fd, record->wd);
+            free(model->watched[record->wd]);
+            model->watched[record->wd]=NULL;
+            model->watch_count--;
+        }
+        if(record->st.st_nlink > 1) AddLinkedInode(model, &record->st);
+        record->removed=1;
+        model->removed_count++;
+        removed++;
+    }
+
+    return removed;
+}
+
+long ApplyWatchChanges(WatchModel *model){
+
+    long changes=0;
+
+    //after lost events the model is built again with a new inotify instance (the directories are watched again)
+    if(model->overflow){
+        fprintf(stdout, "(Watching) Events were lost => Parsing the entire directory again for  \"%s\"\n", monitored_directory);
+        for(size_t i=0; i < model->count; i++) free(model->records[i].path);
+        changes=(long)model->count;
+        model->count=0;
+        model->removed_count=0;
+        for(size_t i=0; i < model->changed_count; i++) free(model->changed[i]);
+        model->changed_count=0;
+        model->overflow=0;
+        if(model->fanotify_fd != -1) ClearWatchHandles(model); //the marks of the file systems are kept
+        else{
+            for(size_t i=0; i < model->watched_capacity; i++){
+                free(model->watched[i]);
+                model->watched[i]=NULL;
+            }
+            model->watch_count=0;
+            close(model->inotify_fd);
+            model->inotify_fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if(model->inotify_fd == -1) return -1;
+        }
+        if(WatchSubtree(model, "", &model->root_st) == -1 || MergeWatchRecords(model) == -1) return -1;
+        model->linked_count=0;
+        return changes + (long)model->count;
+    }
+
+    //the paths are checked in order, so the content of a directory parsed again is skipped
+    if(model->changed_count > 1) qsort(model->changed, model->changed_count, sizeof(char *), CompareChangedPaths);
+    const char *parsed=NULL;
+    size_t parsed_length=0;
+    int result=0;
+
+    for(size_t c=0; c < model->changed_count && result == 0; c++){
+        const char *path=model->changed[c];
+        size_t path_length=strlen(path);
+        if(c > 0 && strcmp(path, model->changed[c-1]) == 0) continue;
+        if(parsed != NULL && path_length > parsed_length && path[parsed_length] == '/' && memcmp(path, parsed, parsed_length) == 0) continue;
+
+        long index=FindWatchRecord(model, path, path_length);
+        WatchRecord *old=index >= 0 ? &model->records[index] : NULL;
+
+        //an entry excluded by the filters is not in the model (like a deleted entry)
+        struct stat st;
+        int exists=fstatat(model->root_fd, path, &st, AT_SYMLINK_NOFOLLOW) == 0;
+        if(exists && filters.count > 0){
+            const char *name=strrchr(path, '/');
+            long rule=MatchFilters(&filters, name ? name + 1 : path, path, S_ISDIR(st.st_mode));
+            if(rule != -1 && !filters.rules[rule].include){
+                if(st.st_nlink > 1 && AddLinkedInode(model, &st) == -1) result=-1; //a link to a file of the model
+                exists=0;
+                count_excluded_entries++;
+            }
+        }
+
+        //the same entry (a directory keeps its content if it is the same directory)
+        if(old != NULL && exists && (old->st.st_mode & S_IFMT) == (st.st_mode & S_IFMT) && (!S_ISDIR(st.st_mode) || (old->st.st_dev == st.st_dev && old->st.st_ino == st.st_ino))){
+            if(WatchRecordChanged(&old->st, &st)){
+                if((old->st.st_nlink > 1 || st.st_nlink > 1) && AddLinkedInode(model, &st) == -1) result=-1;
+                AnalyzeWatchEntry(model, path, &st);
+                old->st=st;
+                changes++;
+            }
+            continue;
+        }
+
+        //deleted, moved, excluded or replaced by another entry
+        if(old != NULL) changes+=RemoveWatchSubtree(model, index);
+        else if(!exists) model->unknown_links=1;
+        if(!exists) continue;
+
+        AnalyzeWatchEntry(model, path, &st);
+        if(AddWatchRecord(model, path, path_length, &st) == NULL || (st.st_nlink > 1 && AddLinkedInode(model, &st) == -1)){
+            result=-1;
+            break;
+        }
+        changes++;
+
+        //a new directory is parsed with its content (its sub-directories are watched too)
+        if(S_ISDIR(st.st_mode)){
+            if(one_file_system && st.st_dev != model->root_st.st_dev) count_skipped_mounts++;
+            else{
+                size_t previous_count=model->addition_count;
+                if(WatchSubtree(model, path, &st) == -1) result=-1;
+                changes+=(long)(model->addition_count - previous_count);
+                parsed=path;
+                parsed_length=path_length;
+            }
+        }
+    }
+
+    for(size_t i=0; i < model->changed_count; i++) free(model->changed[i]);
+    model->changed_count=0;
+    if(MergeWatchRecords(model) == -1) result=-1;
+    changes+=UpdateLinkedRecords(model);
+
+    return result == -1 ? -1 : changes;
+}
+
+
+/*
+    WRITE WATCH RECORDS FUNCTION
+*/
+int WriteWatchRecords(const WatchModel *model, PathBuffer *root_path, SnapshotWriter *snapshot){
+
+    size_t root_length=root_path->length;
+    int result=0;
+
+    for(size_t i=0; i < model->count && result == 0; i++){
+        const WatchRecord *record=&model->records[i];
+        if(AppendToPath(root_path, record->path) == -1 || WriteSnapshotRecord(snapshot, root_path->data, root_path->length, &record->st) == -1) result=-1;
+        root_path->data[root_path->length=root_length]='\0';
+    }
+
+    return result;
+}
+
+
+/*
+    STOP WATCH MODEL FUNCTION
+*/
+void StopWatchModel(WatchModel *model){
+
+    for(size_t i=0; i < model->count; i++) free(model->records[i].path);
+    for(size_t i=0; i < model->addition_count; i++) free(model->additions[i].path);
+    for(size_t i=0; i < model->watched_capacity; i++) free(model->watched[i]);
+    for(size_t i=0; i < model->changed_count; i++) free(model->changed[i]);
+    for(size_t i=0; i < model->filesystem_count; i++){
+        if(model->filesystems[i].mount_fd != -1) close(model->filesystems[i].mount_fd);
+    }
+    if(model->handles != NULL) ClearWatchHandles(model);
+    free(model->records);
+    free(model->additions);
+    free(model->watched);
+    free(model->changed);
+    free(model->linked);
+    free(model->dir_buffer);
+    free(model->filesystems);
+    free(model->handles);
+    free(model->root_real);
+    if(model->inotify_fd != -1) close(model->inotify_fd); //the watches are removed with the inotify instance
+    if(model->fanotify_fd != -1) close(model->fanotify_fd); //the same for the marks
+    if(model->root_fd != -1) close(model->root_fd);
+    memset(model, 0, sizeof(*model));
+    model->inotify_fd=-1;
+    model->fanotify_fd=-1;
+    model->root_fd=-1;
+}
+
+
+/*
+    WATCH DIRECTORY FUNCTION
+*/
+static void StopWatching(int signal_number){
+
+    (void)signal_number;
+    watch_stopping=1;
+}
+
+//the statistics printed by CreateSnapshot are counted again for each snapshot written from the model
+static void ResetScanStatistics(void){
+
+    count_directories=0;
+    count_dir_entries=0;
+    count_getdents_calls=0;
+    count_readdir_calls=0;
+    count_excluded_entries=0;
+    count_pruned_dirs=0;
+    count_skipped_mounts=0;
+    count_duplicate_dirs=0;
+    count_snapshot_writes=0;
+    count_snapshot_bytes=0;
+    count_reused_analyses=0;
+    count_hashed_files=0;
+    count_hashed_bytes=0;
+    count_unhashed_files=0;
+    count_cached_hashes=0;
+}
+
+static double ElapsedMilliseconds(const struct timespec *start){
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)*1000.0 + (now.tv_nsec - start->tv_nsec)/1e6;
+}
+
+void WatchDirectory(char *path, char *output_path, char *isolated_path){
+
+    char *dir_name=basename((char *)path);
+    monitored_directory=dir_name;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    WatchModel model;
+    if(StartWatchModel(&model, path, isolated_path) == -1){
+        fprintf(stderr, "*watch_directory* error: Failed to watch the directory (%s)  \"%s\"\n", strerror(errno), dir_name);
+        return;
+    }
+    fprintf(stdout, "(Watching) %zu entries parsed and %ld %s in %g (ms) for  \"%s\"\n", model.count, model.watch_count,
+            model.fanotify_fd != -1 ? "file systems marked" : "directories watched", ElapsedMilliseconds(&start), dir_name);
+    CreateSnapshot(path, output_path, isolated_path, &model);
+    ResetScanStatistics();
+    time_t last_snapshot=time(NULL);
+
+    //SIGINT and SIGTERM set watch_stopping (the handler is installed by main before the fork, without SA_RESTART,
+    //so poll returns)
+    long events=0;
+    struct timespec first_event;
+    while(!watch_stopping || model.changed_count > 0 || model.overflow){
+        //waiting for the first event, then for the rest of the latency
+        int timeout=-1;
+        if(events > 0){
+            double remaining=watch_latency - ElapsedMilliseconds(&first_event);
+            timeout=remaining > 0 ? (int)remaining + 1 : 0;
+        }
+        struct pollfd poll_fd={model.fanotify_fd != -1 ? model.fanotify_fd : model.inotify_fd, POLLIN, 0};
+        int ready=watch_stopping ? 0 : poll(&poll_fd, 1, timeout);
+        if(ready == -1 && errno != EINTR){
+            fprintf(stderr, "*watch_directory* error: poll() failed => Stopping the watch for  \"%s\"\n", dir_name);
+            break;
+        }
+        if(ready > 0){
+            long read_events=ReadWatchEvents(&model);
+            if(read_events == -1){
+                fprintf(stderr, "*watch_directory* error: Failed to read the events => Stopping the watch for  \"%s\"\n", dir_name);
+                break;
+            }
+            if(events == 0 && read_events > 0) clock_gettime(CLOCK_MONOTONIC, &first_event);
+            events+=read_events;
+        }
+        if(events == 0 || (!watch_stopping && ElapsedMilliseconds(&first_event) < watch_latency)) continue;
+
+        //the snapshots are named by the second, so at most one is written each second
+        if(!watch_stopping && time(NULL) == last_snapshot){
+            struct timespec pause={0, 50*1000000L};
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        double latency=ElapsedMilliseconds(&first_event);
+        long changes=ApplyWatchChanges(&model);
+        if(changes == -1){
+            fprintf(stderr, "*watch_directory* error: Failed to update the model => Stopping the watch for  \"%s\"\n", dir_name);
+            break;
+        }
+        if(changes > 0){
+            fprintf(stdout, "(Watching) %ld events => %ld records changed, applied %g (ms) after the first event for  \"%s\"\n", events, changes, latency, dir_name);
+            CreateSnapshot(path, output_path, isolated_path, &model);
+            ResetScanStatistics();
+            last_snapshot=time(NULL);
+        }
+        events=0;
+    }
+
+    fprintf(stdout, "(Watching) Stopped with %zu entries in the model for  \"%s\"\n", model.count, dir_name);
+    StopWatchModel(&model);
+}
+
+
+/*
+    READ MANIFEST FUNCTION
+*/
+int ReadManifest(const char *output_path, const char *dir_name, SnapshotManifest *manifest){
+
+    char manifest_name[PATH_MAX];
+    snprintf(manifest_name, sizeof(manifest_name), "%s/%s_Snapshot.manifest", output_path, dir_name);
+
+    FILE *file=fopen(manifest_name, "r");
+    if(file == NULL) return -1;
+
+    memset(manifest, 0, sizeof(*manifest));
+    char line[NAME_MAX + 32];
+    char format[16]="";
+    unsigned long long records=0, hash=0, tree=0;
+    int fields=0;
+
+    while(fgets(line, sizeof(line), file) != NULL){
+        line[strcspn(line, "\n")]='\0';
+
+        if(strncmp(line, "Snapshot: ", 10) == 0 && strlen(line + 10) < sizeof(manifest->snapshot) && strchr(line + 10, '/') == NULL){
+            strcpy(manifest->snapshot, line + 10);
+            fields++;
+        }
+        else if(sscanf(line, "Format: %15s", format) == 1) fields++;
+        else if(sscanf(line, "Size: %lld bytes", &manifest->size) == 1) fields++;
+        else if(sscanf(line, "Records: %llu", &records) == 1) fields++;
+        else if(sscanf(line, "Hash: %llx", &hash) == 1) fields++;
+        else if(sscanf(line, "Tree: %llx", &tree) == 1) manifest->has_tree=1; //not in the manifests of older versions
+        else if(strcmp(line, "Content Hashes: yes") == 0) manifest->content_hashes=1;
+        else if(strcmp(line, "Journal: yes") == 0) manifest->journal=1;
+    }
+    fclose(file);
+
+    manifest->binary=strcmp(format, "binary") == 0;
+    manifest->records=records;
+    manifest->hash=hash;
+    manifest->tree=tree;
+
+    return fields == 5 && manifest->snapshot[0] != '\0' ? 0 : -1;
+}
+
+
+/*
+    WRITE MANIFEST FUNCTION
+*/
+int WriteManifest(const char *output_path, const char *dir_name, const SnapshotManifest *manifest){
+
+    char manifest_name[PATH_MAX], temp_name[PATH_MAX];
+    snprintf(manifest_name, sizeof(manifest_name), "%s/%s_Snapshot.manifest", output_path, dir_name);
+    snprintf(temp_name, sizeof(temp_name), "%s/%s_Snapshot.manifest.tmp", output_path, dir_name);
+
+    FILE *file=fopen(temp_name, "w");
+    if(file == NULL) return -1;
+
+    fprintf(file, "Snapshot: %s\nFormat: %s\nSize: %lld bytes\nRecords: %llu\nHash: %016llx\n", manifest->snapshot, manifest->binary ? "binary" : "text",
+            manifest->size, (unsigned long long)manifest->records, (unsigned long long)manifest->hash);
+    if(manifest->has_tree) fprintf(file, "Tree: %016llx\n", (unsigned long long)manifest->tree);
+    if(manifest->content_hashes) fprintf(file, "Content Hashes: yes\n");
+    if(manifest->journal) fprintf(file, "Journal: yes\n");
+
+    //the manifest is replaced only if it was written completely (rename replaces it atomically)
+    if(ferror(file) || fclose(file) != 0 || rename(temp_name, manifest_name) == -1){
+        unlink(temp_name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+    FIND PREVIOUS SNAPSHOT FUNCTION
+*/
+int FindPreviousSnapshot(const char *output_path, const char *dir_name, const char *current_name, char *previous_name, size_t size){
+
+    DIR *d=opendir(output_path);
+    if(d == NULL) return -1;
+
+    char prefix[NAME_MAX + 16];
+    size_t prefix_length=snprintf(prefix, sizeof(prefix), "%s_Snapshot_", dir_name);
+    struct dirent *dir_entry;
+    int found=0;
+
+    //the timestamp is at the end of the name, so the newest snapshot has the greatest name
+    while((dir_entry=readdir(d)) != NULL){
+        if(strncmp(dir_entry->d_name, prefix, prefix_length) != 0 || strcmp(dir_entry->d_name, current_name) == 0) continue;
+        if(strlen(dir_entry->d_name) >= size || (found && strcmp(dir_entry->d_name, previous_name) <= 0)) continue;
+
+        strcpy(previous_name, dir_entry->d_name);
+        found=1;
+    }
+    closedir(d);
+
+    return found;
+}
+
+
+/*
+    GET PREVIOUS SNAPSHOT THEN COMPARE FUNCTION
+*/
+void GetPreviousSnapshotThenCompare(const char *output_path, const char *snapshot_file_name, const SnapshotManifest *current, const MerkleTree *tree){
+
+    const char *dir_name=monitored_directory;
+    SnapshotManifest kept=*current; //the manifest written at the end (with the name of the snapshot that is kept)
+
+    //the previous snapshot is the one from the manifest (if it still exists)
+    SnapshotManifest previous;
+    char prev_snapshot_file_name[PATH_MAX];
+    struct stat prev_st;
+    int from_manifest=ReadManifest(output_path, dir_name, &previous) == 0 && strcmp(previous.snapshot, current->snapshot) != 0;
+
+    if(from_manifest){
+        snprintf(prev_snapshot_file_name, sizeof(prev_snapshot_file_name), "%s/%s", output_path, previous.snapshot);
+        from_manifest=stat(prev_snapshot_file_name, &prev_st) == 0 && S_ISREG(prev_st.st_mode);
+    }
+    if(!from_manifest){ //without a manifest => parsing the output directory
+        char previous_name[NAME_MAX + 1];
+        int found=FindPreviousSnapshot(output_path, dir_name, current->snapshot, previous_name, sizeof(previous_name));
+
+        if(found == -1) fprintf(stderr, "*get_prev_snapshot* error: Failed to open the output directory  \"%s\"\n", monitored_directory);
+        if(found != 1){ //if in the folder is not a previous snapshot => no comparison will be made
+            fprintf(stdout, "(Comparing) No snapshots were previously created for  \"%s\"\n", monitored_directory);
+            if(kept.has_tree && WriteMerkleTree(tree, output_path, dir_name) == -1) kept.has_tree=0;
+            if(WriteManifest(output_path, dir_name, &kept) == -1) fprintf(stderr, "*get_prev_snapshot* error: Failed to write the manifest for  \"%s\"\n", monitored_directory);
+            return;
+        }
+        snprintf(prev_snapshot_file_name, sizeof(prev_snapshot_file_name), "%s/%s", output_path, previous_name);
+    }
+
+    //the manifest has the hash of the previous snapshot => the files are not read if they are identical
+    int IsDifferent=-2;
+    if(from_manifest && previous.size == prev_st.st_size && previous.size == current->size && previous.binary == current->binary &&
+       previous.records == current->records && previous.hash == current->hash) IsDifferent=0;
+
+    //the hash trees have the same root => the snapshots have the same entries (even in different formats)
+    //(the trees of the snapshots with and without content hashes are not compared, the files would be reported as modified)
+    else if(from_manifest && previous.has_tree && current->has_tree && previous.content_hashes == current->content_hashes && !diff_mode){
+        MerkleTree prev_tree;
+        if(previous.tree == current->tree) IsDifferent=0;
+        else if(LoadMerkleTree(&prev_tree, output_path, dir_name) == 0){
+            if(((const MerkleFileHeader *)prev_tree.map)->root_hash == previous.tree){ //the tree is the one of the previous snapshot
+                long added=0, removed=0, modified=0, changed=0;
+                long visited=CompareMerkleTrees(&prev_tree, tree, &added, &removed, &modified, &changed);
+                if(added > 0 || removed > 0 || modified > 0 || changed > 0) fprintf(stdout, "(Comparing) %ld entries added, %ld removed and %ld directories modified, the files of %ld directories changed since the previous snapshot (%ld of %zu directories compared with the hash tree) for  \"%s\"\n", added, removed, modified, changed, visited, tree->count - 1, monitored_directory);
+                IsDifferent=1;
+            }
+            FreeMerkleTree(&prev_tree);
+        }
+    }
+    if(IsDifferent == -2) IsDifferent=diff_mode ? DiffSnapshots(prev_snapshot_file_name, snapshot_file_name) : CompareSnapshots(prev_snapshot_file_name, snapshot_file_name);
+
+    //the current snapshot is renamed over the previous one only if it has the same format, so the extension stays right
+    const char *prev_extension=strrchr(prev_snapshot_file_name, '.'), *current_extension=strrchr(snapshot_file_name, '.');
+    int replace=IsDifferent && prev_extension != NULL && current_extension != NULL && strcmp(prev_extension, current_extension) == 0;
+
+    if(!IsDifferent){   //in case no difference is found
+        fprintf(stdout, "(Comparing) No differences found between the current and the previous snapshot for  \"%s\"\n", monitored_directory);
+    }
+    else{
+        fprintf(stdout, "(Comparing) Difference found between the current and the previous snapshot => Overriding the previous snapshot for  \"%s\"\n", monitored_directory);
+        if(replace && rename(snapshot_file_name, prev_snapshot_file_name) == 0){ //renaming the current snapshot (replacing the previous one)
+            strcpy(kept.snapshot, strrchr(prev_snapshot_file_name, '/') + 1);
+        }
+        else replace=0;
+    }
+
+    //the manifest is updated before deleting the previous snapshot, so it never names a file that does not exist
+    //(the tree is saved first, the manifest has the hash of its root)
+    if(kept.has_tree && WriteMerkleTree(tree, output_path, dir_name) == -1) kept.has_tree=0;
+    if(WriteManifest(output_path, dir_name, &kept) == -1) fprintf(stderr, "*get_prev_snapshot* error: Failed to write the manifest for  \"%s\"\n", monitored_directory);
+    if(!replace) unlink(prev_snapshot_file_name); //deleting the previous snapshot file
+}
+
+
+/*
+    LOAD JOURNAL FUNCTION
+*/
+static int CompareJournalEntries(const void *a, const void *b, void *paths){
+
+    const DiffEntry *x=&((const JournalEntry *)a)->record, *y=&((const JournalEntry *)b)->record;
+    int order=ComparePaths((const char *)paths + x->path_offset, x->path_length, (const char *)paths + y->path_offset, y->path_length);
+
+    //the changes of a path are kept in the order of the journal (their paths were appended one after another)
+    if(order == 0) order=x->path_offset < y->path_offset ? -1 : x->path_offset > y->path_offset;
+    return order;
+}
+
+//parses a timestamp of the snapshots and of the journal ("%Y.%m.%d_%H:%M:%S"), returns its end or NULL if it is not valid
+static const char *ParseTimestamp(const char *text, time_t *result){
+
+    struct tm timestamp;
+    memset(&timestamp, 0, sizeof(timestamp));
+    timestamp.tm_isdst=-1;
+
+    const char *end=strptime(text, "%Y.%m.%d_%H:%M:%S", &timestamp);
+    if(end != NULL) *result=mktime(&timestamp);
+    return end;
+}
+
+//parses a line of the journal: returns 1 for a "Run: " line (its time is stored in run), 0 for a change or a field of
+//the last change (in_record is set until the empty line after its fields) and -1 if the line is not valid
+static int ParseJournalLine(LoadedJournal *journal, char *line, size_t line_length, off_t offset, time_t *run, int *in_record){
+
+    long long number;
+    unsigned long long hash;
+    if(*in_record){ //the fields of an entry, until the empty line
+        DiffEntry *record=&journal->entries[journal->count-1].record;
+        if(line_length == 0) *in_record=0;
+        else if(sscanf(line, "Size: %lld bytes", &number) == 1) record->st.st_size=number;
+        else if(line_length == 26 && strncmp(line, "Access Rights: ", 15) == 0){
+            for(int bit=0, position=15; bit < 9; bit++, position++){
+                if(bit == 3 || bit == 6) position++;
+                if(line[position] != '-') record->st.st_mode|=0400 >> bit;
+            }
+        }
+        else if(sscanf(line, "Hard Links: %lld", &number) == 1) record->st.st_nlink=number;
+        else if(line_length == 30 && sscanf(line, "Content Hash: %16llx", &hash) == 1){
+            record->content_hash=hash;
+            record->has_content_hash=1;
+        }
+        else return -1;
+        return 0;
+    }
+
+    if(strncmp(line, "Run: ", 5) == 0){
+        const char *end=ParseTimestamp(line + 5, run);
+        return end != NULL && *end == '\0' ? 1 : -1;
+    }
+
+    int change;
+    size_t label;
+    if(strncmp(line, "Added: ", 7) == 0) change=JOURNAL_ADDED, label=7;
+    else if(strncmp(line, "Modified: ", 10) == 0) change=JOURNAL_MODIFIED, label=10;
+    else if(strncmp(line, "Removed: ", 9) == 0) change=JOURNAL_REMOVED, label=9;
+    else if(line_length == 0) return 0;
+    else return -1;
+
+    if(journal->count == journal->capacity){
+        size_t new_capacity=journal->capacity ? journal->capacity*2 : 256;
+        JournalEntry *new_entries=realloc(journal->entries, new_capacity*sizeof(JournalEntry));
+        if(new_entries == NULL) return -1;
+        journal->entries=new_entries;
+        journal->capacity=new_capacity;
+    }
+    if(ReserveRecordBuffer(&journal->paths, line_length - label + 1) == -1) return -1;
+
+    JournalEntry *new_entry=&journal->entries[journal->count++];
+    memset(new_entry, 0, sizeof(*new_entry));
+    new_entry->change=change;
+    new_entry->run=*run;
+    new_entry->offset=offset;
+    new_entry->record.path_offset=journal->paths.length;
+    new_entry->record.path_length=line_length - label;
+    memcpy(journal->paths.data + journal->paths.length, line + label, line_length - label + 1);
+    journal->paths.length+=line_length - label + 1;
+    *in_record=change != JOURNAL_REMOVED;
+
+    return 0;
+}
+
+int LoadJournal(LoadedJournal *journal, const char *journal_name, const char *base_name, time_t until, int last_only){
+
+    memset(journal, 0, sizeof(*journal));
+
+    FILE *file=fopen(journal_name, "r");
+    if(file == NULL) return errno == ENOENT ? 1 : -1;
+
+    char *line=NULL;
+    size_t line_capacity=0;
+    ssize_t line_length;
+    int result=0, in_record=0;
+    time_t run=0;
+    off_t offset=0;              //offset of the next line
+
+    //the journal of another base is not used
+    if((line_length=getline(&line, &line_capacity, file)) == -1 || strncmp(line, "Base: ", 6) != 0 || strcspn(line + 6, "\n") != strlen(base_name) ||
+       strncmp(line + 6, base_name, strlen(base_name)) != 0) result=1;
+    else offset=line_length;
+
+    while(result == 0 && (line_length=getline(&line, &line_capacity, file)) != -1){
+        off_t line_offset=offset;
+        offset+=line_length;
+        if(line_length > 0 && line[line_length-1] == '\n') line[--line_length]='\0';
+
+        int status=ParseJournalLine(journal, line, line_length, line_offset, &run, &in_record);
+        if(status == 1){
+            if(until != 0 && run > until) break; //the next runs are not read
+            journal->runs++;
+        }
+        else if(status == -1) result=-1;
+    }
+    free(line);
+    fclose(file);
+
+    if(result != 0){
+        FreeLoadedJournal(journal);
+        return result;
+    }
+
+    //sorting by path (in the order of the snapshots) and, with last_only, keeping only the last change of each path
+    if(journal->count > 1) qsort_r(journal->entries, journal->count, sizeof(JournalEntry), CompareJournalEntries, journal->paths.data);
+    if(!last_only) return 0;
+
+    size_t kept=0;
+    for(size_t i=0; i < journal->count; i++){
+        if(kept > 0){
+            const DiffEntry *previous=&journal->entries[kept-1].record, *current=&journal->entries[i].record;
+            if(previous->path_length == current->path_length && memcmp(journal->paths.data + previous->path_offset, journal->paths.data + current->path_offset, current->path_length) == 0){
+                journal->entries[kept-1]=journal->entries[i];
+                continue;
+            }
+        }
+        journal->entries[kept++]=journal->entries[i];
+    }
+    journal->count=kept;
+
+    return 0;
+}
+
+
+/*
+    FREE LOADED JOURNAL FUNCTION
+*/
+void FreeLoadedJournal(LoadedJournal *journal){
+
+    free(journal->entries);
+    free(journal->paths.data);
+    memset(journal, 0, sizeof(*journal));
+}
+
+
+/*
+    RESET JOURNAL FUNCTION
+*/
+int ResetJournal(const char *journal_name, const char *base_name){
+
+    char temp_name[PATH_MAX];
+    snprintf(temp_name, sizeof(temp_name), "%s.tmp", journal_name);
+
+    FILE *file=fopen(temp_name, "w");
+    if(file == NULL) return -1;
+    fprintf(file, "Base: %s\n", base_name);
+
+    if(ferror(file) || fclose(file) != 0 || rename(temp_name, journal_name) == -1){
+        unlink(temp_name);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+    WRITE BASE SNAPSHOT FUNCTION
+*/
+int WriteBaseSnapshot(int snapshot_fd, const char *file_name){
+
+    struct stat st;
+    if(fstat(snapshot_fd, &st) == -1) return -1;
+
+    int fd=open(file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(fd == -1) return -1;
+
+    //the data is copied by the kernel (without a buffer in the process)
+    off_t offset=0;
+    int result=0;
+    while(offset < st.st_size){
+        ssize_t copied=sendfile(fd, snapshot_fd, &offset, st.st_size - offset);
+        if(copied == -1 && errno == EINTR) continue;
+        if(copied <= 0){
+            result=-1;
+            break;
+        }
+        count_snapshot_bytes+=copied;
+    }
+    if(result == 0 && fdatasync(fd) == -1) result=-1;
+    if(close(fd) == -1) result=-1;
+    if(result == -1) unlink(file_name);
+
+    return result;
+}
+
+
+/*
+    APPEND JOURNAL RECORD FUNCTION (the record of the snapshot with the change instead of "Path: ")
+*/
+static int AppendJournalRecord(RecordBuffer *changes, RecordBuffer *record, int change, const char *path, size_t path_length, const struct stat *st, const uint64_t *content_hash){
+
+    const char *labels[]={"Added: ", "Modified: ", "Removed: "};
+    size_t label_length=strlen(labels[change]);
+
+    if(change == JOURNAL_REMOVED){
+        if(ReserveRecordBuffer(changes, label_length + path_length + 2) == -1) return -1;
+        memcpy(changes->data + changes->length, labels[change], label_length);
+        memcpy(changes->data + changes->length + label_length, path, path_length);
+        changes->length+=label_length + path_length;
+        changes->data[changes->length++]='\n';
+        changes->data[changes->length++]='\n';
+        return 0;
+    }
+
+    record->length=0;
+    if(EncodeSnapshotRecord(record, path, path_length, st, content_hash) == -1 || ReserveRecordBuffer(changes, label_length + record->length) == -1) return -1;
+    memcpy(changes->data + changes->length, labels[change], label_length);
+    memcpy(changes->data + changes->length + label_length, record->data + 6, record->length - 6);
+    changes->length+=label_length + record->length - 6;
+
+    return 0;
+}
+
+
+/*
+    OPEN JOURNAL STATE FUNCTION
+*/
+int OpenJournalState(JournalState *state, const char *base_file_name, const LoadedJournal *journal){
+
+    memset(state, 0, sizeof(*state));
+    if(OpenSnapshotCursor(&state->base, base_file_name) == -1) return -1;
+
+    state->journal=journal;
+    state->base_status=NextSnapshotRecord(&state->base);
+
+    return 0;
+}
+
+
+/*
+    NEXT JOURNAL STATE FUNCTION
+*/
+int NextJournalState(JournalState *state){
+
+    const LoadedJournal *journal=state->journal;
+    if(state->advance_base){
+        state->base_status=NextSnapshotRecord(&state->base);
+        state->advance_base=0;
+    }
+
+    while(state->base_status != -1 && state->base.sorted){
+        //the next change from the journal comes first if its path is not after the path of the base (the same path =>
+        //the record of the base is replaced by the change)
+        const JournalEntry *change=state->next < journal->count ? &journal->entries[state->next] : NULL;
+        int order=1;
+        if(change != NULL && state->base_status == 1) order=ComparePaths(state->base.path.data, state->base.path.length, journal->paths.data + change->record.path_offset, change->record.path_length);
+        if(change != NULL && order >= 0){
+            state->next++;
+            if(order == 0) state->base_status=NextSnapshotRecord(&state->base);
+            if(change->change == JOURNAL_REMOVED) continue;
+            state->path=journal->paths.data + change->record.path_offset;
+            state->path_length=change->record.path_length;
+            state->entry=change->record;
+            return 1;
+        }
+        if(state->base_status == 0) return 0;
+
+        state->path=state->base.path.data;
+        state->path_length=state->base.path.length;
+        memset(&state->entry, 0, sizeof(state->entry));
+        state->entry.st=state->base.st;
+        state->entry.content_hash=state->base.content_hash;
+        state->entry.has_content_hash=state->base.has_content_hash;
+        state->advance_base=1;
+        return 1;
+    }
+
+    return -1;
+}
+
+
+/*
+    CLOSE JOURNAL STATE FUNCTION
+*/
+void CloseJournalState(JournalState *state){
+
+    CloseSnapshotCursor(&state->base);
+}
+
+
+/*
+    UPDATE JOURNAL FUNCTION
+*/
+void UpdateJournal(const char *output_path, int snapshot_fd, const SnapshotManifest *current){
+
+    const char *dir_name=monitored_directory;
+    char journal_name[PATH_MAX], base_file_name[PATH_MAX], current_file_name[64];
+    snprintf(journal_name, sizeof(journal_name), "%s/%s_Snapshot.journal", output_path, dir_name);
+    snprintf(current_file_name, sizeof(current_file_name), "/proc/self/fd/%d", snapshot_fd);
+
+    SnapshotManifest previous, kept=*current;
+    kept.journal=1;
+    kept.has_tree=0; //the tree is not saved (it would be written entirely in every scan)
+
+    //the first scan (or the first one with "--journal", or after the base was deleted) => a new base
+    int has_base=ReadManifest(output_path, dir_name, &previous) == 0 && previous.journal;
+    struct stat base_st;
+    if(has_base){
+        snprintf(base_file_name, sizeof(base_file_name), "%s/%s", output_path, previous.snapshot);
+        has_base=stat(base_file_name, &base_st) == 0 && S_ISREG(base_st.st_mode);
+    }
+    if(!has_base){
+        snprintf(base_file_name, sizeof(base_file_name), "%s/%s", output_path, current->snapshot);
+        if(WriteBaseSnapshot(snapshot_fd, base_file_name) == -1 || WriteManifest(output_path, dir_name, &kept) == -1 || ResetJournal(journal_name, current->snapshot) == -1){
+            fprintf(stderr, "*update_journal* error: Failed to write the base snapshot for  \"%s\"\n", monitored_directory);
+            return;
+        }
+        fprintf(stdout, "(Journal) Base snapshot written => the next scans append only their changes for  \"%s\"\n", monitored_directory);
+        return;
+    }
+
+    //the same snapshot as in the previous scan => nothing is written
+    if(previous.size == current->size && previous.binary == current->binary && previous.records == current->records && previous.hash == current->hash){
+        fprintf(stdout, "(Comparing) No differences found between the current and the previous snapshot for  \"%s\"\n", monitored_directory);
+        return;
+    }
+
+    //a journal that can't be read is replaced by a new base (compacted below), a journal of another base (left by an
+    //interrupted compaction) is archived or replaced by an empty one before the changes are appended
+    LoadedJournal journal;
+    int journal_status=LoadJournal(&journal, journal_name, previous.snapshot, 0, 1);
+    if(journal_status == -1){
+        fprintf(stderr, "*update_journal* error: The journal is not valid => writing a new base snapshot for  \"%s\"\n", monitored_directory);
+        journal.runs=-1;
+    }
+    else if(journal_status == 1){
+        if(history_generations > 0 && access(journal_name, F_OK) == 0) ArchiveJournal(output_path, dir_name, journal_name);
+        if(ResetJournal(journal_name, previous.snapshot) == -1) journal.runs=-1;
+    }
+
+    JournalState state;
+    SnapshotCursor scan;
+    if(OpenJournalState(&state, base_file_name, &journal) == -1){
+        fprintf(stderr, "*update_journal* error: Failed to open the base snapshot for  \"%s\"\n", monitored_directory);
+        FreeLoadedJournal(&journal);
+        return;
+    }
+    if(OpenSnapshotCursor(&scan, current_file_name) == -1){
+        fprintf(stderr, "*update_journal* error: Failed to open the current snapshot for  \"%s\"\n", monitored_directory);
+        CloseJournalState(&state);
+        FreeLoadedJournal(&journal);
+        return;
+    }
+
+    //the previous state (the base with the changes from the journal) is merged with the current snapshot
+    RecordBuffer changes={NULL, 0, 0}, record={NULL, 0, 0};
+    long added=0, removed=0, modified=0;
+    int prev_status=NextJournalState(&state), scan_status=NextSnapshotRecord(&scan), failed=0;
+
+    while(!failed && prev_status != -1 && scan_status != -1 && (prev_status == 1 || scan_status == 1)){
+        int order=prev_status != 1 ? -1 : scan_status != 1 ? 1 : ComparePaths(scan.path.data, scan.path.length, state.path, state.path_length);
+
+        if(order < 0){
+            if(AppendJournalRecord(&changes, &record, JOURNAL_ADDED, scan.path.data, scan.path.length, &scan.st, scan.has_content_hash ? &scan.content_hash : NULL) == -1) failed=1;
+            if(diff_mode) fprintf(stdout, "(Diff) Added     \"%s\"\n", scan.path.data);
+            added++;
+            scan_status=NextSnapshotRecord(&scan);
+        }
+        else if(order > 0){
+            if(AppendJournalRecord(&changes, &record, JOURNAL_REMOVED, state.path, state.path_length, NULL, NULL) == -1) failed=1;
+            if(diff_mode) fprintf(stdout, "(Diff) Removed   \"%.*s\"\n", (int)state.path_length, state.path);
+            removed++;
+            prev_status=NextJournalState(&state);
+        }
+        else{
+            DiffEntry prev_entry=state.entry, scan_entry;
+            memset(&scan_entry, 0, sizeof(scan_entry));
+            scan_entry.st=scan.st;
+            scan_entry.content_hash=scan.content_hash;
+            scan_entry.has_content_hash=scan.has_content_hash;
+            prev_entry.st.st_mode&=0777; //the journal has only the access rights (like the text format)
+            scan_entry.st.st_mode&=0777;
+
+            char description[256];
+            if(DescribeChanges(description, sizeof(description), &prev_entry, &scan_entry) > 0){
+                if(AppendJournalRecord(&changes, &record, JOURNAL_MODIFIED, scan.path.data, scan.path.length, &scan.st, scan.has_content_hash ? &scan.content_hash : NULL) == -1) failed=1;
+                if(diff_mode) fprintf(stdout, "(Diff) Modified  \"%s\"  (%s)\n", scan.path.data, description);
+                modified++;
+            }
+            prev_status=NextJournalState(&state);
+            scan_status=NextSnapshotRecord(&scan);
+        }
+    }
+    if(prev_status == -1 || scan_status == -1 || !scan.sorted) failed=1;
+    CloseJournalState(&state);
+    CloseSnapshotCursor(&scan);
+    free(record.data);
+
+    if(failed){
+        fprintf(stderr, "*update_journal* error: Failed to compare the snapshots => writing a new base snapshot for  \"%s\"\n", monitored_directory);
+        journal.runs=-1;
+    }
+    else if(added > 0 || removed > 0 || modified > 0){
+        fprintf(stdout, "(Comparing) %ld entries added, %ld removed and %ld modified since the previous snapshot for  \"%s\"\n", added, removed, modified, monitored_directory);
+    }
+    else fprintf(stdout, "(Comparing) No differences found between the current and the previous snapshot for  \"%s\"\n", monitored_directory);
+
+    //the changes are appended with one write (and synced before the manifest is updated)
+    struct stat journal_st;
+    if(!failed && changes.length > 0){
+        //the time of the run is the time of the scan (from the name of the snapshot, like the time of the bases)
+        char run[64];
+        const char *scan_time=current->snapshot + strlen(dir_name) + strlen("_Snapshot_");
+        int run_length=snprintf(run, sizeof(run), "Run: %.*s\n", (int)(strrchr(current->snapshot, '.') - scan_time), scan_time);
+
+        int fd=open(journal_name, O_WRONLY | O_APPEND | O_CLOEXEC);
+        struct iovec iov[2]={{run, run_length}, {changes.data, changes.length}};
+        if(fd == -1 || WriteAllBuffers(fd, iov, 2) == -1 || fdatasync(fd) == -1){
+            fprintf(stderr, "*update_journal* error: Failed to append to the journal => writing a new base snapshot for  \"%s\"\n", monitored_directory);
+            journal.runs=-1;
+        }
+        if(fd != -1) close(fd);
+    }
+    free(changes.data);
+
+    //a journal bigger than journal_compaction% of the base is compacted: the current snapshot becomes the new base
+    int compact=journal.runs == -1 || (stat(journal_name, &journal_st) == 0 && journal_st.st_size*100 > base_st.st_size*(long long)journal_compaction);
+    FreeLoadedJournal(&journal);
+    if(!compact){
+        snprintf(kept.snapshot, sizeof(kept.snapshot), "%s", previous.snapshot);
+        if(WriteManifest(output_path, dir_name, &kept) == -1) fprintf(stderr, "*update_journal* error: Failed to write the manifest for  \"%s\"\n", monitored_directory);
+        return;
+    }
+
+    //the new base is written before the manifest and the journal is archived or emptied after it, so after a crash the
+    //manifest names a complete base and a journal of another base is not applied
+    char new_base_name[PATH_MAX];
+    snprintf(new_base_name, sizeof(new_base_name), "%s/%s", output_path, current->snapshot);
+    if(strcmp(current->snapshot, previous.snapshot) == 0 || WriteBaseSnapshot(snapshot_fd, new_base_name) == -1 || WriteManifest(output_path, dir_name, &kept) == -1){
+        fprintf(stderr, "*update_journal* error: Failed to write the new base snapshot for  \"%s\"\n", monitored_directory);
+        return;
+    }
+    int archived=history_generations > 0 && ArchiveJournal(output_path, dir_name, journal_name) == 0;
+    if(ResetJournal(journal_name, current->snapshot) == -1) fprintf(stderr, "*update_journal* error: Failed to empty the journal for  \"%s\"\n", monitored_directory);
+    if(!archived) unlink(base_file_name);
+    fprintf(stdout, "(Journal) The journal was compacted into a new base snapshot%s for  \"%s\"\n", archived ? " (the previous base and its journal were kept in the history)" : "", monitored_directory);
+}
+
+
+/*
+    LIST HISTORY FUNCTION
+*/
+static int CompareGenerations(const void *a, const void *b){
+
+    const HistoryGeneration *x=a, *y=b;
+    if(x->time != y->time) return x->time < y->time ? -1 : 1;
+    return strcmp(x->base, y->base);
+}
+
+long ListHistory(const char *output_path, const char *dir_name, HistoryGeneration **generations){
+
+    *generations=NULL;
+    DIR *d=opendir(output_path);
+    if(d == NULL) return -1;
+
+    //the base of the current journal (from the manifest)
+    SnapshotManifest manifest;
+    int has_journal=ReadManifest(output_path, dir_name, &manifest) == 0 && manifest.journal;
+
+    char prefix[NAME_MAX + 16];
+    size_t prefix_length=snprintf(prefix, sizeof(prefix), "%s_Snapshot_", dir_name);
+    long count=0, capacity=0;
+    struct dirent *dir_entry;
+
+    //every snapshot is a keyframe (the timestamp of its name is the time of the scan)
+    while((dir_entry=readdir(d)) != NULL){
+        const char *name=dir_entry->d_name, *end;
+        time_t time;
+        if(strncmp(name, prefix, prefix_length) != 0 || (end=ParseTimestamp(name + prefix_length, &time)) == NULL ||
+           (strcmp(end, ".txt") != 0 && strcmp(end, ".bin") != 0)) continue;
+
+        if(count == capacity){
+            long new_capacity=capacity ? capacity*2 : 16;
+            HistoryGeneration *new_generations=realloc(*generations, new_capacity*sizeof(HistoryGeneration));
+            if(new_generations == NULL){
+                closedir(d);
+                free(*generations);
+                *generations=NULL;
+                return -1;
+            }
+            *generations=new_generations;
+            capacity=new_capacity;
+        }
+        HistoryGeneration *generation=&(*generations)[count++];
+        memset(generation, 0, sizeof(*generation));
+        snprintf(generation->base, sizeof(generation->base), "%s", name);
+        generation->time=time;
+
+        //its journal: archived (with an index) or the current journal
+        int stem_length=(int)(end - name);
+        char journal_name[PATH_MAX], index_name[PATH_MAX];
+        snprintf(journal_name, sizeof(journal_name), "%s/%.*s.journal", output_path, stem_length, name);
+        snprintf(index_name, sizeof(index_name), "%s/%.*s.index", output_path, stem_length, name);
+        if(access(journal_name, F_OK) == 0 && access(index_name, F_OK) == 0){
+            snprintf(generation->journal, sizeof(generation->journal), "%.*s.journal", stem_length, name);
+            generation->archived=1;
+        }
+        else if(has_journal && strcmp(name, manifest.snapshot) == 0) snprintf(generation->journal, sizeof(generation->journal), "%s_Snapshot.journal", dir_name);
+    }
+    closedir(d);
+
+    if(count > 0) qsort(*generations, count, sizeof(HistoryGeneration), CompareGenerations);
+    return count;
+}
+
+
+/*
+    ARCHIVE JOURNAL FUNCTION
+*/
+int ArchiveJournal(const char *output_path, const char *dir_name, const char *journal_name){
+
+    //the generation has the name of the base of the journal (from its first line)
+    char base_name[NAME_MAX + 1]="";
+    FILE *file=fopen(journal_name, "r");
+    if(file == NULL) return -1;
+    char *line=NULL;
+    size_t line_capacity=0;
+    if(getline(&line, &line_capacity, file) > 6 && strncmp(line, "Base: ", 6) == 0){
+        line[strcspn(line, "\n")]='\0';
+        snprintf(base_name, sizeof(base_name), "%s", line + 6);
+    }
+    free(line);
+    fclose(file);
+
+    const char *extension=strrchr(base_name, '.');
+    if(extension == NULL || strchr(base_name, '/') != NULL) return -1;
+
+    int stem_length=(int)(extension - base_name);
+    char base_file_name[PATH_MAX], index_name[PATH_MAX], temp_name[PATH_MAX + 8], archived_name[PATH_MAX];
+    snprintf(base_file_name, sizeof(base_file_name), "%s/%s", output_path, base_name);
+    snprintf(index_name, sizeof(index_name), "%s/%.*s.index", output_path, stem_length, base_name);
+    snprintf(temp_name, sizeof(temp_name), "%s.tmp", index_name);
+    snprintf(archived_name, sizeof(archived_name), "%s/%.*s.journal", output_path, stem_length, base_name);
+
+    //a journal without its base is not kept
+    LoadedJournal journal;
+    if(access(base_file_name, F_OK) == -1 || LoadJournal(&journal, journal_name, base_name, 0, 0) != 0) return -1;
+
+    //the index has every change sorted by path (the changes of a path in the order of the runs), it is written before
+    //the journal is renamed, so an archived journal always has its index
+    FILE *index=fopen(temp_name, "w");
+    if(index == NULL){
+        FreeLoadedJournal(&journal);
+        return -1;
+    }
+    fprintf(index, "Base: %s\n", base_name);
+    for(size_t i=0; i < journal.count; i++){
+        const JournalEntry *entry=&journal.entries[i];
+        fprintf(index, "%lld %lld %s\n", (long long)entry->offset, (long long)entry->run, journal.paths.data + entry->record.path_offset);
+    }
+    FreeLoadedJournal(&journal);
+
+    int result=ferror(index) || fflush(index) != 0 || fdatasync(fileno(index)) == -1 ? -1 : 0;
+    if(fclose(index) != 0) result=-1;
+    if(result == 0 && rename(temp_name, index_name) == -1) result=-1;
+    if(result == -1){
+        unlink(temp_name);
+        return -1;
+    }
+    if(rename(journal_name, archived_name) == -1){
+        unlink(index_name);
+        return -1;
+    }
+
+    //the oldest archived generations over history_generations are deleted
+    HistoryGeneration *generations;
+    long count=ListHistory(output_path, dir_name, &generations), archived=0;
+    for(long i=0; i < count; i++) archived+=generations[i].archived;
+    for(long i=0; i < count && archived > history_generations; i++){
+        if(!generations[i].archived) continue;
+        char name[PATH_MAX];
+        stem_length=(int)(strrchr(generations[i].base, '.') - generations[i].base);
+        snprintf(name, sizeof(name), "%s/%s", output_path, generations[i].base);
+        unlink(name);
+        snprintf(name, sizeof(name), "%s/%.*s.index", output_path, stem_length, generations[i].base);
+        unlink(name);
+        snprintf(name, sizeof(name), "%s/%s", output_path, generations[i].journal);
+        unlink(name);
+        archived--;
+    }
+    free(generations);
+
+    return 0;
+}
+
+
+/*
+    REBUILD SNAPSHOT AT FUNCTION
+*/
+int RebuildSnapshotAt(const char *output_path, const char *dir_name, const char *timestamp, const char *output_file_name){
+
+    time_t at;
+    const char *end=ParseTimestamp(timestamp, &at);
+    if(end == NULL || *end != '\0'){
+        fprintf(stderr, "*rebuild_snapshot* error: Invalid time (YYYY.MM.DD_HH:MM:SS)  \"%s\"\n", timestamp);
+        return -1;
+    }
+
+    //the latest keyframe made until the given time (the generations are sorted by time)
+    HistoryGeneration *generations;
+    long count=ListHistory(output_path, dir_name, &generations), chosen=-1;
+    for(long i=0; i < count && generations[i].time <= at; i++) chosen=i;
+    if(chosen == -1){
+        fprintf(stderr, "*rebuild_snapshot* error: No snapshot was created until %s for  \"%s\"\n", timestamp, dir_name);
+        free(generations);
+        return -1;
+    }
+    HistoryGeneration generation=generations[chosen];
+    free(generations);
+
+    //only the runs of its journal made until the given time are read
+    char base_file_name[PATH_MAX], journal_name[PATH_MAX];
+    snprintf(base_file_name, sizeof(base_file_name), "%s/%s", output_path, generation.base);
+    LoadedJournal journal;
+    memset(&journal, 0, sizeof(journal));
+    if(generation.journal[0] != '\0'){
+        snprintf(journal_name, sizeof(journal_name), "%s/%s", output_path, generation.journal);
+        if(LoadJournal(&journal, journal_name, generation.base, at, 1) == -1){
+            fprintf(stderr, "*rebuild_snapshot* error: Failed to load the journal  \"%s\"\n", journal_name);
+            return -1;
+        }
+    }
+
+    JournalState state;
+    if(OpenJournalState(&state, base_file_name, &journal) == -1){
+        fprintf(stderr, "*rebuild_snapshot* error: Failed to open the snapshot file  \"%s\"\n", base_file_name);
+        FreeLoadedJournal(&journal);
+        return -1;
+    }
+    int output_fd=open(output_file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(output_fd == -1){
+        fprintf(stderr, "*rebuild_snapshot* error: Failed to create the output file  \"%s\"\n", output_file_name);
+        CloseJournalState(&state);
+        FreeLoadedJournal(&journal);
+        return -1;
+    }
+
+    //the snapshot has the format and the filters of the keyframe (in the text format the filters are written before the records)
+    SnapshotWriter writer;
+    OpenSnapshotWriter(&writer, output_fd, output_file_name, state.base.binary, state.base.filters_data, state.base.filters_length);
+    int result=0;
+    if(!state.base.binary && state.base.filters_length > 0) result=WriteSnapshotData(&writer, state.base.filters_data, state.base.filters_length);
+
+    int status;
+    while(result == 0 && (status=NextJournalState(&state)) != 0){
+        if(status == -1){
+            fprintf(stderr, "*rebuild_snapshot* error: Failed to read the snapshot file  \"%s\"\n", base_file_name);
+            result=-1;
+        }
+        else result=AppendSnapshotRecord(&writer, state.path, state.path_length, &state.entry.st, state.entry.has_content_hash ? &state.entry.content_hash : NULL);
+    }
+
+    if(CloseSnapshotWriter(&writer) == -1) result=-1;
+    close(output_fd);
+    CloseJournalState(&state);
+    if(result == 0) fprintf(stdout, "(History) The snapshot at %s was rebuilt from  \"%s\"  and %ld runs of its journal for  \"%s\"\n", timestamp, generation.base, journal.runs, dir_name);
+    FreeLoadedJournal(&journal);
+
+    return result;
+}
+
+
+/*
+    PRINT PATH HISTORY FUNCTION
+*/
+//reads the change found at an offset of a journal (from its index)
+static int ReadJournalRecord(LoadedJournal *journal, FILE *file, off_t offset, time_t run, char **line, size_t *line_capacity){
+
+    if(fseeko(file, offset, SEEK_SET) == -1) return -1;
+
+    size_t count=journal->count;
+    int in_record=0;
+    do{
+        ssize_t line_length=getline(line, line_capacity, file);
+        if(line_length == -1) return -1;
+        if(line_length > 0 && (*line)[line_length-1] == '\n') (*line)[--line_length]='\0';
+        if(ParseJournalLine(journal, *line, line_length, offset, &run, &in_record) != 0) return -1;
+    }while(in_record);
+
+    return journal->count == count + 1 ? 0 : -1;
+}
+
+long PrintPathHistory(const char *output_path, const char *dir_name, const char *path){
+
+    HistoryGeneration *generations;
+    long count=ListHistory(output_path, dir_name, &generations);
+    if(count == -1){
+        fprintf(stderr, "*path_history* error: Failed to read the output directory  \"%s\"\n", output_path);
+        return -1;
+    }
+
+    size_t path_length=strlen(path);
+    long changes=0;
+    char *line=NULL;
+    size_t line_capacity=0;
+    int failed=0;
+
+    //the generations are read in the order of time, so the changes are printed in the order of the runs
+    for(long i=0; i < count && !failed; i++){
+        if(generations[i].journal[0] == '\0') continue;
+        char journal_name[PATH_MAX];
+        snprintf(journal_name, sizeof(journal_name), "%s/%s", output_path, generations[i].journal);
+
+        LoadedJournal journal;
+        memset(&journal, 0, sizeof(journal));
+        if(!generations[i].archived){
+            //the current journal has no index (it is read entirely)
+            if(LoadJournal(&journal, journal_name, generations[i].base, 0, 0) == -1) failed=1;
+        }
+        else{
+            //the index is sorted by path, so it is read only until the path, and only its records are read from the journal
+            char index_name[PATH_MAX];
+            snprintf(index_name, sizeof(index_name), "%s/%.*s.index", output_path, (int)(strrchr(generations[i].base, '.') - generations[i].base), generations[i].base);
+            FILE *index=fopen(index_name, "r"), *file=fopen(journal_name, "r");
+            if(index == NULL || file == NULL) failed=1;
+
+            ssize_t line_length;
+            while(!failed && (line_length=getline(&line, &line_capacity, index)) != -1){
+                if(line_length > 0 && line[line_length-1] == '\n') line[--line_length]='\0';
+                long long offset, run;
+                int start;
+                if(strncmp(line, "Base: ", 6) == 0) continue;
+                if(sscanf(line, "%lld %lld %n", &offset, &run, &start) != 2){
+                    failed=1;
+                    break;
+                }
+                int order=ComparePaths(line + start, line_length - start, path, path_length);
+                if(order > 0) break;
+                if(order == 0 && ReadJournalRecord(&journal, file, offset, run, &line, &line_capacity) == -1) failed=1;
+            }
+            if(index != NULL) fclose(index);
+            if(file != NULL) fclose(file);
+        }
+        if(failed){
+            fprintf(stderr, "*path_history* error: Failed to read the journal  \"%s\"\n", journal_name);
+            FreeLoadedJournal(&journal);
+            break;
+        }
+
+        for(size_t j=0; j < journal.count; j++){
+            const JournalEntry *entry=&journal.entries[j];
+            if(entry->record.path_length != path_length || memcmp(journal.paths.data + entry->record.path_offset, path, path_length) != 0) continue;
+
+            const char *labels[]={"Added", "Modified", "Removed"};
+            char run[32];
+            strftime(run, sizeof(run), "%Y.%m.%d_%H:%M:%S", localtime(&entry->run));
+            if(entry->change == JOURNAL_REMOVED) fprintf(stdout, "(History) %s  %-8s  \"%s\"\n", run, labels[entry->change], path);
+            else{
+                char hash[40]="";
+                if(entry->record.has_content_hash) snprintf(hash, sizeof(hash), ", content hash %016llx", (unsigned long long)entry->record.content_hash);
+                fprintf(stdout, "(History) %s  %-8s  \"%s\"  (size %lld, access rights %.11s, hard links %lu%s)\n", run, labels[entry->change], path,
+                        (long long)entry->record.st.st_size, permission_strings[entry->record.st.st_mode & 0777], (unsigned long)entry->record.st.st_nlink, hash);
+            }
+            changes++;
+        }
+        FreeLoadedJournal(&journal);
+    }
+    free(line);
+    free(generations);
+
+    if(failed) return -1;
+    if(changes == 0) fprintf(stdout, "(History) No changes of  \"%s\"  were found in the journals of  \"%s\"\n", path, dir_name);
+    return changes;
+}
+
+
+/*
+    STREAM COMPARE SNAPSHOTS FUNCTION
+*/
+int StreamCompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, int print_changes){
+
+    SnapshotCursor current, prev;
+    if(OpenSnapshotCursor(&current, current_snapshot_file_name) == -1){ //opening the current snapshot file
+        fprintf(stderr, "*stream_compare_snapshots* error: Failed to open the current snapshot file for  \"%s\"\n", monitored_directory);
+        return -1;
+    }
+    if(OpenSnapshotCursor(&prev, prev_snapshot_file_name) == -1){ //opening the previous snapshot file
+        fprintf(stderr, "*stream_compare_snapshots* error: Failed to open the previous snapshot file for  \"%s\"\n", monitored_directory);
+        CloseSnapshotCursor(&current);
+        return -1;
+    }
+
+    long added=0, removed=0, modified=0;
+    char changes[256];
+    int prev_status=NextSnapshotRecord(&prev);
+    int current_status=NextSnapshotRecord(&current);
+
+    while((prev_status == 1 || current_status == 1) && prev.sorted && current.sorted){
+        int order;
+        if(prev_status != 1) order=1;
+        else if(current_status != 1) order=-1;
+        else order=ComparePaths(prev.path.data, prev.path.length, current.path.data, current.path.length);
+
+        if(order < 0){          //only in the previous snapshot => removed
+            if(print_changes) fprintf(stdout, "(Diff) Removed   \"%s\"\n", prev.path.data);
+            removed++;
+            prev_status=NextSnapshotRecord(&prev);
+        }
+        else if(order > 0){     //only in the current snapshot => added
+            if(print_changes) fprintf(stdout, "(Diff) Added     \"%s\"\n", current.path.data);
+            added++;
+            current_status=NextSnapshotRecord(&current);
+        }
+        else{                   //in both snapshots => checking the fields recorded by the text format (and the type)
+            DiffEntry prev_entry, current_entry;
+            memset(&prev_entry, 0, sizeof(prev_entry));
+            memset(&current_entry, 0, sizeof(current_entry));
+            prev_entry.st=prev.st;
+            prev_entry.content_hash=prev.content_hash;
+            prev_entry.has_content_hash=prev.has_content_hash;
+            current_entry.st=current.st;
+            current_entry.content_hash=current.content_hash;
+            current_entry.has_content_hash=current.has_content_hash;
+
+            if(DescribeChanges(changes, sizeof(changes), &prev_entry, &current_entry) > 0){
+                if(print_changes) fprintf(stdout, "(Diff) Modified  \"%s\"  (%s)\n", current.path.data, changes);
+                modified++;
+            }
+            prev_status=NextSnapshotRecord(&prev);
+            current_status=NextSnapshotRecord(&current);
+        }
+    }
+
+    int IsDifferent=added > 0 || removed > 0 || modified > 0 || prev.filters_length != current.filters_length ||
+                    (prev.filters_length > 0 && memcmp(prev.filters_data, current.filters_data, prev.filters_length) != 0);
+
+    if(prev_status == -1 || current_status == -1){
+        fprintf(stderr, "*stream_compare_snapshots* error: The %s snapshot file is not valid for  \"%s\"\n", prev_status == -1 ? "previous" : "current", monitored_directory);
+        IsDifferent=-1;
+    }
+    else if(!prev.sorted || !current.sorted){ //a snapshot created by an older version (in the order of getdents64)
+        fprintf(stdout, "(Comparing) The %s snapshot is not sorted by path => its records are sorted before comparing for  \"%s\"\n", !prev.sorted ? "previous" : "current", monitored_directory);
+        IsDifferent=-2;
+    }
+    else if(added > 0 || removed > 0 || modified > 0) fprintf(stdout, "(Comparing) %ld entries added, %ld removed and %ld modified since the previous snapshot for  \"%s\"\n", added, removed, modified, monitored_directory);
+
+    CloseSnapshotCursor(&current);
+    CloseSnapshotCursor(&prev);
+
+    return IsDifferent;
+}
+
+
+/*
+    COMPARE SNAPSHOTS FUNCTION
+*/
+int CompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name){
+
+    //identical files are detected without parsing the records
+    off_t first_difference;
+    int bytes_status=CompareSnapshotBytes(prev_snapshot_file_name, current_snapshot_file_name, &first_difference);
+    if(bytes_status == 0) return 0;
+    if(bytes_status == 1 && first_difference != -1) fprintf(stdout, "(Comparing) The snapshots have the same size and differ from the byte %lld for  \"%s\"\n", (long long)first_difference, monitored_directory);
+
+    //two identical binary snapshots are detected by comparing their tables directly
+    if(IsBinarySnapshot(prev_snapshot_file_name) == 1 && IsBinarySnapshot(current_snapshot_file_name) == 1 && 
+       CompareBinarySnapshots(prev_snapshot_file_name, current_snapshot_file_name) == 0) return 0;
+
+    //the shards of sorted snapshots are compared by several threads (an unsorted snapshot is compared below)
+    if(compare_threads > 1){
+        int IsDifferent=ParallelCompareSnapshots(prev_snapshot_file_name, current_snapshot_file_name, 0);
+        if(IsDifferent != -2) return IsDifferent;
+    }
+
+    //the records of both snapshots are sorted by path => they are merged in a single pass (like merging two sorted lists),
+    //a snapshot created by an older version (in the order of getdents64) is compared again through an external sort
+    int IsDifferent=StreamCompareSnapshots(prev_snapshot_file_name, current_snapshot_file_name, 0);
+    if(IsDifferent == -2) IsDifferent=SortMergeSnapshots(prev_snapshot_file_name, current_snapshot_file_name, compare_memory ? compare_memory : DEFAULT_COMPARE_MEMORY, 0);
+
+    return IsDifferent;
+}
+
+
+/*
+    OPEN SORTED SNAPSHOT FUNCTION
+*/
+static int CompareSortRecords(const void *a, const void *b, void *paths){
+
+    const SortRecord *x=a, *y=b;
+    return ComparePaths((const char *)paths + x->path_offset, x->path_length, (const char *)paths + y->path_offset, y->path_length);
+}
+
+//adds a run file to the sorted snapshot
+static RunReader *AddRunReader(SortedSnapshot *snapshot, int fd){
+
+    RunReader *new_runs=realloc(snapshot->runs, (snapshot->run_count + 1)*sizeof(RunReader));
+    if(new_runs == NULL) return NULL;
+    snapshot->runs=new_runs;
+
+    RunReader *run=&snapshot->runs[snapshot->run_count++];
+    memset(run, 0, sizeof(*run));
+    run->fd=fd;
+    snapshot->runs_written++;
+
+    return run;
+}
+
+//sorts the records read in memory and writes them as a new run (the record followed by the path)
+static int WriteSortedRun(SortedSnapshot *snapshot, const char *directory){
+
+    if(snapshot->count > 1) qsort_r(snapshot->records, snapshot->count, sizeof(SortRecord), CompareSortRecords, snapshot->paths);
+
+    int fd=CreateTemporaryFile(directory);
+    if(fd == -1) return -1;
+    if(AddRunReader(snapshot, fd) == NULL){
+        close(fd);
+        return -1;
+    }
+
+    struct iovec iov[1024];
+    int count=0;
+    for(size_t i=0; i < snapshot->count; i++){
+        iov[count++]=(struct iovec){&snapshot->records[i], sizeof(SortRecord)};
+        iov[count++]=(struct iovec){snapshot->paths + snapshot->records[i].path_offset, snapshot->records[i].path_length};
+        if((count == 1024 || i + 1 == snapshot->count) && WriteAllBuffers(fd, iov, count) == -1) return -1;
+        if(count == 1024) count=0;
+    }
+    snapshot->count=0;
+    snapshot->paths_length=0;
+
+    return 0;
+}
+
+//copies bytes from the run (reading its next block when the buffer is used), returns the no. of bytes copied or -1
+static ssize_t ReadRunBytes(RunReader *run, void *data, size_t length){
+
+    size_t done=0;
+    while(done < length){
+        if(run->start == run->end){
+            ssize_t bytes=ReadBlock(run->fd, run->buffer, run->buffer_size, run->offset);
+            if(bytes <= 0) return bytes == 0 ? (ssize_t)done : -1;
+            run->offset+=bytes;
+            run->start=0;
+            run->end=bytes;
+        }
+        size_t chunk=run->end - run->start < length - done ? run->end - run->start : length - done;
+        memcpy((char *)data + done, run->buffer + run->start, chunk);
+        run->start+=chunk;
+        done+=chunk;
+    }
+
+    return done;
+}
+
+//reads the next record of a run, returns 1 if a record was read, 0 at the end of the run and -1 in case of errors
+static int NextRunRecord(RunReader *run){
+
+    ssize_t bytes=ReadRunBytes(run, &run->record, sizeof(SortRecord));
+    if(bytes == 0) return 0;
+    if(bytes != sizeof(SortRecord)) return -1;
+
+    if(run->path.capacity < (size_t)run->record.path_length + 1){
+        size_t new_capacity=run->path.capacity ? run->path.capacity : PATH_MAX;
+        while(new_capacity < (size_t)run->record.path_length + 1) new_capacity*=2;
+        char *new_data=realloc(run->path.data, new_capacity);
+        if(new_data == NULL) return -1;
+        run->path.data=new_data;
+        run->path.capacity=new_capacity;
+    }
+    if(ReadRunBytes(run, run->path.data, run->record.path_length) != (ssize_t)run->record.path_length) return -1;
+    run->path.length=run->record.path_length;
+    run->path.data[run->path.length]='\0';
+
+    return 1;
+}
+
+//the runs are ordered by their current path (the run written first for the same path, so the order is deterministic)
+static int CompareRuns(const RunReader *runs, size_t a, size_t b){
+
+    int order=ComparePaths(runs[a].path.data, runs[a].path.length, runs[b].path.data, runs[b].path.length);
+    return order != 0 ? order : (a < b ? -1 : 1);
+}
+
+static void SiftRunHeap(const RunReader *runs, size_t *heap, size_t count, size_t position){
+
+    while(2*position + 1 < count){
+        size_t child=2*position + 1;
+        if(child + 1 < count && CompareRuns(runs, heap[child + 1], heap[child]) < 0) child++;
+        if(CompareRuns(runs, heap[position], heap[child]) <= 0) break;
+        size_t swap=heap[position];
+        heap[position]=heap[child];
+        heap[child]=swap;
+        position=child;
+    }
+}
+
+//starts reading the runs from first to first + count with buffers of buffer_size and builds the heap of the runs
+static int StartRunMerge(SortedSnapshot *snapshot, size_t first, size_t count, size_t buffer_size){
+
+    free(snapshot->heap);
+    snapshot->heap=malloc(count*sizeof(size_t));
+    if(snapshot->heap == NULL) return -1;
+    snapshot->heap_count=0;
+    snapshot->advance_run=0;
+
+    for(size_t i=first; i < first + count; i++){
+        RunReader *run=&snapshot->runs[i];
+        run->buffer=malloc(buffer_size);
+        if(run->buffer == NULL) return -1;
+        run->buffer_size=buffer_size;
+
+        int status=NextRunRecord(run);
+        if(status == -1) return -1;
+        if(status == 1) snapshot->heap[snapshot->heap_count++]=i;
+    }
+    for(size_t i=snapshot->heap_count/2; i-- > 0;) SiftRunHeap(snapshot->runs, snapshot->heap, snapshot->heap_count, i);
+
+    return 0;
+}
+
+//closes a run and frees its buffers
+static void CloseRunReader(RunReader *run){
+
+    if(run->fd != -1) close(run->fd);
+    free(run->buffer);
+    free(run->path.data);
+    memset(run, 0, sizeof(*run));
+    run->fd=-1;
+}
+
+//merges the first count runs into a new run (one pass of the merge), with a buffer of buffer_size for each run
+static int MergeRuns(SortedSnapshot *snapshot, const char *directory, size_t count, size_t buffer_size){
+
+    int fd=CreateTemporaryFile(directory);
+    if(fd == -1) return -1;
+    RecordBuffer output={NULL, 0, 0};
+    int result=StartRunMerge(snapshot, 0, count, buffer_size);
+
+    while(result == 0 && snapshot->heap_count > 0){
+        RunReader *run=&snapshot->runs[snapshot->heap[0]];
+        if(ReserveRecordBuffer(&output, sizeof(SortRecord) + run->path.length) == -1){
+            result=-1;
+            break;
+        }
+        memcpy(output.data + output.length, &run->record, sizeof(SortRecord));
+        memcpy(output.data + output.length + sizeof(SortRecord), run->path.data, run->path.length);
+        output.length+=sizeof(SortRecord) + run->path.length;
+
+        //the output is written in blocks of the size of a run buffer
+        if(output.length >= buffer_size){
+            struct iovec iov={output.data, output.length};
+            if(WriteAllBuffers(fd, &iov, 1) == -1) result=-1;
+            output.length=0;
+        }
+
+        int status=NextRunRecord(run);
+        if(status == -1) result=-1;
+        if(status == 0) snapshot->heap[0]=snapshot->heap[--snapshot->heap_count];
+        SiftRunHeap(snapshot->runs, snapshot->heap, snapshot->heap_count, 0);
+    }
+    if(result == 0 && output.length > 0){
+        struct iovec iov={output.data, output.length};
+        if(WriteAllBuffers(fd, &iov, 1) == -1) result=-1;
+    }
+    free(output.data);
+
+    //the merged runs are replaced by the new run (at the end, so it is merged again only after the other runs)
+    for(size_t i=0; i < count; i++) CloseRunReader(&snapshot->runs[i]);
+    memmove(snapshot->runs, snapshot->runs + count, (snapshot->run_count - count)*sizeof(RunReader));
+    snapshot->run_count-=count;
+    if(result == -1 || AddRunReader(snapshot, fd) == NULL){
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+int OpenSortedSnapshot(SortedSnapshot *snapshot, const char *file_name, size_t memory){
+
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    SnapshotCursor cursor;
+    if(OpenSnapshotCursor(&cursor, file_name) == -1) return -1;
+
+    //half of the memory for the records and half for their paths
+    size_t capacity=memory/2/sizeof(SortRecord), paths_capacity=memory/2;
+    snapshot->records=malloc(capacity*sizeof(SortRecord));
+    snapshot->paths=malloc(paths_capacity);
+    int result=snapshot->records == NULL || snapshot->paths == NULL || ReserveRecordBuffer(&snapshot->filters, cursor.filters_length + 1) == -1 ? -1 : 0;
+    if(result == 0){
+        if(cursor.filters_length > 0) memcpy(snapshot->filters.data, cursor.filters_data, cursor.filters_length);
+        snapshot->filters.length=cursor.filters_length;
+    }
+
+    //the runs are written in the directory of the snapshot
+    char directory[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", file_name);
+    char *slash=strrchr(directory, '/');
+    if(slash == NULL) strcpy(directory, ".");
+    else if(slash == directory) slash[1]='\0';
+    else *slash='\0';
+
+    int status;
+    while(result == 0 && (status=NextSnapshotRecord(&cursor)) != 0){
+        if(status == -1){
+            result=-1;
+            break;
+        }
+
+        //the memory is full => the records are sorted and written as a run
+        if(snapshot->count == capacity || cursor.path.length > paths_capacity - snapshot->paths_length){
+            if(snapshot->count == 0 || WriteSortedRun(snapshot, directory) == -1){
+                result=-1;
+                break;
+            }
+        }
+
+        SortRecord *record=&snapshot->records[snapshot->count++];
+        memset(record, 0, sizeof(*record));
+        record->size=cursor.st.st_size;
+        record->nlink=cursor.st.st_nlink;
+        record->mode=cursor.st.st_mode;
+        record->content_hash=cursor.content_hash;
+        record->flags=cursor.has_content_hash ? RECORD_HAS_CONTENT_HASH : 0;
+        record->path_offset=snapshot->paths_length;
+        record->path_length=cursor.path.length;
+        memcpy(snapshot->paths + snapshot->paths_length, cursor.path.data, cursor.path.length);
+        snapshot->paths_length+=cursor.path.length;
+    }
+    CloseSnapshotCursor(&cursor);
+
+    //a snapshot that fits in the memory is sorted there
+    if(result == 0 && snapshot->run_count == 0){
+        if(snapshot->count > 1) qsort_r(snapshot->records, snapshot->count, sizeof(SortRecord), CompareSortRecords, snapshot->paths);
+        return 0;
+    }
+
+    //otherwise the memory of the records is used for the buffers of the runs, merged in passes while they don't fit
+    if(result == 0 && snapshot->count > 0 && WriteSortedRun(snapshot, directory) == -1) result=-1;
+    free(snapshot->records);
+    free(snapshot->paths);
+    snapshot->records=NULL;
+    snapshot->paths=NULL;
+
+    size_t fan_in=memory/MIN_RUN_BUFFER_SIZE - 1;
+    while(result == 0 && snapshot->run_count > fan_in){
+        if(MergeRuns(snapshot, directory, fan_in, memory/(fan_in + 1)) == -1) result=-1;
+    }
+    if(result == 0) result=StartRunMerge(snapshot, 0, snapshot->run_count, memory/snapshot->run_count);
+
+    if(result == -1){
+        CloseSortedSnapshot(snapshot);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+    NEXT SORTED RECORD FUNCTION
+*/
+int NextSortedRecord(SortedSnapshot *snapshot){
+
+    const SortRecord *record;
+    if(snapshot->run_count == 0){ //sorted in memory
+        if(snapshot->next == snapshot->count) return 0;
+        record=&snapshot->records[snapshot->next++];
+        snapshot->path=snapshot->paths + record->path_offset;
+    }
+    else{
+        //the run of the previous record moves to its next record
+        if(snapshot->advance_run){
+            RunReader *run=&snapshot->runs[snapshot->heap[0]];
+            int status=NextRunRecord(run);
+            if(status == -1) return -1;
+            if(status == 0) snapshot->heap[0]=snapshot->heap[--snapshot->heap_count];
+            SiftRunHeap(snapshot->runs, snapshot->heap, snapshot->heap_count, 0);
+            snapshot->advance_run=0;
+        }
+        if(snapshot->heap_count == 0) return 0;
+
+        RunReader *run=&snapshot->runs[snapshot->heap[0]];
+        record=&run->record;
+        snapshot->path=run->path.data;
+        snapshot->advance_run=1;
+    }
+
+    snapshot->path_length=record->path_length;
+    memset(&snapshot->st, 0, sizeof(snapshot->st));
+    snapshot->st.st_size=record->size;
+    snapshot->st.st_nlink=record->nlink;
+    snapshot->st.st_mode=record->mode;
+    snapshot->content_hash=record->content_hash;
+    snapshot->has_content_hash=(record->flags & RECORD_HAS_CONTENT_HASH) != 0;
+
+    return 1;
+}
+
+
+/*
+    CLOSE SORTED SNAPSHOT FUNCTION
+*/
+void CloseSortedSnapshot(SortedSnapshot *snapshot){
+
+    for(size_t i=0; i < snapshot->run_count; i++) CloseRunReader(&snapshot->runs[i]);
+    free(snapshot->runs);
+    free(snapshot->heap);
+    free(snapshot->records);
+    free(snapshot->paths);
+    free(snapshot->filters.data);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+
+/*
+    SORT MERGE SNAPSHOTS FUNCTION
+*/
+int SortMergeSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, size_t memory, int print_changes){
+
+    //the memory is shared by the two snapshots
+    SortedSnapshot prev, current;
+    if(OpenSortedSnapshot(&prev, prev_snapshot_file_name, memory/2) == -1){
+        fprintf(stderr, "*sort_merge_snapshots* error: Failed to sort the previous snapshot file for  \"%s\"\n", monitored_directory);
+        return -1;
+    }
+    if(OpenSortedSnapshot(&current, current_snapshot_file_name, memory/2) == -1){
+        fprintf(stderr, "*sort_merge_snapshots* error: Failed to sort the current snapshot file for  \"%s\"\n", monitored_directory);
+        CloseSortedSnapshot(&prev);
+        return -1;
+    }
+    if(prev.runs_written > 0 || current.runs_written > 0){
+        fprintf(stdout, "(Sorting) %ld sorted runs written and merged within %zu bytes of memory for  \"%s\"\n", prev.runs_written + current.runs_written, memory, monitored_directory);
+    }
+
+    //the sorted records are merged like in CompareSnapshots, so the changes are printed while they are found
+    long added=0, removed=0, modified=0;
+    char changes[256];
+    int prev_status=NextSortedRecord(&prev), current_status=NextSortedRecord(&current);
+
+    while(prev_status != -1 && current_status != -1 && (prev_status == 1 || current_status == 1)){
+        int order;
+        if(prev_status != 1) order=1;
+        else if(current_status != 1) order=-1;
+        else order=ComparePaths(prev.path, prev.path_length, current.path, current.path_length);
+
+        if(order < 0){
+            if(print_changes) fprintf(stdout, "(Diff) Removed   \"%.*s\"\n", (int)prev.path_length, prev.path);
+            removed++;
+            prev_status=NextSortedRecord(&prev);
+        }
+        else if(order > 0){
+            if(print_changes) fprintf(stdout, "(Diff) Added     \"%.*s\"\n", (int)current.path_length, current.path);
+            added++;
+            current_status=NextSortedRecord(&current);
+        }
+        else{
+            DiffEntry prev_entry, current_entry;
+            memset(&prev_entry, 0, sizeof(prev_entry));
+            memset(&current_entry, 0, sizeof(current_entry));
+            prev_entry.st=prev.st;
+            prev_entry.content_hash=prev.content_hash;
+            prev_entry.has_content_hash=prev.has_content_hash;
+            current_entry.st=current.st;
+            current_entry.content_hash=current.content_hash;
+            current_entry.has_content_hash=current.has_content_hash;
+
+            if(DescribeChanges(changes, sizeof(changes), &prev_entry, &current_entry) > 0){
+                if(print_changes) fprintf(stdout, "(Diff) Modified  \"%.*s\"  (%s)\n", (int)current.path_length, current.path, changes);
+                modified++;
+            }
+            prev_status=NextSortedRecord(&prev);
+            current_status=NextSortedRecord(&current);
+        }
+    }
+
+    int IsDifferent=added > 0 || removed > 0 || modified > 0 || prev.filters.length != current.filters.length ||
+                    (prev.filters.length > 0 && memcmp(prev.filters.data, current.filters.data, prev.filters.length) != 0);
+
+    if(prev_status == -1 || current_status == -1){
+        fprintf(stderr, "*sort_merge_snapshots* error: Failed to read the sorted runs of the %s snapshot for  \"%s\"\n", prev_status == -1 ? "previous" : "current", monitored_directory);
+        IsDifferent=-1;
+    }
+    else if(added > 0 || removed > 0 || modified > 0) fprintf(stdout, "(Comparing) %ld entries added, %ld removed and %ld modified since the previous snapshot for  \"%s\"\n", added, removed, modified, monitored_directory);
+
+    CloseSortedSnapshot(&prev);
+    CloseSortedSnapshot(&current);
+
+    return IsDifferent;
+}
+
+
+/*
+    COMPARE SHARD WORKER FUNCTION
+*/
+//finds the first record of a text snapshot whose "Path: " line starts at or after an offset (the line after an empty
+//line, or the first line of the file), returns 1 if it is found, 0 at the end of the file and -1 in case of errors
+static int FindTextRecord(SnapshotCursor *cursor, uint64_t offset, uint64_t *position){
+
+    //the two bytes before the offset show if it is the start of a line and if the previous line is empty
+    unsigned char before[2]={'\n', '\n'};
+    size_t known=offset < 2 ? offset : 2;
+    if(known > 0 && pread(fileno(cursor->file), before + 2 - known, known, offset - known) != (ssize_t)known) return -1;
+    int line_start=before[1] == '\n', previous_empty=line_start && before[0] == '\n';
+
+    if(fseeko(cursor->file, (off_t)offset, SEEK_SET) == -1) return -1;
+    cursor->pending=0;
+
+    ssize_t line_length;
+    if(!line_start){ //the rest of the line from the offset
+        if((line_length=getline(&cursor->line, &cursor->line_capacity, cursor->file)) == -1) return 0;
+        offset+=line_length;
+    }
+    while((line_length=getline(&cursor->line, &cursor->line_capacity, cursor->file)) != -1){
+        if(previous_empty && strncmp(cursor->line, "Path: ", 6) == 0){
+            *position=offset;
+            return 1;
+        }
+        previous_empty=line_length == 1 && cursor->line[0] == '\n';
+        offset+=line_length;
+    }
+
+    return ferror(cursor->file) ? -1 : 0;
+}
+
+//reads the first record at or after a position (in the path of the cursor), returns 1 if it is found, 0 at the end
+//of the snapshot and -1 in case of errors
+static int ReadRecordAt(SnapshotCursor *cursor, uint64_t position, uint64_t *record_position){
+
+    if(cursor->binary){
+        if(position >= cursor->mapped.header->record_count) return 0;
+        *record_position=position;
+    }
+    else{
+        int status=FindTextRecord(cursor, position, record_position);
+        if(status != 1) return status;
+    }
+
+    if(SeekSnapshotCursor(cursor, *record_position) == -1) return -1;
+    return NextSnapshotRecord(cursor) == 1 ? 1 : -1;
+}
+
+//no. of positions of a snapshot (records in the binary format, bytes in the text format)
+static uint64_t SnapshotPositions(SnapshotCursor *cursor){
+
+    if(cursor->binary) return cursor->mapped.header->record_count;
+
+    struct stat st;
+    return fstat(fileno(cursor->file), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+//position of the next record read by the cursor (the offset after the record read in the text format)
+static uint64_t CursorPosition(SnapshotCursor *cursor){
+
+    return cursor->binary ? cursor->index : (uint64_t)ftello(cursor->file);
+}
+
+//copies a path (for the limits of the shards)
+static int CopyShardPath(PathBuffer *destination, const PathBuffer *source){
+
+    if(destination->capacity < source->length + 1){
+        char *new_data=realloc(destination->data, source->length + 1);
+        if(new_data == NULL) return -1;
+        destination->data=new_data;
+        destination->capacity=source->length + 1;
+    }
+    memcpy(destination->data, source->data, source->length + 1);
+    destination->length=source->length;
+
+    return 0;
+}
+
+//reads the next record of a shard from a cursor, returns 0 after the last record of the shard (checking that the
+//next shard starts there), 1 if a record is read, -1 in case of errors and -2 if the snapshot is not sorted
+static int NextShardRecord(SnapshotCursor *cursor, const CompareShard *shard, uint64_t next_start){
+
+    uint64_t position=CursorPosition(cursor);
+    int status=NextSnapshotRecord(cursor);
+    if(status == 1 && shard->end.length > 0 && ComparePaths(cursor->path.data, cursor->path.length, shard->end.data, shard->end.length) >= 0) status=0;
+    else if(status == 0) position=CursorPosition(cursor);
+
+    //the records of an unsorted snapshot can be outside of their shard or skipped between two shards
+    if(status == 0 && shard->end.length > 0 && position != next_start) return -2;
+
+    return status;
+}
+
+//finds the position of the first record whose path is not before the key (binary search over the positions: all the
+//positions between a record and the previous one lead to the same record), returns 0 on success and -1 in case of errors
+static int FindShardStart(SnapshotCursor *cursor, const char *key, size_t key_length, uint64_t *start){
+
+    uint64_t low=0, high=SnapshotPositions(cursor), record_position;
+    while(low < high){
+        uint64_t middle=low + (high - low)/2;
+        int status=ReadRecordAt(cursor, middle, &record_position);
+        if(status == -1) return -1;
+        if(status == 0 || ComparePaths(cursor->path.data, cursor->path.length, key, key_length) >= 0) high=middle;
+        else low=record_position + 1;
+    }
+
+    int status=ReadRecordAt(cursor, low, &record_position);
+    if(status == -1) return -1;
+    *start=status == 1 ? record_position : SnapshotPositions(cursor);
+
+    return 0;
+}
+
+//appends a formatted line to the changes of a shard
+static int AppendShardOutput(CompareShard *shard, const char *format, ...){
+
+    va_list args;
+    va_start(args, format);
+    int length=vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if(length < 0 || ReserveRecordBuffer(&shard->output, length + 1) == -1) return -1;
+
+    va_start(args, format);
+    vsnprintf(shard->output.data + shard->output.length, length + 1, format, args);
+    va_end(args);
+    shard->output.length+=length;
+
+    return 0;
+}
+
+//compares the records of a shard (like CompareSnapshots), returns 0, -1 in case of errors or -2 if a snapshot is not sorted
+static int CompareShardRecords(const ParallelCompare *compare, size_t index, SnapshotCursor *prev, SnapshotCursor *current){
+
+    CompareShard *shard=&compare->shards[index];
+    if(SeekSnapshotCursor(prev, shard->prev_start) == -1 || SeekSnapshotCursor(current, shard->current_start) == -1) return -1;
+
+    uint64_t prev_next=index + 1 < compare->count ? compare->shards[index + 1].prev_start : 0;
+    uint64_t current_next=index + 1 < compare->count ? compare->shards[index + 1].current_start : 0;
+    int prev_status=NextShardRecord(prev, shard, prev_next), current_status=NextShardRecord(current, shard, current_next);
+
+    //the first records cannot be before the shard
+    if(index > 0){
+        const PathBuffer *start=&compare->shards[index - 1].end;
+        if((prev_status == 1 && ComparePaths(prev->path.data, prev->path.length, start->data, start->length) < 0) ||
+           (current_status == 1 && ComparePaths(current->path.data, current->path.length, start->data, start->length) < 0)) return -2;
+    }
+
+    char changes[256];
+    while((prev_status == 1 || current_status == 1) && prev->sorted && current->sorted){
+        int order;
+        if(prev_status != 1) order=1;
+        else if(current_status != 1) order=-1;
+        else order=ComparePaths(prev->path.data, prev->path.length, current->path.data, current->path.length);
+
+        int result=0;
+        if(order < 0){
+            if(compare->print_changes) result=AppendShardOutput(shard, "(Diff) Removed   \"%s\"\n", prev->path.data);
+            shard->removed++;
+        }
+        else if(order > 0){
+            if(compare->print_changes) result=AppendShardOutput(shard, "(Diff) Added     \"%s\"\n", current->path.data);
+            shard->added++;
+        }
+        else if(compare->print_changes){ //the same changes as SortMergeSnapshots
+            DiffEntry prev_entry, current_entry;
+            memset(&prev_entry, 0, sizeof(prev_entry));
+            memset(&current_entry, 0, sizeof(current_entry));
+            prev_entry.st=prev->st;
+            prev_entry.content_hash=prev->content_hash;
+            prev_entry.has_content_hash=prev->has_content_hash;
+            current_entry.st=current->st;
+            current_entry.content_hash=current->content_hash;
+            current_entry.has_content_hash=current->has_content_hash;
+
+            if(DescribeChanges(changes, sizeof(changes), &prev_entry, &current_entry) > 0){
+                result=AppendShardOutput(shard, "(Diff) Modified  \"%s\"  (%s)\n", current->path.data, changes);
+                shard->modified++;
+            }
+        }
+        else if(prev->st.st_size != current->st.st_size || (prev->st.st_mode & 0777) != (current->st.st_mode & 0777) || prev->st.st_nlink != current->st.st_nlink ||
+                (prev->has_content_hash && current->has_content_hash && prev->content_hash != current->content_hash)) shard->modified++; //the same fields as CompareSnapshots
+        if(result == -1) return -1;
+
+        if(order <= 0) prev_status=NextShardRecord(prev, shard, prev_next);
+        if(order >= 0) current_status=NextShardRecord(current, shard, current_next);
+    }
 
+    if(prev_status == -1 || current_status == -1) return -1;
+    return prev->sorted && current->sorted && prev_status != -2 && current_status != -2 ? 0 : -2;
+}
 
-/*
-    Checks if a directory entry given as parameter has all the access permissions missing and creates a new grandchild 
-    process in that case for running the script and analyzing syntactically the dir entry.
-*/
-void CheckPermissionsAndAnalyze(const char *dir_entry, struct stat permissions, char *isolated_path, int snapshot_fd);
+void *CompareShardWorker(void *arg){
 
+    ParallelCompare *compare=arg;
 
-/*
-    Performs the syntactic analysis for the files that have all the permissions missing by running the scripy 'verifiy_for_malicious'.
-    The result of the analysis is written to the pipe (for transmitting information to the child process)
-*/
-int AnalyzeFile(const char *dir_entry, int pipe_fd);
+    //each thread has its own cursors, moved to the start of every shard it takes
+    SnapshotCursor prev, current;
+    int opened=OpenSnapshotCursor(&prev, compare->prev_file_name) == 0;
+    if(opened && OpenSnapshotCursor(&current, compare->current_file_name) == -1){
+        CloseSnapshotCursor(&prev);
+        opened=0;
+    }
 
+    while(1){
+        size_t index=__atomic_fetch_add(&compare->next, 1, __ATOMIC_RELAXED);
+        if(index >= compare->count) break;
+        CompareShard *shard=&compare->shards[index];
+        shard->status=opened ? CompareShardRecords(compare, index, &prev, &current) : -1;
 
-/*
-    Depending on the result transmitted through the pipe, this function takes the decision of moving the corrupted file
-    to the isolated directory or not.
-*/
-void ResultOfAnalysis(int pipe_fd[2], const char *dir_entry, char *isolated_path, pid_t pid);
+        //the pages of the binary snapshots read for the shard are released (like the cursor does while reading)
+        if(opened && prev.binary) madvise(prev.mapped.map, prev.mapped.map_size, MADV_DONTNEED);
+        if(opened && current.binary) madvise(current.mapped.map, current.mapped.map_size, MADV_DONTNEED);
+    }
+
+    if(opened){
+        CloseSnapshotCursor(&prev);
+        CloseSnapshotCursor(&current);
+    }
+
+    return NULL;
+}
 
 
 /*
-    FUNCTION IMPLEMENTATIONS
-*/
-/*
-    READ DIRECTORIES FUNCTION
+    PARALLEL COMPARE SNAPSHOTS FUNCTION
 */
-void ReadDirectories(const char *path, int snapshot_fd, char *isolated_path){
- 
-    DIR *d = opendir(path);
-    struct dirent *dir_entry;
-    
-    char *entries_path=NULL; //storing the path and name of each directory entry
-    char *file_info=NULL;  //storing information for each directory entry
+int ParallelCompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, int print_changes){
 
-    char *path_copy = strdup(path);
-
-    if(!d){
-        fprintf(stderr, "*read_directories* error: Failed to open the directory  \"%s\"\n", monitored_directory);
-        return;
+    SnapshotCursor prev, current;
+    if(OpenSnapshotCursor(&prev, prev_snapshot_file_name) == -1){
+        fprintf(stderr, "*parallel_compare* error: Failed to open the previous snapshot file for  \"%s\"\n", monitored_directory);
+        return -1;
+    }
+    if(OpenSnapshotCursor(&current, current_snapshot_file_name) == -1){
+        fprintf(stderr, "*parallel_compare* error: Failed to open the current snapshot file for  \"%s\"\n", monitored_directory);
+        CloseSnapshotCursor(&prev);
+        return -1;
     }
 
-    while((dir_entry = readdir(d)) != NULL){
-        //not printing in the snapshot file the entries "." & ".." 
-        if(strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0)  continue;  
- 
-        entries_path=realloc(entries_path, strlen(path) + strlen(dir_entry->d_name) +2); //+2 is for '/' and null terminator
-        
-        if(entries_path == NULL){          
-            fprintf(stderr, "*read_directories* error: Failed to allocate memory for path  \"%s\"\n", path);
-            //if the allocation of memory fails for a file
-            //the loop will break => the directory will not be monitired further     
-            free(file_info);
-            break;
-        }
+    ParallelCompare compare;
+    memset(&compare, 0, sizeof(compare));
+    compare.prev_file_name=prev_snapshot_file_name;
+    compare.current_file_name=current_snapshot_file_name;
+    compare.print_changes=print_changes;
+    size_t shard_count=(size_t)compare_threads*COMPARE_SHARDS_PER_THREAD;
+    compare.shards=calloc(shard_count, sizeof(CompareShard));
+    int result=compare.shards == NULL ? -1 : 0;
 
-        sprintf(entries_path, "%s/%s", path_copy, dir_entry->d_name); //constructing the path of each entry
-        
-        struct stat st;                        //get file information with lstat      
-                                               //& print error message in case of failing  
-        if(lstat(entries_path, &st) == -1){       
-            fprintf(stderr, "*read_directories* error: Failed to get information for file  \"%s\"\n", dir_entry->d_name);      
-            free(entries_path);                              
+    //the shards start at the records of the previous snapshot found at evenly spaced positions (a record found again
+    //is skipped), so their paths have to be increasing
+    uint64_t prev_positions=SnapshotPositions(&prev), record_position;
+    PathBuffer key={NULL, 0, 0};
+    for(size_t i=0; result == 0 && i < shard_count; i++){
+        int status=ReadRecordAt(&prev, prev_positions*i/shard_count, &record_position);
+        if(status != 1){
+            if(status == -1) result=-1;
             break;
         }
-        else CheckPermissionsAndAnalyze(entries_path, st, isolated_path, snapshot_fd);
-       
-        //gets the actual size of each line & used for reallocaating memory 
-        size_t data_length = snprintf(NULL, 0, "Path: %s\nSize: %ld bytes\nAccess Rights: %c%c%c %c%c%c %c%c%c\nHard Links: %ld\n", entries_path, st.st_size, (st.st_mode & S_IRUSR) ? 'r' : '-', (st.st_mode & S_IWUSR) ? 'w' : '-', (st.st_mode & S_IXUSR) ? 'x' : '-', (st.st_mode & S_IRGRP) ? 'r' : '-', (st.st_mode & S_IWGRP) ? 'w' : '-', (st.st_mode & S_IXGRP) ? 'x' : '-' , (st.st_mode & S_IROTH) ? 'r' : '-', (st.st_mode & S_IWOTH) ? 'w' : '-', (st.st_mode & S_IXOTH) ? 'x' : '-', st.st_nlink);
-
-        //reallocating memory for file_info then write in it entries_path & some additional data
-        file_info=realloc(file_info, (data_length+1)); // +1 is for the null terminator
-        if(file_info == NULL){
-            fprintf(stderr, "*read_directories* error: Failed to allocate memory for entry  \"%s\"\n", dir_entry->d_name);
-            free(file_info);
+        if(compare.count > 0){
+            if(record_position <= compare.shards[compare.count - 1].prev_start) continue;
+            if(ComparePaths(prev.path.data, prev.path.length, key.data, key.length) <= 0){
+                result=-2;
+                break;
+            }
+            if(CopyShardPath(&compare.shards[compare.count - 1].end, &prev.path) == -1){
+                result=-1;
+                break;
+            }
+        }
+        if(CopyShardPath(&key, &prev.path) == -1){
+            result=-1;
             break;
         }
+        compare.shards[compare.count++].prev_start=record_position;
+    }
+    free(key.data);
+    if(result == 0 && compare.count == 0){ //an empty previous snapshot => one shard
+        compare.shards[0].prev_start=prev_positions;
+        compare.count=1;
+    }
+
+    //the start of each shard in the current snapshot
+    for(size_t i=0; result == 0 && i < compare.count; i++){
+        if(i == 0){
+            int status=ReadRecordAt(&current, 0, &record_position);
+            if(status == -1) result=-1;
+            compare.shards[0].current_start=status == 1 ? record_position : SnapshotPositions(&current);
+        }
+        else if(FindShardStart(&current, compare.shards[i-1].end.data, compare.shards[i-1].end.length, &compare.shards[i].current_start) == -1) result=-1;
+    }
 
-        sprintf(file_info, "Path: %s\nSize: %ld bytes\nAccess Rights: %c%c%c %c%c%c %c%c%c\nHard Links: %ld\n", entries_path, st.st_size, (st.st_mode & S_IRUSR) ? 'r' : '-', (st.st_mode & S_IWUSR)? 'w' : '-', (st.st_mode & S_IXUSR) ? 'x' : '-', (st.st_mode & S_IRGRP) ? 'r' : '-', (st.st_mode & S_IWGRP) ? 'w' : '-', (st.st_mode & S_IXGRP) ? 'x' : '-' ,(st.st_mode & S_IROTH) ? 'r' : '-', (st.st_mode & S_IWOTH) ? 'w' : '-', (st.st_mode & S_IXOTH) ? 'x' : '-', st.st_nlink);
+    int filters_differ=prev.filters_length != current.filters_length || (prev.filters_length > 0 && memcmp(prev.filters_data, current.filters_data, prev.filters_length) != 0);
+    CloseSnapshotCursor(&prev);
+    CloseSnapshotCursor(&current);
 
-        //writing to the snapshot file the file_info & "\n" after each line
-        write(snapshot_fd, file_info, strlen(file_info));                                               
-        write(snapshot_fd, "\n", 1);   
+    //the shards are compared by the threads (in this thread if none can be created)
+    if(result == 0){
+        int thread_count=compare_threads < (int)compare.count ? compare_threads : (int)compare.count;
+        pthread_t *threads=malloc(thread_count*sizeof(pthread_t));
+        int started=0;
+        while(threads != NULL && started < thread_count && pthread_create(&threads[started], NULL, CompareShardWorker, &compare) == 0) started++;
+        if(started == 0) CompareShardWorker(&compare);
+        for(int i=0; i < started; i++) pthread_join(threads[i], NULL);
+        free(threads);
+    }
+
+    //the results are merged in the order of the shards
+    long added=0, removed=0, modified=0;
+    for(size_t i=0; result == 0 && i < compare.count; i++) if(compare.shards[i].status != 0) result=compare.shards[i].status;
+    for(size_t i=0; result == 0 && i < compare.count; i++){
+        CompareShard *shard=&compare.shards[i];
+        if(shard->output.length > 0) fwrite(shard->output.data, 1, shard->output.length, stdout);
+        added+=shard->added;
+        removed+=shard->removed;
+        modified+=shard->modified;
+    }
+    for(size_t i=0; compare.shards != NULL && i < shard_count; i++){
+        free(compare.shards[i].end.data);
+        free(compare.shards[i].output.data);
+    }
+    free(compare.shards);
 
-        //if an entry is a directory => recursively call again the function with the new path  
-        if(S_ISDIR(st.st_mode)) ReadDirectories(entries_path, snapshot_fd, isolated_path);
+    if(result == -1){
+        fprintf(stderr, "*parallel_compare* error: Failed to compare the snapshots for  \"%s\"\n", monitored_directory);
+        return -1;
     }
+    if(result == -2) return -2; //compared again by one thread
+    if(added > 0 || removed > 0 || modified > 0) fprintf(stdout, "(Comparing) %ld entries added, %ld removed and %ld modified since the previous snapshot (%zu shards compared by %d threads) for  \"%s\"\n", added, removed, modified, compare.count, compare_threads, monitored_directory);
 
-    free(entries_path);
-    free(file_info);
-    closedir(d);     
+    return added > 0 || removed > 0 || modified > 0 || filters_differ;
 }
 
 
 /*
-    CREATE SNAPSHOT FUNCTION    
+    COMPARE SNAPSHOT BYTES FUNCTION
 */
-void CreateSnapshot(char *path, char *output_path, char *isolated_path){
+int CompareSnapshotBytes(const char *prev_snapshot_file_name, const char *current_snapshot_file_name, off_t *first_difference){
 
-    char *dir_name=basename((char *)path);  //from libgen library, gets the name of the input directory
-    monitored_directory=dir_name; //storing the name in the global variable
+    *first_difference=-1;
 
-    DIR *dir_check=opendir(path); //checking if the directory given as argument for monitoring   
-                                  //exist. If the path is incorrect the error message will be printed to stderr 
-                                  //and it will be skipped
-    if(dir_check == NULL){
-        fprintf(stderr, "*create_snapshots* error: The provided directory for monitoring does not exist  \"%s\"\n", dir_name);
-        return;
+    int prev_fd=open(prev_snapshot_file_name, O_RDONLY | O_CLOEXEC);
+    if(prev_fd == -1) return -1;
+    int current_fd=open(current_snapshot_file_name, O_RDONLY | O_CLOEXEC);
+    if(current_fd == -1){
+        close(prev_fd);
+        return -1;
     }
-    closedir(dir_check);
 
-    dir_check=opendir(output_path); //checking if the output directory given as argument exists. 
-                                    //creates the output directory in case of non-existance
-    if(dir_check == NULL) mkdir(output_path, 0777);
-    closedir(dir_check); 
+    struct stat prev_st, current_st;
+    if(fstat(prev_fd, &prev_st) == -1 || fstat(current_fd, &current_st) == -1){
+        close(prev_fd);
+        close(current_fd);
+        return -1;
+    }
 
-    dir_check=opendir(isolated_path); //checking if the isolated directory given as argument exists. 
-                                      //creates the isolated directory in case of non-existance
-    if(dir_check == NULL) mkdir(isolated_path, 0777);
-    closedir(dir_check); 
+    //files with different sizes are different (without reading them)
+    size_t size=prev_st.st_size;
+    if(prev_st.st_size != current_st.st_size || size == 0){
+        close(prev_fd);
+        close(current_fd);
+        return size != 0;
+    }
 
-    //buffer for storing the name of the snapshot file
-    char snapshot_file_name[FILENAME_MAX];
-  
-    time_t now;                                         
-    struct tm *timestamp;  
-    char timestamp_str[32];
+    char *prev_map=mmap(NULL, size, PROT_READ, MAP_PRIVATE, prev_fd, 0);
+    char *current_map=prev_map == MAP_FAILED ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, current_fd, 0);
+    int result=0;
 
-    time(&now); // --> gets the current time
-    timestamp=localtime(&now);
-    strftime(timestamp_str,sizeof(timestamp_str),"%Y.%m.%d_%H:%M:%S", timestamp);
+    if(current_map != MAP_FAILED){
+        madvise(prev_map, size, MADV_SEQUENTIAL);
+        madvise(current_map, size, MADV_SEQUENTIAL);
 
-    //constructing the snapshot file name with: output_path --> directory name --> snapshot number --> and timestamp
-    snprintf(snapshot_file_name, sizeof(snapshot_file_name), "%s/%s_Snapshot_%s.txt", output_path, dir_name, timestamp_str);
-  
-    int snapshot_fd=open(snapshot_file_name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR); 
-    if(snapshot_fd == -1){
-        fprintf(stderr, "*create_snapshots* error: Failed to open the snapshot file for  \"%s\"\n", dir_name);
-        return;
+        //memcmp of glibc compares with vector instructions, so only the block that differs is searched byte by byte
+        for(size_t offset=0; offset < size && !result; offset+=COMPARE_BLOCK_SIZE){
+            size_t length=size - offset < COMPARE_BLOCK_SIZE ? size - offset : COMPARE_BLOCK_SIZE;
+            if(memcmp(prev_map + offset, current_map + offset, length) == 0) continue;
+
+            size_t i=0;
+            while(prev_map[offset + i] == current_map[offset + i]) i++;
+            *first_difference=(off_t)(offset + i);
+            result=1;
+        }
+        munmap(current_map, size);
     }
+    else{ //the files can't be mapped => reading them in large blocks
+        char *prev_buffer=malloc(COMPARE_BLOCK_SIZE);
+        char *current_buffer=malloc(COMPARE_BLOCK_SIZE);
+        if(prev_buffer == NULL || current_buffer == NULL) result=-1;
 
-    clock_t start=clock();  //getting the cpu time used for the read_directories function
-    ReadDirectories(path, snapshot_fd, isolated_path);
-    clock_t end=clock();
+        for(size_t offset=0; offset < size && !result; offset+=COMPARE_BLOCK_SIZE){
+            size_t length=size - offset < COMPARE_BLOCK_SIZE ? size - offset : COMPARE_BLOCK_SIZE;
+            if(ReadBlock(prev_fd, prev_buffer, length, offset) != (ssize_t)length || ReadBlock(current_fd, current_buffer, length, offset) != (ssize_t)length){
+                result=-1; //one of the files was changed while comparing it
+                break;
+            }
+            if(memcmp(prev_buffer, current_buffer, length) == 0) continue;
 
-    double time=(double)(end-start)/CLOCKS_PER_SEC;  
-   
-    if(snapshot_fd != -1) fprintf(stdout, "(Creating) Snapshot created successfully for  \"%s\"  in %g (s)\n", dir_name, time);
-    
-    close(snapshot_fd);
-    GetPreviousSnapshotThenCompare(output_path, snapshot_file_name);
+            size_t i=0;
+            while(prev_buffer[i] == current_buffer[i]) i++;
+            *first_difference=(off_t)(offset + i);
+            result=1;
+        }
+        free(prev_buffer);
+        free(current_buffer);
+    }
+    if(prev_map != MAP_FAILED) munmap(prev_map, size);
+
+    close(prev_fd);
+    close(current_fd);
+
+    return result;
 }
 
 
 /*
-    GET PREVIOUS SNAPSHOT THEN COMPARE FUNCTION
+    READ BLOCK FUNCTION
 */
-void GetPreviousSnapshotThenCompare(const char *output_path, const char *snapshot_file_name){
-
-    DIR *d=opendir(output_path);
-    struct dirent *dir_entry;
-                                                                                      
-    if(!d){
-        fprintf(stderr, "*get_prev_snapshot* error: Failed to open the output directory  \"%s\"\n", monitored_directory);
-        return;
-    }
-
-    int prev_snapshot_no=0;
-    int current_snapshot_no=1;
-    char prev_snapshot_file_name[FILENAME_MAX];
+ssize_t ReadBlock(int fd, char *buffer, size_t length, off_t offset){
 
-    //parsing through all the snapshot files from the output that starts with
-    //directory name that is monitored
-    while((dir_entry = readdir(d)) != NULL){
+    size_t done=0;
 
-        if(!(strstr(dir_entry->d_name, monitored_directory) == dir_entry->d_name && strstr(dir_entry->d_name, "_Snapshot_") != NULL)) continue;
-
-        if(prev_snapshot_no < current_snapshot_no){
-            strcpy(prev_snapshot_file_name, output_path);    //--> constructing the name of the previous
-            strcat(prev_snapshot_file_name, "/");            //    snapshot file
-            strcat(prev_snapshot_file_name, dir_entry->d_name);
-        }
-        prev_snapshot_no++;   
-    }
-    
-    //if in the folder is not a previous snapshot => no comparison will be made
-    if(prev_snapshot_no < 2){
-        fprintf(stdout, "(Comparing) No snapshots were previously created for  \"%s\"\n", monitored_directory);
-        return;
+    while(done < length){
+        ssize_t nread=pread(fd, buffer + done, length - done, offset + done);
+        if(nread == -1 && errno == EINTR) continue;
+        if(nread == -1) return -1;
+        if(nread == 0) break;
+        done+=nread;
     }
-        
-    int IsDifferent=CompareSnapshots(prev_snapshot_file_name, snapshot_file_name);
 
-    if(!IsDifferent){   //in case no difference is found
-        fprintf(stdout, "(Comparing) No differences found between the current and the previous snapshot for  \"%s\"\n", monitored_directory);
-        unlink(prev_snapshot_file_name); //deleting the previous snapshot file name
-    }
-    else{
-        fprintf(stdout, "(Comparing) Difference found between the current and the previous snapshot => Overriding the previous snapshot for  \"%s\"\n", monitored_directory);
-        unlink(prev_snapshot_file_name);  //deleting the previous snapshot file name
-        rename(snapshot_file_name, prev_snapshot_file_name);  //renaming the current snapshot
-    } 
-    
-    closedir(d);
+    return done;
 }
 
 
 /*
-    COMPARE SNAPSHOTS FUNCTION
+    COMPARE BINARY SNAPSHOTS FUNCTION
 */
-int CompareSnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name){
+int CompareBinarySnapshots(const char *prev_snapshot_file_name, const char *current_snapshot_file_name){
 
-    int snapshot_fd_current=open(current_snapshot_file_name, O_RDONLY, S_IRUSR); //opening the current snapshot file in reading mode
-    if(snapshot_fd_current == -1){
-        fprintf(stderr, "*compare_snapshots* error: Failed to open the current snapshot file for  \"%s\"\n", monitored_directory);
+    MappedSnapshot prev, current;
+    if(MapSnapshot(prev_snapshot_file_name, &prev) == -1){
+        fprintf(stderr, "*compare_snapshots* error: The previous snapshot file is not valid for  \"%s\"\n", monitored_directory);
         return -1;
     }
-
-    int snapshot_fd_prev=open(prev_snapshot_file_name, O_RDONLY, S_IRUSR); //opening the previous snapshot file in reading 
-                                                                            //and writing mode
-    if(snapshot_fd_prev == -1){
-        fprintf(stderr, "*compare_snapshots* error: Failed to open the previous snapshot file for  \"%s\"\n", monitored_directory);
+    if(MapSnapshot(current_snapshot_file_name, &current) == -1){
+        fprintf(stderr, "*compare_snapshots* error: The current snapshot file is not valid for  \"%s\"\n", monitored_directory);
+        UnmapSnapshot(&prev);
         return -1;
     }
 
-    char current_line[MAX_LINE]; //buffers for storing the lines of the  
-    char prev_line[MAX_LINE];    //snapshots that are compared
+    const SnapshotFileHeader *a=prev.header, *b=current.header;
 
-    int IsDifferent=0; //flag
-    
-    ssize_t current_read, prev_read;
-
-    do{ 
-        current_read=read(snapshot_fd_current, current_line, sizeof(current_line)-1);
-        prev_read=read(snapshot_fd_prev, prev_line, sizeof(prev_line)-1);
+    //the tables of paths are equal only if the paths are equal (they are encoded the same way)
+    int IsDifferent=a->record_count != b->record_count || a->restart_interval != b->restart_interval ||
+                    a->strings_length != b->strings_length || a->filters_length != b->filters_length ||
+                    memcmp(prev.map + a->filters_offset, current.map + b->filters_offset, a->filters_length) != 0 ||
+                    memcmp(prev.strings, current.strings, a->strings_length) != 0;
 
-        current_line[current_read]='\0';
-        prev_line[prev_read]='\0';
-
-        if((current_read!=prev_read) || strcmp(current_line, prev_line)!=0){
-            IsDifferent=1;  
-            break;
-        }
+    for(uint64_t i=0; !IsDifferent && i < a->record_count; i++){
+        SnapshotFileRecord prev_record, current_record;
+        ReadSnapshotRecord(&prev, i, &prev_record);
+        ReadSnapshotRecord(&current, i, &current_record);
+        const SnapshotFileRecord *x=&prev_record, *y=&current_record;
+        if(x->path_offset != y->path_offset || x->size != y->size || (x->mode & 0777) != (y->mode & 0777) || x->nlink != y->nlink ||
+           ((x->flags & y->flags & RECORD_HAS_CONTENT_HASH) && x->content_hash != y->content_hash)) IsDifferent=1;
     }
-    while(current_read > 0 && prev_read > 0); //reading and comparing untill end of files
 
-    close(snapshot_fd_current);
-    close(snapshot_fd_prev);
+    UnmapSnapshot(&prev);
+    UnmapSnapshot(&current);
 
     return IsDifferent;
 }
@@ -313,17 +8568,27 @@ void CheckPermissionsAndAnalyze(const char *dir_entry, struct stat permissions,
 
     pid_t pid;
 
-    int pipe_fd[2];
-    if(pipe(pipe_fd) == -1){
-        write(STDERR_FILENO, "*check_permissions* error: pipe() failed!\n", strlen("*check_permissions* error: pipe() failed!\n"));
-        return;
-    }
-
     //checking if all the permissions are missing
     if(!(permissions.st_mode & S_IXUSR) && !(permissions.st_mode & S_IRUSR) && !(permissions.st_mode & S_IWUSR) && !(permissions.st_mode & S_IRGRP) && 
     !(permissions.st_mode & S_IWGRP) && !(permissions.st_mode & S_IXGRP) && !(permissions.st_mode & S_IROTH) && !(permissions.st_mode & S_IWOTH) && 
     !(permissions.st_mode & S_IXOTH)){     //if all of them are missing => syntactic analysis will be perfomed
 
+        //another hard link of the same inode was already analyzed => reusing its result
+        InodeInfo *inode_info=LookupInodeInfo(&permissions);
+        if(inode_info != NULL && inode_info->analyzed){
+            fprintf(stdout,"(Checking Permissions) \"%s\" from \"%s\" has no access rights => Reusing the analysis of another hard link!\n", basename((char *)dir_entry), monitored_directory);
+            HandleAnalysisResult(inode_info->analysis_status, dir_entry, isolated_path);
+            count_reused_analyses++;
+            return;
+        }
+
+        //the pipe is created only for the entries that are analyzed (otherwise its fds would stay open for every entry)
+        int pipe_fd[2];
+        if(pipe(pipe_fd) == -1){
+            write(STDERR_FILENO, "*check_permissions* error: pipe() failed!\n", strlen("*check_permissions* error: pipe() failed!\n"));
+            return;
+        }
+
         fprintf(stdout,"(Checking Permissions) \"%s\" from \"%s\" has no access rights => Performing Syntactic Anaysis!\n", basename((char *)dir_entry), monitored_directory);
         
         int file_status;
@@ -346,8 +8611,13 @@ void CheckPermissionsAndAnalyze(const char *dir_entry, struct stat permissions,
             return;
         }   
         else {
-            ResultOfAnalysis(pipe_fd, dir_entry, isolated_path, pid);
+            int file_status=ResultOfAnalysis(pipe_fd, dir_entry, isolated_path);
             wait(NULL);
+
+            if(inode_info != NULL){
+                inode_info->analyzed=1;
+                inode_info->analysis_status=file_status;
+            }
         }
 
         fprintf(stdout, "Grandchild Process %d.%d terminated with PID %d and exit code %d for file  \"%s\"  from  \"%s\"\n", count_processes, count_grandchild_procesess, getpid(), pid, basename((char *)dir_entry), monitored_directory);
@@ -382,7 +8652,7 @@ int AnalyzeFile(const char *dir_entry, int pipe_fd){
 /*
     RESULT OF ANALYSIS FUNCTION
 */
-void ResultOfAnalysis(int pipe_fd[2], const char *dir_entry, char *isolated_path, pid_t pid){
+int ResultOfAnalysis(int pipe_fd[2], const char *dir_entry, char *isolated_path){
 
     close(pipe_fd[1]); //close write end of the pipe
     int file_status;
@@ -390,6 +8660,16 @@ void ResultOfAnalysis(int pipe_fd[2], const char *dir_entry, char *isolated_path
     read(pipe_fd[0], &file_status, sizeof(file_status)); //read result from the pipe
     close(pipe_fd[0]); //close read end of the pipe
 
+    HandleAnalysisResult(file_status, dir_entry, isolated_path);
+    return file_status;
+}
+
+
+/*
+    HANDLE ANALYSIS RESULT FUNCTION
+*/
+void HandleAnalysisResult(int file_status, const char *dir_entry, char *isolated_path){
+
     if(file_status != 0){ //if status is 0, the file is safe, otherwise it will be moved to the isolated directory with rename function
         
         if(isolated_path[strlen(isolated_path) - 1] != '/') strcat(isolated_path, "/"); //if the path of the isolated path is not ending with char '\' then 
@@ -409,10 +8689,273 @@ void ResultOfAnalysis(int pipe_fd[2], const char *dir_entry, char *isolated_path
 }
 
 
+/*
+    PARSE SIZE FUNCTION
+*/
+int ParseSize(const char *text, size_t *size){
+
+    char *end;
+    errno=0;
+    unsigned long long value=strtoull(text, &end, 10);
+    if(errno != 0 || end == text || text[0] == '-') return -1;
+
+    switch(*end){
+        case 'G': case 'g': value<<=10; //fall through
+        case 'M': case 'm': value<<=10; //fall through
+        case 'K': case 'k': value<<=10; end++; break;
+        case '\0': break;
+        default: return -1;
+    }
+    if(*end != '\0' || value == 0) return -1;
+
+    *size=(size_t)value;
+    return 0;
+}
+
+
+/*
+    IS OPTION FUNCTION
+*/
+int IsOption(const char *argument){
+
+    return strncmp(argument, "--", 2) == 0;
+}
+
+
+/*
+    PARSE OPTION FUNCTION
+*/
+void ParseOption(const char *argument){
+
+    const char *value=strchr(argument, '=');
+    size_t name_length=value ? (size_t)(value - argument) : strlen(argument);
+    if(value) value++;
+
+    if(name_length == strlen("--dir-buffer") && strncmp(argument, "--dir-buffer", name_length) == 0){
+        //the buffer must fit at least one record of getdents64 (a name has maximum 255 characters)
+        if(value == NULL || ParseSize(value, &dir_buffer_size) == -1 || dir_buffer_size < 4096){
+            fprintf(stderr, "error: Invalid value for \"--dir-buffer\" (minimum 4K)! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(name_length == strlen("--threads") && strncmp(argument, "--threads", name_length) == 0){
+        char *end=NULL;
+        long threads=value ? strtol(value, &end, 10) : 0;
+        if(value == NULL || *end != '\0' || threads < 1 || threads > MAX_SCAN_THREADS){
+            fprintf(stderr, "error: Invalid value for \"--threads\" (between 1 and %d)! => Exiting program!\n", MAX_SCAN_THREADS);
+            exit(EXIT_FAILURE);
+        }
+        scan_threads=(int)threads;
+    }
+    else if(name_length == strlen("--uring-depth") && strncmp(argument, "--uring-depth", name_length) == 0){
+        char *end=NULL;
+        long depth=value ? strtol(value, &end, 10) : 0;
+        if(value == NULL || *end != '\0' || depth < 1 || depth > MAX_URING_DEPTH){
+            fprintf(stderr, "error: Invalid value for \"--uring-depth\" (between 1 and %d)! => Exiting program!\n", MAX_URING_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        uring_depth=(unsigned int)depth;
+    }
+    else if(name_length == strlen("--incremental") && strncmp(argument, "--incremental", name_length) == 0){
+        if(value == NULL) incremental_mode=1;
+        else if(strcmp(value, "prune") == 0) incremental_mode=2;
+        else{
+            fprintf(stderr, "error: Invalid value for \"--incremental\" (only \"--incremental=prune\")! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        statx_mask|=STATX_INO | STATX_MTIME | STATX_CTIME; //the cache identifies the directories by inode, mtime and ctime
+    }
+    else if((name_length == strlen("--exclude") && strncmp(argument, "--exclude", name_length) == 0) ||
+            (name_length == strlen("--include") && strncmp(argument, "--include", name_length) == 0)){
+        if(value == NULL || AddFilterRule(value, argument[2] == 'i') == -1){
+            fprintf(stderr, "error: Invalid pattern for \"%.*s\"! => Exiting program!\n", (int)name_length, argument);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(name_length == strlen("--filter-file") && strncmp(argument, "--filter-file", name_length) == 0){
+        if(value == NULL || ReadFilterFile(value) == -1){
+            fprintf(stderr, "error: Invalid filter file for \"--filter-file\"! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(name_length == strlen("--write-buffer") && strncmp(argument, "--write-buffer", name_length) == 0){
+        if(value == NULL || ParseSize(value, &write_buffer_size) == -1 || write_buffer_size < 4096 || write_buffer_size > MAX_WRITE_BUFFER_SIZE){
+            fprintf(stderr, "error: Invalid value for \"--write-buffer\" (between 4K and 256M)! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(name_length == strlen("--write-uring") && strncmp(argument, "--write-uring", name_length) == 0){
+        if(value != NULL){
+            fprintf(stderr, "error: The option \"--write-uring\" has no value! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        write_uring=1;
+    }
+    else if(name_length == strlen("--one-file-system") && strncmp(argument, "--one-file-system", name_length) == 0){
+        if(value != NULL){
+            fprintf(stderr, "error: The option \"--one-file-system\" has no value! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        one_file_system=1;
+    }
+    else if(name_length == strlen("--format") && strncmp(argument, "--format", name_length) == 0){
+        if(value != NULL && strcmp(value, "text") == 0) binary_snapshots=0;
+        else if(value != NULL && strcmp(value, "binary") == 0){
+            binary_snapshots=1;
+            statx_mask|=STATX_MTIME; //the binary records have the mtime too
+        }
+        else{
+            fprintf(stderr, "error: Invalid value for \"--format\" (\"text\" or \"binary\")! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(name_length == strlen("--diff") && strncmp(argument, "--diff", name_length) == 0){
+        if(value != NULL){
+            fprintf(stderr, "error: The option \"--diff\" has no value! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        diff_mode=1;
+    }
+    else if(name_length == strlen("--journal") && strncmp(argument, "--journal", name_length) == 0){
+        char *end=NULL;
+        long percent=value ? strtol(value, &end, 10) : DEFAULT_JOURNAL_COMPACTION;
+        if((value != NULL && *end != '\0') || percent < 1 || percent > 1000){
+            fprintf(stderr, "error: Invalid value for \"--journal\" (between 1 and 1000 percent)! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        journal_compaction=(int)percent;
+    }
+    else if(name_length == strlen("--compare-memory") && strncmp(argument, "--compare-memory", name_length) == 0){
+        if(value == NULL || ParseSize(value, &compare_memory) == -1 || compare_memory < MIN_COMPARE_MEMORY){
+            fprintf(stderr, "error: Invalid value for \"--compare-memory\" (minimum 4M)! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(name_length == strlen("--watch") && strncmp(argument, "--watch", name_length) == 0){
+        char *end=NULL;
+        long latency=value ? strtol(value, &end, 10) : DEFAULT_WATCH_LATENCY;
+        if((value != NULL && *end != '\0') || latency < 1 || latency > 60000){
+            fprintf(stderr, "error: Invalid value for \"--watch\" (between 1 and 60000 ms)! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        watch_latency=(int)latency;
+    }
+    else if(name_length == strlen("--watch-backend") && strncmp(argument, "--watch-backend", name_length) == 0){
+        if(value != NULL && strcmp(value, "inotify") == 0) watch_fanotify=0;
+        else if(value != NULL && strcmp(value, "fanotify") == 0) watch_fanotify=1;
+        else{
+            fprintf(stderr, "error: Invalid value for \"--watch-backend\" (\"inotify\" or \"fanotify\")! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(name_length == strlen("--compare-threads") && strncmp(argument, "--compare-threads", name_length) == 0){
+        char *end=NULL;
+        long threads=value ? strtol(value, &end, 10) : 0;
+        if(value == NULL || *end != '\0' || threads < 1 || threads > MAX_COMPARE_THREADS){
+            fprintf(stderr, "error: Invalid value for \"--compare-threads\" (between 1 and %d threads)! => Exiting program!\n", MAX_COMPARE_THREADS);
+            exit(EXIT_FAILURE);
+        }
+        compare_threads=(int)threads;
+    }
+    else if(name_length == strlen("--history") && strncmp(argument, "--history", name_length) == 0){
+        char *end=NULL;
+        long generations=value ? strtol(value, &end, 10) : DEFAULT_HISTORY_GENERATIONS;
+        if((value != NULL && *end != '\0') || generations < 1 || generations > 10000){
+            fprintf(stderr, "error: Invalid value for \"--history\" (between 1 and 10000 generations)! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        history_generations=(int)generations;
+        if(journal_compaction == 0) journal_compaction=DEFAULT_JOURNAL_COMPACTION; //the generations are the compacted journals
+    }
+    else if(name_length == strlen("--content-hash") && strncmp(argument, "--content-hash", name_length) == 0){
+        char *end=NULL;
+        long threads=value ? strtol(value, &end, 10) : DEFAULT_CONTENT_HASH_THREADS;
+        if((value != NULL && *end != '\0') || threads < 1 || threads > MAX_CONTENT_HASH_THREADS){
+            fprintf(stderr, "error: Invalid value for \"--content-hash\" (between 1 and %d threads)! => Exiting program!\n", MAX_CONTENT_HASH_THREADS);
+            exit(EXIT_FAILURE);
+        }
+        content_hash_threads=(int)threads;
+        statx_mask|=STATX_INO | STATX_MTIME | STATX_CTIME; //the hash cache identifies the files by inode, mtime and ctime
+    }
+    else if(name_length == strlen("--max-open-dirs") && strncmp(argument, "--max-open-dirs", name_length) == 0){
+        char *end=NULL;
+        long limit=value ? strtol(value, &end, 10) : 0;
+        if(value == NULL || *end != '\0' || limit < 2 || limit > 1000000){ //the root and the current directory stay open
+            fprintf(stderr, "error: Invalid value for \"--max-open-dirs\" (minimum 2)! => Exiting program!\n");
+            exit(EXIT_FAILURE);
+        }
+        max_open_dirs=(int)limit;
+    }
+    else{
+        fprintf(stderr, "error: Unknown option \"%s\"! => Exiting program!\n", argument);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
 int main(int argc, char *argv[]){
 
     write(STDOUT_FILENO,"\n",1);
 
+    //comparing two snapshot files given as arguments (no directory is monitored)
+    if(argc >= 2 && strcmp(argv[1], "--compare") == 0){
+        //the options (e.g. "--compare-memory=SIZE") can be given with the two snapshot files
+        const char *files[2];
+        int file_count=0;
+        for(int i=2; i < argc; i++){
+            if(strncmp(argv[i], "--", 2) == 0) ParseOption(argv[i]);
+            else if(file_count < 2) files[file_count++]=argv[i];
+            else file_count=3;
+        }
+        if(file_count != 2){
+            write(STDERR_FILENO, "error: Usage: --compare [OPTIONS] PREVIOUS CURRENT => Exiting program!\n", strlen("error: Usage: --compare [OPTIONS] PREVIOUS CURRENT => Exiting program!\n"));
+            exit(EXIT_FAILURE);
+        }
+        monitored_directory=files[1];
+        BuildPermissionTable();
+        int IsDifferent=DiffSnapshots(files[0], files[1]);
+        if(IsDifferent == -1) exit(EXIT_FAILURE);
+        if(!IsDifferent) fprintf(stdout, "(Comparing) No differences found between  \"%s\"  and  \"%s\"\n", files[0], files[1]);
+        exit(EXIT_SUCCESS);
+    }
+
+    //converting a snapshot between the text and the binary format (no directory is monitored)
+    if(argc >= 2 && strcmp(argv[1], "--convert") == 0){
+        if(argc != 4){
+            write(STDERR_FILENO, "error: Usage: --convert INPUT OUTPUT => Exiting program!\n", strlen("error: Usage: --convert INPUT OUTPUT => Exiting program!\n"));
+            exit(EXIT_FAILURE);
+        }
+        monitored_directory=argv[2];
+        BuildPermissionTable();
+        if(ConvertSnapshot(argv[2], argv[3]) == -1) exit(EXIT_FAILURE);
+        fprintf(stdout, "(Converting) Snapshot converted successfully to  \"%s\"\n", argv[3]);
+        exit(EXIT_SUCCESS);
+    }
+
+    //rebuilding the snapshot of a monitored directory at a given time from its history (no directory is monitored)
+    if(argc >= 2 && strcmp(argv[1], "--at") == 0){
+        if(argc != 6){
+            write(STDERR_FILENO, "error: Usage: --at OUTPUT_DIR DIR_NAME TIMESTAMP OUTPUT => Exiting program!\n", strlen("error: Usage: --at OUTPUT_DIR DIR_NAME TIMESTAMP OUTPUT => Exiting program!\n"));
+            exit(EXIT_FAILURE);
+        }
+        monitored_directory=argv[3];
+        BuildPermissionTable();
+        if(RebuildSnapshotAt(argv[2], argv[3], argv[4], argv[5]) == -1) exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
+    //printing the changes of a path from the history of a monitored directory (no directory is monitored)
+    if(argc >= 2 && strcmp(argv[1], "--changes") == 0){
+        if(argc != 5){
+            write(STDERR_FILENO, "error: Usage: --changes OUTPUT_DIR DIR_NAME PATH => Exiting program!\n", strlen("error: Usage: --changes OUTPUT_DIR DIR_NAME PATH => Exiting program!\n"));
+            exit(EXIT_FAILURE);
+        }
+        monitored_directory=argv[3];
+        BuildPermissionTable();
+        if(PrintPathHistory(argv[2], argv[3], argv[4]) == -1) exit(EXIT_FAILURE);
+        exit(EXIT_SUCCESS);
+    }
+
     if(argc<6){   // minimum 6 arguments because now I need "-o" and the output dir, "-s" and the isolated dir,
                   // the ./a.out and the rest of the paths to directories that will be monitored
         write(STDERR_FILENO, "error: Not enough arguments! => Exiting program!\n", strlen("error: Not enough arguments! => Exiting program!\n"));
@@ -425,7 +8968,8 @@ int main(int argc, char *argv[]){
 
     //parsing through all the arguments for error handling
     for(int i=0;i<argc;i++){           
-        if(strcmp(argv[i],"-o")==0){  
+        if(i>0 && IsOption(argv[i])) ParseOption(argv[i]);  //options like "--dir-buffer=SIZE"
+        else if(strcmp(argv[i],"-o")==0){  
             o_count++;      
             output_path=argv[i+1];
         }
@@ -471,7 +9015,24 @@ int main(int argc, char *argv[]){
         }
     }
 
+    BuildPermissionTable(); //used for encoding the records of the snapshots
+
+    //the filters are compiled once, before creating the child processes
+    if(CompileFilters(&filters) == -1){
+        write(STDERR_FILENO, "error: Failed to allocate memory for the filters! => Exiting program!\n", strlen("error: Failed to allocate memory for the filters! => Exiting program!\n"));
+        exit(EXIT_FAILURE);
+    }
+
     pid_t pid;
+    pid_t *children=calloc(argc, sizeof(pid_t)); //with "--watch" a SIGINT or SIGTERM of the parent is passed to them
+    int child_count=0;
+    if(watch_latency > 0){
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler=StopWatching;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
 
     //parsing again through all the argument
     for(int i=1;i<argc;i++){  
@@ -479,6 +9040,7 @@ int main(int argc, char *argv[]){
         //basically if the argument is "-o" then the next one is the output directory so we skip them
         //the same for "-s" and the isolate directory
         if((strcmp(argv[i],"-o")==0 && i+1<argc) || (strcmp(argv[i],"-s")==0 && i+1<argc)) i++; 
+        else if(IsOption(argv[i])) continue; //the options were already parsed
        
         else{ //the rest of the arguments are directories that are monitored
             char *path = argv[i];  
@@ -486,24 +9048,31 @@ int main(int argc, char *argv[]){
             count_processes++;
 
             if(pid == 0){      
-                CreateSnapshot(path, output_path, isolated_path); 
+                if(watch_latency > 0) WatchDirectory(path, output_path, isolated_path);
+                else CreateSnapshot(path, output_path, isolated_path, NULL);
                 fprintf(stdout,"Child Process %d terminated with PID %d and %d files with potential danger for  \"%s\"\n", count_processes, getpid(), count_corrupted, monitored_directory);
+                free(children);
                 return EXIT_SUCCESS;
             }
             else if(pid < 0){
                 write(STDERR_FILENO,"*main* error: fork() for child failed!\n", strlen("*main* error: fork() for child failed!\n"));
                 return EXIT_FAILURE;
             }
+            else if(children != NULL) children[child_count++]=pid;
         }
     }
 
     for(int i=1;i<argc;i++){ 
         if((strcmp(argv[i],"-o")==0 && i+1<argc) || (strcmp(argv[i],"-s")==0 && i+1<argc)) i++;
+        else if(IsOption(argv[i])) continue;
         else{
             write(STDOUT_FILENO,"\n",1);
-            wait(NULL); //waiting for a child process to end
+            while(wait(NULL) == -1 && errno == EINTR){ //waiting for a child process to end
+                for(int c=0; c < child_count; c++) kill(children[c], SIGTERM);
+            }
         }
     }
+    free(children);
 
     write(STDOUT_FILENO,"\n",1);
     return EXIT_SUCCESS;